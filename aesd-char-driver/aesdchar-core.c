@@ -0,0 +1,395 @@
+/**
+ * @file aesdchar-core.c
+ * @brief Kernel-independent read/write/seek logic of the AESD char driver
+ *
+ * Everything here operates on a struct aesd_core and is shared by the kernel
+ * module (main.c) and the userspace harness (harness/).
+ *
+ */
+
+#ifdef __KERNEL__
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/string.h>
+#include <linux/printk.h>
+#include <linux/fs.h> // SEEK_SET and friends
+#endif
+
+#include "aesdchar-core.h"
+
+void aesd_core_init(struct aesd_core *core)
+{
+    memset(core, 0, sizeof(*core));
+    mutex_init(&core->lock);
+    aesd_circular_buffer_init(&core->cmd_history);
+}
+
+/**
+ * @brief Free all history entries and any partially collected command
+ */
+void aesd_core_free(struct aesd_core *core)
+{
+    struct aesd_buffer_entry *entry;
+    uint8_t idx;
+
+    AESD_CIRCULAR_BUFFER_FOREACH(entry, &core->cmd_history, idx) {
+        if (entry->buffptr) {
+            kfree(entry->buffptr);
+            entry->buffptr = NULL;
+            entry->size = 0;
+        }
+    }
+    aesd_circular_buffer_init(&core->cmd_history);
+    core->generation++;
+
+    kfree(core->incomplete_cmd.buffptr);
+    core->incomplete_cmd.buffptr = NULL;
+    core->incomplete_cmd.size = 0;
+    core->incomplete_cap = 0;
+    core->incomplete_scanned = 0;
+}
+
+static unsigned int aesd_entries_in_use(const struct aesd_circular_buffer *buf)
+{
+    if (buf->full)
+        return AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    return (buf->in_offs + AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - buf->out_offs)
+           % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+}
+
+/**
+ * @brief Resume a sequential read from the cursor without walking the history
+ *
+ * @return the entry to read from, with *entry_byte_off and *cmd set, or NULL
+ *      at end of data. Only valid if the cursor matches the position and the
+ *      history has not wrapped since it was saved.
+ */
+static struct aesd_buffer_entry *aesd_cursor_resume(struct aesd_core *dev, const struct aesd_cursor *cursor,
+            size_t *entry_byte_off, unsigned int *cmd)
+{
+    unsigned int in_use = aesd_entries_in_use(&dev->cmd_history);
+    unsigned int n = cursor->cmd;
+    size_t off = cursor->offset;
+
+    while (n < in_use) {
+        struct aesd_buffer_entry *entry =
+            &dev->cmd_history.entry[(dev->cmd_history.out_offs + n) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+
+        if (off < entry->size) {
+            *entry_byte_off = off;
+            *cmd = n;
+            return entry;
+        }
+        /* Finished this command last time; continue with the next one */
+        n++;
+        off = 0;
+    }
+    return NULL;
+}
+
+/**
+ * @param cursor optional per-open read cursor. When it still describes *f_pos
+ *      the read resumes from it directly; otherwise the position is resolved
+ *      from the start of the history and the cursor is refreshed.
+ */
+ssize_t aesd_core_read(struct aesd_core *dev, struct aesd_cursor *cursor, char __user *buf,
+            size_t count, loff_t *f_pos)
+{
+    struct aesd_buffer_entry *entry = NULL;
+    size_t entry_byte_off = 0;
+    size_t bytes_avail_in_entry;
+    size_t bytes_to_copy;
+    unsigned int cmd = 0;
+    ssize_t ret;
+
+    if (!buf || !f_pos) {
+        PDEBUG("read: invalid args buf=%p f_pos=%p", buf, f_pos);
+        return -EINVAL;
+    }
+    PDEBUG("read %zu bytes with offset %lld",count,*f_pos);
+    if (count == 0)
+        return 0;
+
+    if (mutex_lock_interruptible(&dev->lock)) {
+        PDEBUG("read: mutex_lock_interruptible interrupted");
+        return -ERESTARTSYS;
+    }
+
+    if (cursor && cursor->valid && cursor->pos == *f_pos && cursor->generation == dev->generation) {
+        entry = aesd_cursor_resume(dev, cursor, &entry_byte_off, &cmd);
+    } else {
+        /* Map the linear file position */
+        entry = aesd_circular_buffer_find_entry_offset_for_fpos(&dev->cmd_history, (size_t)*f_pos, &entry_byte_off);
+        if (entry)
+            cmd = ((unsigned int)(entry - dev->cmd_history.entry) + AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED
+                   - dev->cmd_history.out_offs) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    }
+    if (!entry) {
+        mutex_unlock(&dev->lock);
+        return 0;
+    }
+
+    bytes_avail_in_entry = entry->size - entry_byte_off;
+    bytes_to_copy = (bytes_avail_in_entry < count) ? bytes_avail_in_entry : count;
+
+    if (copy_to_user(buf, (const char *)entry->buffptr + entry_byte_off, bytes_to_copy))
+    {
+        PDEBUG("read: copy_to_user failed (req=%zu)", bytes_to_copy);
+        mutex_unlock(&dev->lock);
+        return -EFAULT;
+    }
+
+    *f_pos += bytes_to_copy;
+    ret = (ssize_t)bytes_to_copy;
+
+    if (cursor) {
+        cursor->pos = *f_pos;
+        cursor->cmd = cmd;
+        cursor->offset = entry_byte_off + bytes_to_copy;
+        cursor->generation = dev->generation;
+        cursor->valid = true;
+    }
+
+    PDEBUG("read: copied=%zu new f_pos=%lld", bytes_to_copy, *f_pos);
+    mutex_unlock(&dev->lock);
+    return ret;
+}
+
+/**
+ * @brief Append user data to the partial command, moving every completed
+ * (newline terminated) command into cmd_history.
+ *
+ * @return count on success, negative errno on failure
+ */
+ssize_t aesd_core_write(struct aesd_core *dev, const char __user *ubuf, size_t count, loff_t *f_pos)
+{
+    ssize_t retval = count;
+    char *base;
+    size_t total, scan, cmd_start = 0;
+
+    if (!ubuf || !f_pos) {
+        PDEBUG("write: invalid args buf=%p f_pos=%p", ubuf, f_pos);
+        return -EINVAL;
+    }
+
+    if (count == 0)
+        return 0;
+
+    if (mutex_lock_interruptible(&dev->lock)) {
+        PDEBUG("write: mutex_lock_interruptible interrupted");
+        return -ERESTARTSYS;
+    }
+
+    /* Grow the accumulating buffer geometrically so streaming writes amortise */
+    total = dev->incomplete_cmd.size + count;
+    if (total > dev->incomplete_cap) {
+        size_t new_cap = dev->incomplete_cap * 2 > total ? dev->incomplete_cap * 2 : total;
+        void *newptr = krealloc((void *)dev->incomplete_cmd.buffptr, new_cap, GFP_KERNEL);
+
+        if (!newptr) {
+            PDEBUG("write: krealloc failed for %zu bytes", new_cap);
+            retval = -ENOMEM;
+            goto out_unlock;
+        }
+        dev->incomplete_cmd.buffptr = (const char *)newptr;
+        dev->incomplete_cap = new_cap;
+    }
+    base = (char *)dev->incomplete_cmd.buffptr;
+
+    /* Copy the user chunk once, straight behind the pending partial command */
+    if (copy_from_user(base + dev->incomplete_cmd.size, ubuf, count)) {
+        PDEBUG("write: copy_from_user failed");
+        retval = -EFAULT;
+        goto out_unlock;
+    }
+
+    /* Bytes before incomplete_scanned are known to hold no newline */
+    scan = dev->incomplete_scanned;
+    while (scan < total) {
+        char *nl = memchr(base + scan, '\n', total - scan);
+        const char *overwritten_ptr = NULL;
+        struct aesd_buffer_entry e;
+        size_t cmd_end, cmd_len;
+        char *final_buf;
+
+        if (!nl)
+            break; /* still incomplete */
+
+        /* Length including newline */
+        cmd_end = (size_t)(nl - base) + 1;
+        cmd_len = cmd_end - cmd_start;
+
+        if (cmd_start == 0 && cmd_end == total) {
+            /* The whole buffer is exactly one command: hand it over, no copy */
+            final_buf = base;
+            dev->incomplete_cmd.buffptr = NULL;
+            dev->incomplete_cap = 0;
+        } else {
+            final_buf = kmalloc(cmd_len, GFP_KERNEL);
+            if (!final_buf) {
+                retval = -ENOMEM;
+                break;
+            }
+            memcpy(final_buf, base + cmd_start, cmd_len);
+        }
+
+        if (dev->cmd_history.full) {
+            overwritten_ptr = dev->cmd_history.entry[dev->cmd_history.in_offs].buffptr;
+            dev->generation++; /* every stored byte shifts: read cursors are stale */
+        }
+
+        /* Pushing into the circular buffer */
+        e.buffptr = (const char *)final_buf;
+        e.size = cmd_len;
+        aesd_circular_buffer_add_entry(&dev->cmd_history, &e);
+        if (dev->cmd_complete)
+            dev->cmd_complete(dev->cmd_complete_ctx, final_buf, cmd_len);
+
+        /* Free the overwritten entry */
+        kfree(overwritten_ptr);
+
+        cmd_start = scan = cmd_end;
+    }
+
+    /* Shift the unterminated tail to the front once, not once per command */
+    if (dev->incomplete_cmd.buffptr) {
+        size_t tail_len = total - cmd_start;
+
+        if (cmd_start && tail_len)
+            memmove(base, base + cmd_start, tail_len);
+        dev->incomplete_cmd.size = tail_len;
+        /* After an allocation failure the tail may still hold a newline */
+        dev->incomplete_scanned = retval < 0 ? 0 : tail_len;
+    } else {
+        dev->incomplete_cmd.size = 0;
+        dev->incomplete_scanned = 0;
+    }
+
+  out_unlock:
+    if (retval > 0)                 // only advance when we actually wrote bytes
+        *f_pos += retval;           // keep positional I/O consistent with llseek
+    mutex_unlock(&dev->lock);
+    return retval;
+}
+
+static loff_t aesd_buffer_size_bytes(const struct aesd_circular_buffer *buf)
+{
+    loff_t total = 0;
+    uint8_t idx;
+    const struct aesd_buffer_entry *entry;
+
+    AESD_CIRCULAR_BUFFER_FOREACH(entry, buf, idx) {
+        if (entry->buffptr)
+          total += entry->size;
+    }
+    return total;
+}
+
+/**
+ * @brief Resolve an llseek against the current history size
+ *
+ * Same rules as fixed_size_llseek(): the result must lie within [0, size].
+ *
+ * @param pos current file position, used for SEEK_CUR
+ * @return the new position, or a negative errno
+ */
+loff_t aesd_core_llseek(struct aesd_core *dev, loff_t pos, loff_t offset, int whence)
+{
+    loff_t size, res;
+
+    if (mutex_lock_interruptible(&dev->lock))
+        return -ERESTARTSYS;
+
+    size = aesd_buffer_size_bytes(&dev->cmd_history);
+
+    switch (whence) {
+    case SEEK_SET:
+        res = offset;
+        break;
+    case SEEK_CUR:
+        res = pos + offset;
+        break;
+    case SEEK_END:
+        res = size + offset;
+        break;
+    default:
+        res = -EINVAL;
+        goto out;
+    }
+    if (res < 0 || res > size)
+        res = -EINVAL;
+
+out:
+    mutex_unlock(&dev->lock);
+    return res;   /* returns new position */
+}
+
+/**
+ * @brief Calculate absolute byte offset for a given write command and offset
+ *
+ * @param circ_buf   Pointer to the AESD circular buffer
+ * @param cmd_index  Command number to seek into (0-based)
+ * @param byte_offset Byte offset inside that command
+ * @param absolute_pos Pointer to store computed absolute position
+ *
+ * @return 0 on success, -EINVAL on invalid index or offset
+ */
+static int aesd_get_absolute_position(const struct aesd_circular_buffer *circ_buf,
+                                      uint32_t cmd_index,
+                                      uint32_t byte_offset,
+                                      loff_t *absolute_pos)
+{
+    loff_t accumulated_size = 0;
+    unsigned int valid_entries;
+    uint8_t buffer_index;
+    const struct aesd_buffer_entry *entry;
+
+    valid_entries = circ_buf->full
+        ? AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED
+        : ((circ_buf->in_offs - circ_buf->out_offs + AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED)
+           % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED);
+
+    if (cmd_index >= valid_entries)
+        return -EINVAL;
+
+    for (unsigned int i = 0; i < valid_entries; i++) {
+        buffer_index = (circ_buf->out_offs + i) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+        entry = &circ_buf->entry[buffer_index];
+
+        if (!entry->buffptr || entry->size == 0)
+            return -EINVAL;
+
+        if (i == cmd_index) {
+            if (byte_offset >= entry->size)
+                return -EINVAL;
+            *absolute_pos = accumulated_size + byte_offset;
+            return 0;
+        }
+
+        accumulated_size += entry->size;  // sum sizes of commands before target
+    }
+
+    return -EINVAL;
+}
+
+/**
+ * @brief Move *f_pos to byte_offset within the cmd_index'th stored command
+ *
+ * @return 0 on success, -EINVAL on invalid index or offset
+ */
+int aesd_core_seekto(struct aesd_core *dev, uint32_t cmd_index, uint32_t byte_offset, loff_t *f_pos)
+{
+    loff_t new_file_position = 0;
+    int result;
+
+    if (mutex_lock_interruptible(&dev->lock))
+        return -ERESTARTSYS;
+
+    result = aesd_get_absolute_position(&dev->cmd_history, cmd_index, byte_offset,
+                                        &new_file_position);
+    if (result == 0)
+        *f_pos = new_file_position;
+
+    mutex_unlock(&dev->lock);
+    return result;
+}
@@ -0,0 +1,136 @@
+/*
+ * aesdchar-core.h
+ *
+ * Kernel-independent part of the aesdchar driver: command accumulation,
+ * history reads and seeks. The same source builds into the module and into
+ * the userspace harness, where the few kernel primitives it needs are
+ * mapped onto libc and pthreads.
+ */
+
+#ifndef AESD_CHAR_DRIVER_AESDCHAR_CORE_H_
+#define AESD_CHAR_DRIVER_AESDCHAR_CORE_H_
+
+#ifndef AESD_NO_DEBUG
+#define AESD_DEBUG 1  //Remove comment on this line to enable debug
+#endif
+
+#undef PDEBUG             /* undef it, just in case */
+#ifdef AESD_DEBUG
+#  ifdef __KERNEL__
+     /* This one if debugging is on, and kernel space */
+#    define PDEBUG(fmt, args...) printk( KERN_DEBUG "aesdchar: " fmt, ## args)
+#  else
+     /* This one for user space */
+#    define PDEBUG(fmt, args...) fprintf(stderr, fmt, ## args)
+#  endif
+#else
+#  define PDEBUG(fmt, args...) /* not debugging: nothing */
+#endif
+
+#ifdef __KERNEL__
+#include <linux/mutex.h>
+#include <linux/types.h>
+#else
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h> // loff_t, ssize_t
+
+/* ========================== Userspace shims ========================== */
+#define __user
+#define GFP_KERNEL 0
+#define ERESTARTSYS 512
+
+struct mutex {
+    pthread_mutex_t m;
+};
+
+static inline void mutex_init(struct mutex *lock)
+{
+    pthread_mutex_init(&lock->m, NULL);
+}
+
+static inline int mutex_lock_interruptible(struct mutex *lock)
+{
+    return pthread_mutex_lock(&lock->m) ? -ERESTARTSYS : 0;
+}
+
+static inline void mutex_unlock(struct mutex *lock)
+{
+    pthread_mutex_unlock(&lock->m);
+}
+
+static inline void *kmalloc(size_t size, int flags)
+{
+    (void)flags;
+    return malloc(size);
+}
+
+static inline void *krealloc(const void *ptr, size_t size, int flags)
+{
+    (void)flags;
+    return realloc((void *)ptr, size);
+}
+
+static inline void kfree(const void *ptr)
+{
+    free((void *)ptr);
+}
+
+/* Like the kernel versions these return the number of bytes NOT copied */
+static inline unsigned long copy_to_user(void __user *to, const void *from, unsigned long n)
+{
+    memcpy(to, from, n);
+    return 0;
+}
+
+static inline unsigned long copy_from_user(void *to, const void __user *from, unsigned long n)
+{
+    memcpy(to, from, n);
+    return 0;
+}
+#endif /* __KERNEL__ */
+
+#include "aesd-circular-buffer.h"
+
+struct aesd_core
+{
+    struct mutex lock;                       // Protects concurrent access
+    struct aesd_circular_buffer cmd_history; // Holds 10 most recent completed commands
+    struct aesd_buffer_entry incomplete_cmd; // Data from write() before newline is received
+    size_t incomplete_cap;                   // Allocated size of incomplete_cmd.buffptr
+    size_t incomplete_scanned;               // Leading bytes of incomplete_cmd known to hold no newline
+    unsigned long generation;                // Bumped whenever stored commands are dropped
+    /**
+     * Optional hook called with lock held for every completed command, after
+     * it has been added to cmd_history. Used by the driver's persistence log.
+     */
+    void (*cmd_complete)(void *ctx, const char *cmd, size_t len);
+    void *cmd_complete_ctx;
+};
+
+/**
+ * Per-open read position cache, so sequential reads continue from where the
+ * previous read stopped instead of re-resolving *f_pos from out_offs.
+ * Protected by the owning aesd_core's lock.
+ */
+struct aesd_cursor
+{
+    loff_t pos;                // File position this cursor describes
+    unsigned int cmd;          // Command index, counted from cmd_history.out_offs
+    size_t offset;             // Byte offset in that command (may equal its size)
+    unsigned long generation;  // aesd_core.generation when the cursor was saved
+    bool valid;
+};
+
+void aesd_core_init(struct aesd_core *core);
+void aesd_core_free(struct aesd_core *core);
+ssize_t aesd_core_read(struct aesd_core *core, struct aesd_cursor *cursor, char __user *buf,
+            size_t count, loff_t *f_pos);
+ssize_t aesd_core_write(struct aesd_core *core, const char __user *buf, size_t count, loff_t *f_pos);
+loff_t aesd_core_llseek(struct aesd_core *core, loff_t pos, loff_t offset, int whence);
+int aesd_core_seekto(struct aesd_core *core, uint32_t cmd_index, uint32_t byte_offset, loff_t *f_pos);
+
+#endif /* AESD_CHAR_DRIVER_AESDCHAR_CORE_H_ */
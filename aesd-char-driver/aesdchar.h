@@ -8,23 +8,9 @@
 #ifndef AESD_CHAR_DRIVER_AESDCHAR_H_
 #define AESD_CHAR_DRIVER_AESDCHAR_H_
 
-#define AESD_DEBUG 1  //Remove comment on this line to enable debug
-
-#undef PDEBUG             /* undef it, just in case */
-#ifdef AESD_DEBUG
-#  ifdef __KERNEL__
-     /* This one if debugging is on, and kernel space */
-#    define PDEBUG(fmt, args...) printk( KERN_DEBUG "aesdchar: " fmt, ## args)
-#  else
-     /* This one for user space */
-#    define PDEBUG(fmt, args...) fprintf(stderr, fmt, ## args)
-#  endif
-#else
-#  define PDEBUG(fmt, args...) /* not debugging: nothing */
-#endif
-
 #include <linux/mutex.h>
-#include "aesd-circular-buffer.h"
+#include <linux/workqueue.h>
+#include "aesdchar-core.h"   // PDEBUG, struct aesd_core
 
 ssize_t aesd_read(struct file *filp, char __user *buf, size_t count, loff_t *f_pos);
 ssize_t aesd_write(struct file *filp, const char __user *buf, size_t count, loff_t *f_pos);
@@ -34,15 +20,35 @@ int aesd_init_module(void);
 void aesd_cleanup_module(void);
 
 
+/*
+ * Optional append-only backing log for completed commands.
+ * Enabled by loading the module with persist_path=<file>.
+ */
+struct aesd_persist
+{
+    struct file *log;                  // Backing log file, NULL when persistence is off
+    struct mutex lock;                 // Protects the pending batch below
+    char *batch;                       // Completed commands not yet written to the log
+    size_t batch_len;
+    size_t batch_cap;
+    struct delayed_work flush_work;    // Writes the batch out off the write() path
+};
+
 struct aesd_dev
 {
     /**
      * TODO: Add structure(s) and locks needed to complete assignment requirements
      */
-    struct mutex lock;                       // Protects concurrent access
-    struct aesd_circular_buffer cmd_history; // Holds 10 most recent completed commands
-    struct aesd_buffer_entry incomplete_cmd; // Data from write() before newline is received
+    struct aesd_core core;                   // History, partial command and their lock
     struct cdev cdev;                        // Char device structure
+    struct aesd_persist persist;             // Optional on-disk history log
+};
+
+/* filp->private_data: state private to one open() of the device */
+struct aesd_file
+{
+    struct aesd_dev *dev;
+    struct aesd_cursor cursor;               // Where the last read on this file stopped
 };
 
 #endif /* AESD_CHAR_DRIVER_AESDCHAR_H_ */
@@ -0,0 +1,140 @@
+/**
+ * @file bench_aesdchar.cpp
+ * @brief Google Benchmark microbenchmarks for the aesdchar core
+ *
+ * Covers whole-command writes by size, commands split across many partial
+ * writes, sequential reads of a wrapped (full) history and seek lookups.
+ *
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "aesdchar-core.h"
+}
+
+namespace {
+
+std::string make_command(size_t size)
+{
+    std::string cmd(size - 1, 'a');
+    cmd.push_back('\n');
+    return cmd;
+}
+
+/* Fill the history past capacity so out_offs has wrapped */
+void fill_wrapped(struct aesd_core *core, size_t cmd_size)
+{
+    std::string cmd = make_command(cmd_size);
+    loff_t pos = 0;
+
+    for (int i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 5; i++)
+        aesd_core_write(core, cmd.data(), cmd.size(), &pos);
+}
+
+void BM_WriteWholeCommand(benchmark::State &state)
+{
+    struct aesd_core core;
+    std::string cmd = make_command(state.range(0));
+    loff_t pos = 0;
+
+    aesd_core_init(&core);
+    for (auto _ : state)
+        benchmark::DoNotOptimize(aesd_core_write(&core, cmd.data(), cmd.size(), &pos));
+    state.SetBytesProcessed(state.iterations() * cmd.size());
+    aesd_core_free(&core);
+}
+BENCHMARK(BM_WriteWholeCommand)->RangeMultiplier(8)->Range(16, 1 << 20);
+
+void BM_WritePartial(benchmark::State &state)
+{
+    struct aesd_core core;
+    std::string cmd = make_command(state.range(0));
+    size_t pieces = state.range(1);
+    size_t chunk = (cmd.size() + pieces - 1) / pieces;
+    loff_t pos = 0;
+
+    aesd_core_init(&core);
+    for (auto _ : state) {
+        for (size_t off = 0; off < cmd.size(); off += chunk) {
+            size_t n = cmd.size() - off < chunk ? cmd.size() - off : chunk;
+            benchmark::DoNotOptimize(aesd_core_write(&core, cmd.data() + off, n, &pos));
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * cmd.size());
+    aesd_core_free(&core);
+}
+BENCHMARK(BM_WritePartial)->ArgsProduct({{4096, 1 << 20}, {4, 64, 1024}});
+
+void BM_WriteManyPerCall(benchmark::State &state)
+{
+    struct aesd_core core;
+    std::string batch;
+    loff_t pos = 0;
+
+    for (int i = 0; i < state.range(0); i++)
+        batch += make_command(64);
+    aesd_core_init(&core);
+    for (auto _ : state)
+        benchmark::DoNotOptimize(aesd_core_write(&core, batch.data(), batch.size(), &pos));
+    state.SetBytesProcessed(state.iterations() * batch.size());
+    aesd_core_free(&core);
+}
+BENCHMARK(BM_WriteManyPerCall)->Arg(1)->Arg(16)->Arg(1024);
+
+void BM_ReadAllWrapped(benchmark::State &state)
+{
+    struct aesd_core core;
+    std::vector<char> buf(state.range(1));
+    struct aesd_cursor cursor = {};
+    size_t total = 0;
+
+    aesd_core_init(&core);
+    fill_wrapped(&core, state.range(0));
+    for (auto _ : state) {
+        loff_t pos = 0;
+        ssize_t n;
+
+        total = 0;
+        while ((n = aesd_core_read(&core, &cursor, buf.data(), buf.size(), &pos)) > 0)
+            total += n;
+    }
+    state.SetBytesProcessed(state.iterations() * total);
+    aesd_core_free(&core);
+}
+BENCHMARK(BM_ReadAllWrapped)->ArgsProduct({{64, 4096, 1 << 16}, {16, 1024, 1 << 16}});
+
+void BM_SeekTo(benchmark::State &state)
+{
+    struct aesd_core core;
+    uint32_t cmd = 0;
+    loff_t pos = 0;
+
+    aesd_core_init(&core);
+    fill_wrapped(&core, 128);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(aesd_core_seekto(&core, cmd, 7, &pos));
+        cmd = (cmd + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    }
+    aesd_core_free(&core);
+}
+BENCHMARK(BM_SeekTo);
+
+void BM_LlseekEnd(benchmark::State &state)
+{
+    struct aesd_core core;
+
+    aesd_core_init(&core);
+    fill_wrapped(&core, 128);
+    for (auto _ : state)
+        benchmark::DoNotOptimize(aesd_core_llseek(&core, 0, 0, SEEK_END));
+    aesd_core_free(&core);
+}
+BENCHMARK(BM_LlseekEnd);
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,182 @@
+/**
+ * @file fuzz_aesdchar.c
+ * @brief libFuzzer/AFL target for the aesdchar core
+ *
+ * The input is decoded into a sequence of write/read/llseek/seekto calls on
+ * a struct aesd_core. Every result is checked against a deliberately naive
+ * model of the device (an array of the last commands plus a pending string),
+ * and the process aborts on the first mismatch.
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aesdchar-core.h"
+
+#define MAX_CMDS AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED
+
+struct model {
+    char *cmds[MAX_CMDS];  // Oldest first
+    size_t lens[MAX_CMDS];
+    unsigned int count;
+    char *partial;
+    size_t partial_len;
+};
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            abort(); \
+        } \
+    } while (0)
+
+static void model_write(struct model *m, const uint8_t *data, size_t len)
+{
+    m->partial = realloc(m->partial, m->partial_len + len + 1);
+    CHECK(m->partial != NULL);
+    memcpy(m->partial + m->partial_len, data, len);
+    m->partial_len += len;
+
+    for (;;) {
+        char *nl = memchr(m->partial, '\n', m->partial_len);
+        size_t cmd_len;
+        char *cmd;
+
+        if (!nl)
+            break;
+        cmd_len = (size_t)(nl - m->partial) + 1;
+        cmd = malloc(cmd_len);
+        CHECK(cmd != NULL);
+        memcpy(cmd, m->partial, cmd_len);
+        memmove(m->partial, m->partial + cmd_len, m->partial_len - cmd_len);
+        m->partial_len -= cmd_len;
+
+        if (m->count == MAX_CMDS) {
+            free(m->cmds[0]);
+            memmove(&m->cmds[0], &m->cmds[1], (MAX_CMDS - 1) * sizeof(m->cmds[0]));
+            memmove(&m->lens[0], &m->lens[1], (MAX_CMDS - 1) * sizeof(m->lens[0]));
+            m->count--;
+        }
+        m->cmds[m->count] = cmd;
+        m->lens[m->count] = cmd_len;
+        m->count++;
+    }
+}
+
+static size_t model_size(const struct model *m)
+{
+    size_t total = 0;
+
+    for (unsigned int i = 0; i < m->count; i++)
+        total += m->lens[i];
+    return total;
+}
+
+/* Bytes a single read at pos may return: the rest of the command holding pos */
+static size_t model_read_avail(const struct model *m, size_t pos, const char **src)
+{
+    for (unsigned int i = 0; i < m->count; i++) {
+        if (pos < m->lens[i]) {
+            *src = m->cmds[i] + pos;
+            return m->lens[i] - pos;
+        }
+        pos -= m->lens[i];
+    }
+    return 0;
+}
+
+static void model_free(struct model *m)
+{
+    for (unsigned int i = 0; i < m->count; i++)
+        free(m->cmds[i]);
+    free(m->partial);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    struct aesd_core core;
+    struct aesd_cursor cursor = { 0 };
+    struct model m;
+    loff_t pos = 0;
+    size_t i = 0;
+
+    aesd_core_init(&core);
+    memset(&m, 0, sizeof(m));
+
+    while (i + 2 <= size) {
+        uint8_t op = data[i++] % 4;
+        uint8_t arg = data[i++];
+
+        switch (op) {
+        case 0: { /* write: arg bytes of payload follow */
+            size_t n = arg < size - i ? arg : size - i;
+            loff_t wpos = pos;
+            ssize_t rc = aesd_core_write(&core, (const char *)data + i, n, &wpos);
+
+            CHECK(rc == (ssize_t)n);
+            CHECK(wpos == pos + (loff_t)n);
+            model_write(&m, data + i, n);
+            i += n;
+            break;
+        }
+        case 1: { /* read: arg + 1 bytes at the current position, odd args bypass the cursor */
+            char buf[256];
+            const char *expect = NULL;
+            size_t count = (size_t)arg + 1;
+            size_t avail = model_read_avail(&m, (size_t)pos, &expect);
+            size_t want = avail < count ? avail : count;
+            loff_t rpos = pos;
+            ssize_t rc = aesd_core_read(&core, (arg & 1) ? NULL : &cursor, buf, count, &rpos);
+
+            CHECK(rc == (ssize_t)want);
+            CHECK(want == 0 || memcmp(buf, expect, want) == 0);
+            CHECK(rpos == pos + (loff_t)want);
+            pos = rpos;
+            break;
+        }
+        case 2: { /* llseek: whence from arg, signed offset from the next byte */
+            int whence = arg % 3;
+            loff_t offset = i < size ? (int8_t)data[i++] : 0;
+            loff_t base = whence == SEEK_SET ? 0 : whence == SEEK_CUR ? pos : (loff_t)model_size(&m);
+            loff_t expect = base + offset;
+            loff_t rc = aesd_core_llseek(&core, pos, offset, whence);
+
+            if (expect < 0 || expect > (loff_t)model_size(&m)) {
+                CHECK(rc == -EINVAL);
+            } else {
+                CHECK(rc == expect);
+                pos = rc;
+            }
+            break;
+        }
+        case 3: { /* seekto: command from arg, offset from the next byte */
+            uint32_t cmd = arg % (MAX_CMDS + 2);
+            uint32_t off = i < size ? data[i++] : 0;
+            loff_t spos = pos;
+            int rc = aesd_core_seekto(&core, cmd, off, &spos);
+
+            if (cmd >= m.count || off >= m.lens[cmd]) {
+                CHECK(rc == -EINVAL);
+                CHECK(spos == pos);
+            } else {
+                loff_t expect = off;
+
+                for (uint32_t c = 0; c < cmd; c++)
+                    expect += (loff_t)m.lens[c];
+                CHECK(rc == 0);
+                CHECK(spos == expect);
+                pos = spos;
+            }
+            break;
+        }
+        }
+    }
+
+    CHECK(core.incomplete_cmd.size == m.partial_len);
+    aesd_core_free(&core);
+    model_free(&m);
+    return 0;
+}
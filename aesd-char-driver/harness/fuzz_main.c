@@ -0,0 +1,85 @@
+/**
+ * @file fuzz_main.c
+ * @brief Standalone driver for fuzz_aesdchar.c without libFuzzer
+ *
+ * With file arguments each file is run once, which is what AFL expects:
+ *     afl-fuzz -i seeds -o findings -- ./aesdchar_fuzz_replay @@
+ * Without arguments a fixed-seed set of random inputs is run as a smoke test.
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+#define SMOKE_RUNS 2000
+#define SMOKE_MAX_LEN 4096
+
+static uint32_t xorshift32(uint32_t *state)
+{
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static int run_file(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    uint8_t *data = NULL;
+    size_t len = 0, cap = 0, n;
+
+    if (!fp) {
+        perror(path);
+        return 1;
+    }
+    do {
+        if (len == cap) {
+            cap = cap ? cap * 2 : 4096;
+            data = realloc(data, cap);
+            if (!data) {
+                fclose(fp);
+                return 1;
+            }
+        }
+        n = fread(data + len, 1, cap - len, fp);
+        len += n;
+    } while (n > 0);
+    fclose(fp);
+
+    LLVMFuzzerTestOneInput(data, len);
+    free(data);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static uint8_t buf[SMOKE_MAX_LEN];
+    static const uint8_t alphabet[] = { 'a', 'b', 'c', '\n' };
+    uint32_t seed = 0x5eed1234;
+
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++)
+            if (run_file(argv[i]) != 0)
+                return EXIT_FAILURE;
+        return EXIT_SUCCESS;
+    }
+
+    for (int run = 0; run < SMOKE_RUNS; run++) {
+        size_t len = xorshift32(&seed) % SMOKE_MAX_LEN;
+
+        /* Payload bytes drawn from a small alphabet so newlines are frequent */
+        for (size_t i = 0; i < len; i++) {
+            uint32_t r = xorshift32(&seed);
+
+            buf[i] = (r & 1) ? alphabet[(r >> 1) % sizeof(alphabet)] : (uint8_t)(r >> 8);
+        }
+        LLVMFuzzerTestOneInput(buf, len);
+    }
+    printf("%d random inputs passed\n", SMOKE_RUNS);
+    return EXIT_SUCCESS;
+}
@@ -21,6 +21,9 @@
 #include <linux/types.h>
 #include <linux/cdev.h>
 #include <linux/fs.h> // file_operations
+#include <linux/moduleparam.h>
+#include <linux/workqueue.h>
+#include <linux/mm.h>        // kvmalloc/kvfree
 #include "aesdchar.h"
 int aesd_major =   0; // use dynamic major
 int aesd_minor =   0;
@@ -30,292 +33,300 @@ MODULE_LICENSE("Dual BSD/GPL");
 
 struct aesd_dev aesd_device;
 
-int aesd_open(struct inode *inode, struct file *filp)
-{
-    PDEBUG("open");
-    /**
-     * TODO: handle open
-     */
-    filp->private_data = container_of(inode->i_cdev, struct aesd_dev, cdev);
-    return 0;
-}
+/* Persistence is off unless a log path is given at insmod time */
+static char *persist_path;
+module_param(persist_path, charp, 0444);
+MODULE_PARM_DESC(persist_path, "Append-only log used to persist and restore command history");
 
-int aesd_release(struct inode *inode, struct file *filp)
+static unsigned int persist_delay_ms = 100;
+module_param(persist_delay_ms, uint, 0444);
+MODULE_PARM_DESC(persist_delay_ms, "Milliseconds to batch completed commands before writing the log");
+
+static bool persist_sync = true;
+module_param(persist_sync, bool, 0444);
+MODULE_PARM_DESC(persist_sync, "fdatasync the log after each batch is written");
+
+/* ---------- persistent history log ---------- */
+
+/**
+ * @brief Queue a completed command for the backing log.
+ *
+ * Installed as the core's cmd_complete hook, so it runs with core.lock held.
+ * The bytes are copied into the pending batch and written later by
+ * aesd_persist_flush(), so write() never waits on the disk.
+ * Persistence is best effort: on allocation failure the command is kept in
+ * memory but not logged.
+ */
+static void aesd_persist_queue(void *ctx, const char *cmd, size_t len)
 {
-    PDEBUG("release");
-    /**
-     * TODO: handle release
-     */
-    filp->private_data = NULL;
-    return 0;
+    struct aesd_dev *dev = ctx;
+    struct aesd_persist *p = &dev->persist;
+
+    if (!p->log)
+        return;
+
+    mutex_lock(&p->lock);
+    if (p->batch_len + len > p->batch_cap) {
+        size_t new_cap = p->batch_cap ? p->batch_cap : PAGE_SIZE;
+        char *new_batch;
+
+        while (p->batch_len + len > new_cap)
+            new_cap *= 2;
+        new_batch = krealloc(p->batch, new_cap, GFP_KERNEL);
+        if (!new_batch) {
+            PDEBUG("persist: dropping %zu bytes, batch krealloc failed", len);
+            mutex_unlock(&p->lock);
+            return;
+        }
+        p->batch = new_batch;
+        p->batch_cap = new_cap;
+    }
+    memcpy(p->batch + p->batch_len, cmd, len);
+    p->batch_len += len;
+    mutex_unlock(&p->lock);
+
+    /* No-op if a flush is already pending, so commands coalesce into one write */
+    schedule_delayed_work(&p->flush_work, msecs_to_jiffies(persist_delay_ms));
 }
 
-ssize_t aesd_read(struct file *filp, char __user *buf, size_t count, loff_t *f_pos)
+/**
+ * @brief Workqueue handler: append the pending batch to the log in one write.
+ */
+static void aesd_persist_flush(struct work_struct *work)
 {
-    struct aesd_dev *dev;
-    struct aesd_buffer_entry *entry = NULL;
-    size_t entry_byte_off = 0;
-    size_t bytes_avail_in_entry;
-    size_t bytes_to_copy;
-    ssize_t ret;
-    PDEBUG("read %zu bytes with offset %lld",count,*f_pos);
-
-    /**
-     * TODO: handle read
-     */
-   
-   if (!filp || !buf || !f_pos) {
-        PDEBUG("read: invalid args filp=%p buf=%p f_pos=%p", filp, buf, f_pos);
-        return -EINVAL;
+    struct aesd_persist *p = container_of(to_delayed_work(work), struct aesd_persist, flush_work);
+    char *batch;
+    size_t len;
+    loff_t pos = 0;
+    ssize_t written;
+
+    /* Take ownership of the batch so writers can keep queueing meanwhile */
+    mutex_lock(&p->lock);
+    batch = p->batch;
+    len = p->batch_len;
+    p->batch = NULL;
+    p->batch_len = 0;
+    p->batch_cap = 0;
+    mutex_unlock(&p->lock);
+
+    if (len) {
+        written = kernel_write(p->log, batch, len, &pos); // O_APPEND, pos is ignored
+        if (written != (ssize_t)len)
+            printk(KERN_WARNING "aesdchar: log write returned %zd of %zu bytes\n", written, len);
+        else if (persist_sync)
+            vfs_fsync(p->log, 1);
     }
-    if (count == 0)
-        return 0;
+    kfree(batch);
+}
 
-    dev = filp->private_data;
+/**
+ * @brief Rebuild the circular buffer from the tail of the log.
+ *
+ * Only the last AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED commands are needed,
+ * so the log is scanned backwards a page at a time and just that tail is read,
+ * keeping load time independent of the log size. Bytes after the last newline
+ * belong to a write torn by a crash; they are truncated so the next append
+ * starts on a record boundary.
+ *
+ * @return 0 on success, negative errno on failure
+ */
+static int aesd_persist_restore(struct aesd_dev *dev)
+{
+    struct file *log = dev->persist.log;
+    loff_t size = i_size_read(file_inode(log));
+    loff_t pos = size;
+    loff_t start = 0;
+    loff_t end = 0;
+    unsigned int newlines = 0;
+    char *chunk;
+    char *tail = NULL;
+    size_t tail_len, i, line_start;
+    ssize_t n;
+    int ret = 0;
+
+    chunk = kmalloc(PAGE_SIZE, GFP_KERNEL);
+    if (!chunk)
+        return -ENOMEM;
 
+    /* The Nth newline from the end starts the (N-1)th most recent command */
+    while (pos > 0 && newlines <= AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED) {
+        size_t len = (size_t)min_t(loff_t, pos, PAGE_SIZE);
+        loff_t off = pos - len;
 
-    if (mutex_lock_interruptible(&dev->lock)) {
-        PDEBUG("read: mutex_lock_interruptible interrupted");
-        return -ERESTARTSYS;
+        n = kernel_read(log, chunk, len, &off);
+        if (n != (ssize_t)len) {
+            ret = n < 0 ? (int)n : -EIO;
+            goto out;
+        }
+        pos -= len;
+
+        for (i = len; i-- > 0; ) {
+            if (chunk[i] != '\n')
+                continue;
+            if (++newlines == 1) {
+                end = pos + i + 1;
+            } else if (newlines > AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED) {
+                start = pos + i + 1;
+                break;
+            }
+        }
     }
 
-    /* Map the linear file position */
-    entry = aesd_circular_buffer_find_entry_offset_for_fpos(&dev->cmd_history, (size_t)*f_pos, &entry_byte_off);
-    if (!entry) {
-        mutex_unlock(&dev->lock);
-        return 0; 
+    if (end < size) {
+        printk(KERN_WARNING "aesdchar: truncating %lld torn bytes from log\n", size - end);
+        ret = vfs_truncate(&log->f_path, end);
+        if (ret)
+            goto out;
+    }
+    if (end == 0)
+        goto out;
+
+    tail_len = (size_t)(end - start);
+    tail = kvmalloc(tail_len, GFP_KERNEL);
+    if (!tail) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    pos = start;
+    n = kernel_read(log, tail, tail_len, &pos);
+    if (n != (ssize_t)tail_len) {
+        ret = n < 0 ? (int)n : -EIO;
+        goto out;
     }
 
-    bytes_avail_in_entry = entry->size - entry_byte_off;
-    bytes_to_copy = (bytes_avail_in_entry < count) ? bytes_avail_in_entry : count;
+    for (line_start = 0, i = 0; i < tail_len; i++) {
+        struct aesd_buffer_entry e;
+        char *cmd;
 
-    if (copy_to_user(buf, (const char *)entry->buffptr + entry_byte_off, bytes_to_copy)) 
-    {
-        PDEBUG("read: copy_to_user failed (req=%zu)", bytes_to_copy);
-        mutex_unlock(&dev->lock);
-        return -EFAULT;
+        if (tail[i] != '\n')
+            continue;
+        cmd = kmalloc(i + 1 - line_start, GFP_KERNEL);
+        if (!cmd) {
+            ret = -ENOMEM;
+            goto out;
+        }
+        memcpy(cmd, tail + line_start, i + 1 - line_start);
+        e.buffptr = cmd;
+        e.size = i + 1 - line_start;
+        aesd_circular_buffer_add_entry(&dev->core.cmd_history, &e);
+        line_start = i + 1;
     }
+    PDEBUG("persist: restored %zu bytes of history from %s", tail_len, persist_path);
 
-    *f_pos += bytes_to_copy;
-    ret = (ssize_t)bytes_to_copy;
-
-    PDEBUG("read: copied=%zu new f_pos=%lld", bytes_to_copy, *f_pos);
-    mutex_unlock(&dev->lock);
+out:
+    if (ret)
+        aesd_core_free(&dev->core); /* Don't leave a partially rebuilt history behind */
+    kvfree(tail);
+    kfree(chunk);
     return ret;
 }
 
-ssize_t aesd_write(struct file *filp, const char __user *ubuf, size_t count, loff_t *f_pos)
+static int aesd_persist_init(struct aesd_dev *dev)
 {
-    struct aesd_dev *dev = filp->private_data;
-    char *kbuf = NULL;
-    ssize_t retval = count;
-    void *newptr;
-    size_t newsize;
-
-    if (!filp || !ubuf || !f_pos) {
-        PDEBUG("write: invalid args filp=%p buf=%p f_pos=%p", filp, ubuf, f_pos);
-        return -EINVAL;
-    }
+    struct aesd_persist *p = &dev->persist;
+    int ret;
 
-    if (count == 0)
-        return 0;
-
-    dev = filp->private_data;
-    if (!dev)
-        return -EFAULT;
+    mutex_init(&p->lock);
+    INIT_DELAYED_WORK(&p->flush_work, aesd_persist_flush);
 
-    kbuf = kmalloc(count, GFP_KERNEL);
-    if (!kbuf) {
-        PDEBUG("write: kmalloc failed for %zu bytes", count);
-        return -ENOMEM;
-    }
+    if (!persist_path || !*persist_path)
+        return 0;
 
-    if (copy_from_user(kbuf, ubuf, count)) {
-        PDEBUG("write: copy_from_user failed");
-        kfree(kbuf);
-        return -EFAULT;
+    p->log = filp_open(persist_path, O_RDWR | O_CREAT | O_APPEND | O_LARGEFILE, 0600);
+    if (IS_ERR(p->log)) {
+        ret = PTR_ERR(p->log);
+        p->log = NULL;
+        printk(KERN_ERR "aesdchar: can't open log %s: %d\n", persist_path, ret);
+        return ret;
     }
 
-    if (mutex_lock_interruptible(&dev->lock)) {
-        PDEBUG("write: mutex_lock_interruptible interrupted");
-        kfree(kbuf);
-        return -ERESTARTSYS;
+    ret = aesd_persist_restore(dev);
+    if (ret) {
+        printk(KERN_ERR "aesdchar: restoring history from %s failed: %d\n", persist_path, ret);
+        filp_close(p->log, NULL);
+        p->log = NULL;
     }
+    return ret;
+}
 
+static void aesd_persist_cleanup(struct aesd_dev *dev)
+{
+    struct aesd_persist *p = &dev->persist;
 
-    /* Append this user chunk to the accumulating buffer */
-    newsize = dev->incomplete_cmd.size + count;
-    newptr  = krealloc((void *)dev->incomplete_cmd.buffptr, newsize, GFP_KERNEL);
-    if (!newptr) 
-    {
-      retval = -ENOMEM; 
-      goto out_unlock_free; 
-    }
-
-    dev->incomplete_cmd.buffptr = (const char *)newptr;
-
-    memcpy((char *)dev->incomplete_cmd.buffptr + dev->incomplete_cmd.size, kbuf, count);
-
-    dev->incomplete_cmd.size = newsize;
-
-    /*complete commands present in the accumulated buffer */
-    for (;;) {
-        char *base = (char *)dev->incomplete_cmd.buffptr;
-        char *nl;
-
-        if (!base || dev->incomplete_cmd.size == 0)
-         break;
-        nl = memchr(base, '\n', dev->incomplete_cmd.size);
-        if (!nl)
-         break; /* still incomplete */
+    if (!p->log)
+        return;
 
-        /* Length including newline */
-        {
-            size_t cmd_len = (size_t)(nl - base) + 1;
-            const char *overwritten_ptr = NULL;
+    /* Run any pending batch now and wait for it, then close the log */
+    flush_delayed_work(&p->flush_work);
+    filp_close(p->log, NULL);
+    p->log = NULL;
+    kfree(p->batch);
+    p->batch = NULL;
+}
 
-            if (dev->cmd_history.full) {
-                uint8_t idx = dev->cmd_history.in_offs;
-                overwritten_ptr = dev->cmd_history.entry[idx].buffptr;
-            }
+int aesd_open(struct inode *inode, struct file *filp)
+{
+    struct aesd_file *file;
 
-            /* Allocating buffer for this completed command */
-            char *final_buf = kmalloc(cmd_len, GFP_KERNEL);
-            if (!final_buf) 
-            { 
-             retval = -ENOMEM;
-             goto out_unlock_free;
-            }
+    PDEBUG("open");
+    /**
+     * TODO: handle open
+     */
+    file = kzalloc(sizeof(*file), GFP_KERNEL);
+    if (!file)
+        return -ENOMEM;
+    file->dev = container_of(inode->i_cdev, struct aesd_dev, cdev);
+    filp->private_data = file;
+    return 0;
+}
 
-            memcpy(final_buf, base, cmd_len);
-
-            /* Pushing into teh circular buffer*/
-
-            struct aesd_buffer_entry e = { .buffptr = (const char *)final_buf, .size = cmd_len };
-            aesd_circular_buffer_add_entry(&dev->cmd_history, &e);
-
-            /* Free the overwritten entry */
-            if (overwritten_ptr)
-              kfree((void *)overwritten_ptr);
-
-            /* checking any tail after the newline as the new incomplete_cmd */
-            {
-                size_t tail_len = dev->incomplete_cmd.size - cmd_len;
-                if (tail_len == 0) 
-                {
-                    kfree((void *)dev->incomplete_cmd.buffptr);
-                    dev->incomplete_cmd.buffptr = NULL;
-                    dev->incomplete_cmd.size = 0;
-                } else {
-                    char *tail = kmalloc(tail_len, GFP_KERNEL);
-                    if (!tail) {
-                     retval = -ENOMEM; 
-                     goto out_unlock_free; 
-                    }
-                    memcpy(tail, base + cmd_len, tail_len);
-                    kfree((void *)dev->incomplete_cmd.buffptr);
-                    dev->incomplete_cmd.buffptr = (const char *)tail;
-                    dev->incomplete_cmd.size = tail_len;
-                }
-            }
-        }
-        /* Loop in case multiple '\n' exist in the now-updated incomplete_cmd */
-    }
+int aesd_release(struct inode *inode, struct file *filp)
+{
+    PDEBUG("release");
+    /**
+     * TODO: handle release
+     */
+    kfree(filp->private_data);
+    filp->private_data = NULL;
+    return 0;
+}
 
-   
+ssize_t aesd_read(struct file *filp, char __user *buf, size_t count, loff_t *f_pos)
+{
+    struct aesd_file *file;
 
-  out_unlock_free:
-    if (retval > 0)                 // only advance when we actually wrote bytes
-        *f_pos += retval;           // keep positional I/O consistent with llseek
-    mutex_unlock(&dev->lock);
-    kfree(kbuf);
-    return retval;
+    if (!filp || !filp->private_data)
+        return -EINVAL;
+    file = filp->private_data;
+    return aesd_core_read(&file->dev->core, &file->cursor, buf, count, f_pos);
 }
 
-static loff_t aesd_buffer_size_bytes(const struct aesd_circular_buffer *buf)
+ssize_t aesd_write(struct file *filp, const char __user *ubuf, size_t count, loff_t *f_pos)
 {
-    loff_t total = 0;
-    uint8_t idx;
-    struct aesd_buffer_entry *entry;
+    struct aesd_file *file;
 
-    AESD_CIRCULAR_BUFFER_FOREACH(entry, buf, idx) {
-        if (entry && entry->buffptr) 
-          total += entry->size;
-    }
-    return total;
+    if (!filp || !filp->private_data)
+        return -EINVAL;
+    file = filp->private_data;
+    return aesd_core_write(&file->dev->core, ubuf, count, f_pos);
 }
+
 /* ---------- llseek implementation---------- */
 static loff_t aesd_llseek(struct file *filp, loff_t offset, int whence)
 {
-    loff_t res, size;
-    struct aesd_dev *dev = filp->private_data;
+    loff_t res;
+    struct aesd_file *file = filp->private_data;
 
-    if (!dev) 
+    if (!file) 
        return -EINVAL;
 
-   
-    if (mutex_lock_interruptible(&dev->lock))
-        return -ERESTARTSYS;
-
-    size = aesd_buffer_size_bytes(&dev->cmd_history); 
-
-   
-    res = fixed_size_llseek(filp, offset, whence, size);
-
-    mutex_unlock(&dev->lock);
+    res = aesd_core_llseek(&file->dev->core, filp->f_pos, offset, whence);
+    if (res >= 0)
+        filp->f_pos = res;
     return res;   /* returns new position */
 }
 
 
-/**
- * @brief Calculate absolute byte offset for a given write command and offset
- *
- * @param circ_buf   Pointer to the AESD circular buffer
- * @param cmd_index  Command number to seek into (0-based)
- * @param byte_offset Byte offset inside that command
- * @param absolute_pos Pointer to store computed absolute position
- *
- * @return 0 on success, -EINVAL on invalid index or offset
- */
-static int aesd_get_absolute_position(const struct aesd_circular_buffer *circ_buf,
-                                      uint32_t cmd_index,
-                                      uint32_t byte_offset,
-                                      loff_t *absolute_pos)
-{
-    loff_t accumulated_size = 0;
-    unsigned int valid_entries;
-    uint8_t buffer_index;
-    const struct aesd_buffer_entry *entry;
-
-    valid_entries = circ_buf->full
-        ? AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED
-        : ((circ_buf->in_offs - circ_buf->out_offs + AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED)
-           % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED);
-
-    if (cmd_index >= valid_entries)
-        return -EINVAL;
-
-    for (unsigned int i = 0; i < valid_entries; i++) {
-        buffer_index = (circ_buf->out_offs + i) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-        entry = &circ_buf->entry[buffer_index];
-
-        if (!entry->buffptr || entry->size == 0)
-            return -EINVAL;
-
-        if (i == cmd_index) {
-            if (byte_offset >= entry->size)
-                return -EINVAL;
-            *absolute_pos = accumulated_size + byte_offset;
-            return 0;
-        }
-
-        accumulated_size += entry->size;  // sum sizes of commands before target
-    }
-
-    return -EINVAL;
-}
-
-
 /**
  * @brief Handle ioctl commands for AESD character device
  *
@@ -324,10 +335,8 @@ static int aesd_get_absolute_position(const struct aesd_circular_buffer *circ_bu
  */
 static long aesd_handle_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 {
-    struct aesd_dev *device;
+    struct aesd_file *file;
     struct aesd_seekto seek_params;
-    loff_t new_file_position = 0;
-    int result;
 
     // Validate ioctl command magic and range
     if (_IOC_TYPE(cmd) != AESD_IOC_MAGIC || _IOC_NR(cmd) > AESDCHAR_IOC_MAXNR)
@@ -339,23 +348,12 @@ static long aesd_handle_ioctl(struct file *filp, unsigned int cmd, unsigned long
     if (copy_from_user(&seek_params, (const void __user *)arg, sizeof(seek_params)))
         return -EFAULT;
 
-    device = filp->private_data;
-    if (!device)
+    file = filp->private_data;
+    if (!file)
         return -EINVAL;
 
-    if (mutex_lock_interruptible(&device->lock))
-        return -ERESTARTSYS;
-
-    result = aesd_get_absolute_position(&device->cmd_history,
-                                        seek_params.write_cmd,
-                                        seek_params.write_cmd_offset,
-                                        &new_file_position);
-
-    if (result == 0)
-        filp->f_pos = new_file_position;
-
-    mutex_unlock(&device->lock);
-    return result;
+    return aesd_core_seekto(&file->dev->core, seek_params.write_cmd,
+                            seek_params.write_cmd_offset, &filp->f_pos);
 }
 
 
@@ -403,14 +401,22 @@ int aesd_init_module(void)
      * TODO: initialize the AESD specific portion of the device
      */
  
-    mutex_init(&aesd_device.lock);                 
-    aesd_circular_buffer_init(&aesd_device.cmd_history); 
-    aesd_device.incomplete_cmd.buffptr = NULL;
-    aesd_device.incomplete_cmd.size = 0;
+    aesd_core_init(&aesd_device.core);
+    aesd_device.core.cmd_complete = aesd_persist_queue;
+    aesd_device.core.cmd_complete_ctx = &aesd_device;
+
+    /* Restore history before the device becomes visible */
+    result = aesd_persist_init(&aesd_device);
+    if (result) {
+        unregister_chrdev_region(dev, 1);
+        return result;
+    }
 
     result = aesd_setup_cdev(&aesd_device);
 
     if( result ) {
+        aesd_persist_cleanup(&aesd_device);
+        aesd_core_free(&aesd_device.core);
         unregister_chrdev_region(dev, 1);
     }
     return result;
@@ -419,32 +425,19 @@ int aesd_init_module(void)
 
 void aesd_cleanup_module(void)
 {
-      struct aesd_buffer_entry *entry;
     dev_t devno = MKDEV(aesd_major, aesd_minor);
 
     cdev_del(&aesd_device.cdev);
 
+    /* Write out anything still batched before the history is freed */
+    aesd_persist_cleanup(&aesd_device);
+
     /**
      * TODO: cleanup AESD specific poritions here as necessary
      */
- 
-   uint8_t idx;
-
-   /* Free all command-history entries */
-    AESD_CIRCULAR_BUFFER_FOREACH(entry, &aesd_device.cmd_history, idx) {
-    if (entry->buffptr) {
-        kfree(entry->buffptr);
-        entry->buffptr = NULL;
-        entry->size = 0;
-        }
-    }
 
-   /* Free any partially collected write-buffer */
-  if (aesd_device.incomplete_cmd.buffptr) {
-        kfree(aesd_device.incomplete_cmd.buffptr);
-        aesd_device.incomplete_cmd.buffptr = NULL;
-        aesd_device.incomplete_cmd.size = 0;
-    }
+    /* Free all command-history entries and any partially collected write */
+    aesd_core_free(&aesd_device.core);
 
     unregister_chrdev_region(devno, 1);
 }
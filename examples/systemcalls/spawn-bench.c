@@ -0,0 +1,126 @@
+/*
+ * spawn-bench.c
+ *
+ * Spawn latency against the parent's RSS: fork() + execv() + waitpid(), as
+ * do_exec() used to, next to do_exec() itself (posix_spawn). Each round grows
+ * the parent to the next size, touches every page so it is really resident,
+ * and times @runs spawns of /bin/true both ways.
+ *
+ * Build: gcc -O2 -pthread -o spawn-bench spawn-bench.c systemcalls.c
+ * Usage: spawn-bench [runs] [max_mib]
+ */
+
+#include "systemcalls.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <syslog.h>
+
+#define SPAWN_CMD "/bin/true"
+
+static double now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static long rss_kib(void)
+{
+    FILE *f = fopen("/proc/self/statm", "r");
+    long pages = 0, resident = 0;
+
+    if (f == NULL)
+        return -1;
+    if (fscanf(f, "%ld %ld", &pages, &resident) != 2)
+        resident = -1;
+    fclose(f);
+    return resident < 0 ? -1 : resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static bool fork_exec(void)
+{
+    char *const command[] = { SPAWN_CMD, NULL };
+    int status = 0;
+    pid_t pid;
+
+    fflush(NULL);
+    pid = fork();
+    if (pid < 0)
+        return false;
+    if (pid == 0) {
+        execv(command[0], command);
+        _exit(127);
+    }
+    if (waitpid(pid, &status, 0) < 0)
+        return false;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/* Mean microseconds per spawn, or a negative value if one failed */
+static double time_spawns(bool (*spawn)(void), int runs)
+{
+    double start = now_us();
+
+    for (int i = 0; i < runs; i++) {
+        if (!spawn())
+            return -1;
+    }
+    return (now_us() - start) / runs;
+}
+
+static bool posix_spawn_exec(void)
+{
+    return do_exec(1, SPAWN_CMD);
+}
+
+int main(int argc, char *argv[])
+{
+    int runs = argc > 1 ? atoi(argv[1]) : 200;
+    long max_mib = argc > 2 ? atol(argv[2]) : 1024;
+    char *ballast = NULL;
+    size_t held = 0;
+
+    if (runs < 1 || max_mib < 0) {
+        fprintf(stderr, "Usage: %s [runs] [max_mib]\n", argv[0]);
+        return 1;
+    }
+
+    /* do_exec() logs every success at LOG_DEBUG, to stderr as well */
+    setlogmask(LOG_UPTO(LOG_INFO));
+
+    printf("%10s %10s %14s %14s %8s\n", "ballast", "rss_kib", "fork_us", "posix_spawn_us", "ratio");
+    for (long mib = 0; mib <= max_mib; mib = mib ? mib * 4 : 16) {
+        size_t want = (size_t)mib << 20;
+        double fork_us, spawn_us;
+
+        if (want > held) {
+            char *grown = realloc(ballast, want);
+
+            if (grown == NULL) {
+                fprintf(stderr, "stopping at %ld MiB: out of memory\n", mib);
+                break;
+            }
+            ballast = grown;
+            memset(ballast + held, 0x5a, want - held);
+            held = want;
+        }
+
+        fork_us = time_spawns(fork_exec, runs);
+        spawn_us = time_spawns(posix_spawn_exec, runs);
+        if (fork_us < 0 || spawn_us < 0) {
+            fprintf(stderr, "failed: could not run %s\n", SPAWN_CMD);
+            free(ballast);
+            return 1;
+        }
+        printf("%8ldMi %10ld %14.1f %14.1f %7.1fx\n", mib, rss_kib(), fork_us, spawn_us,
+               fork_us / spawn_us);
+    }
+
+    free(ballast);
+    return 0;
+}
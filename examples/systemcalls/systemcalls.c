@@ -1,56 +1,186 @@
+#define _GNU_SOURCE     // pipe2()
+
 #include "systemcalls.h"
 
 #include <stdlib.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <syslog.h>
 
+extern char **environ;
+
+static pthread_once_t log_once = PTHREAD_ONCE_INIT;
+
+/* The log is opened once for the process and left open */
+static void log_open(void)
+{
+    openlog("systemcalls.c", LOG_CONS | LOG_PID | LOG_PERROR, LOG_USER);
+}
+
+/*
+ * Run @argv[0] (a full path) with @argv and wait for it, with its stdout on
+ * @outputfile (created or truncated) when that is not NULL. posix_spawn()
+ * starts the child with clone(CLONE_VM | CLONE_VFORK) rather than fork(),
+ * so the cost of a spawn does not grow with the caller's page tables, and
+ * it reports a failed open or exec in the child as its own return value.
+ * @attr, when not NULL, sets the child's signal state. @who names the caller
+ * in the log.
+ */
+static bool spawn_wait(const char *who, char *const argv[], const char *outputfile,
+                       const posix_spawnattr_t *attr)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_t *pactions = NULL;
+    pid_t pid;
+    int status = 0;
+    int rc;
+
+    if (outputfile != NULL) {
+        rc = posix_spawn_file_actions_init(&actions);
+        if (rc != 0) {
+            syslog(LOG_ERR, "%s: posix_spawn_file_actions_init() failed, errno=%d (%s)", who, rc, strerror(rc));
+            return false;
+        }
+        pactions = &actions;
+        rc = posix_spawn_file_actions_addopen(pactions, STDOUT_FILENO, outputfile,
+                                              O_CREAT | O_TRUNC | O_WRONLY, 0644);
+        if (rc != 0) {
+            syslog(LOG_ERR, "%s: redirect to '%s' failed, errno=%d (%s)", who, outputfile, rc, strerror(rc));
+            posix_spawn_file_actions_destroy(pactions);
+            return false;
+        }
+    }
+
+    /* The child shares our stdout: anything buffered goes out before its output */
+    fflush(NULL);
+    rc = posix_spawn(&pid, argv[0], pactions, attr, argv, environ);
+    if (pactions != NULL) {
+        posix_spawn_file_actions_destroy(pactions);
+    }
+    if (rc != 0) {
+        syslog(LOG_ERR, "%s: posix_spawn('%s', ...) failed, errno=%d (%s)", who, argv[0], rc, strerror(rc));
+        return false;
+    }
+
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            syslog(LOG_ERR, "%s: waitpid() failed, errno=%d (%m)", who, errno);
+            return false;
+        }
+    }
+
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        syslog(LOG_DEBUG, "%s: child '%s' exited normally with status=0", who, argv[0]);
+        return true;
+    }
+    syslog(LOG_ERR, "%s: child '%s' exited abnormally (status=0x%x)", who, argv[0], status);
+    return false;
+}
+
+/*
+ * What system() does to the caller's signals while a command runs: SIGINT and
+ * SIGQUIT are ignored, process-wide, from the first do_system() in progress
+ * until the last one returns, and SIGCHLD is blocked in the waiting thread.
+ */
+static pthread_mutex_t system_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int system_waiters;
+static struct sigaction system_saved_int, system_saved_quit;
+
+/*
+ * Take the caller's signals as system() would, filling @saved_mask with the
+ * thread's mask before SIGCHLD was blocked and @reset with the signals the
+ * child should get back at their default action.
+ */
+static void system_signals_hold(sigset_t *saved_mask, sigset_t *reset)
+{
+    struct sigaction ignore = { .sa_handler = SIG_IGN };
+    sigset_t chld;
+
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &chld, saved_mask);
+
+    pthread_mutex_lock(&system_lock);
+    if (system_waiters++ == 0) {
+        sigemptyset(&ignore.sa_mask);
+        sigaction(SIGINT, &ignore, &system_saved_int);
+        sigaction(SIGQUIT, &ignore, &system_saved_quit);
+    }
+    /* As system(): a signal the caller already ignored stays ignored in the child */
+    sigemptyset(reset);
+    if (system_saved_int.sa_handler != SIG_IGN)
+        sigaddset(reset, SIGINT);
+    if (system_saved_quit.sa_handler != SIG_IGN)
+        sigaddset(reset, SIGQUIT);
+    pthread_mutex_unlock(&system_lock);
+}
+
+static void system_signals_release(const sigset_t *saved_mask)
+{
+    pthread_mutex_lock(&system_lock);
+    if (--system_waiters == 0) {
+        sigaction(SIGINT, &system_saved_int, NULL);
+        sigaction(SIGQUIT, &system_saved_quit, NULL);
+    }
+    pthread_mutex_unlock(&system_lock);
+    pthread_sigmask(SIG_SETMASK, saved_mask, NULL);
+}
+
 /**
- * @param cmd the command to execute with system()
- * @return true if the command in @param cmd was executed
- *   successfully using the system() call, false if an error occurred,
- *   either in invocation of the system() call, or if a non-zero return
- *   value was returned by the command issued in @param cmd.
+ * @param cmd the shell command line to execute, as system() would
+ * @return true if /bin/sh -c @param cmd ran and exited with status 0,
+ *   false if it could not be spawned or waited for, or if it returned
+ *   a non-zero status or was killed by a signal.
 */
 bool do_system(const char *cmd)
 {
 
 /*
- * TODO  add your code here
- *  Call the system() function with the command set in the cmd
- *   and return a boolean true if the system() call completed with success
- *   or false() if it returned a failure
+ * The command runs under /bin/sh -c like system(), but spawned with
+ * posix_spawn() the same way as do_exec(). The caller's signals are
+ * handled as system() does it: SIGINT and SIGQUIT are ignored and SIGCHLD
+ * is blocked while the command runs, and the child starts with SIGINT and
+ * SIGQUIT at their defaults and the caller's own signal mask.
 */
 
-   openlog("systemcalls.c", LOG_CONS | LOG_PID | LOG_PERROR, LOG_USER);
+    posix_spawnattr_t attr;
+    sigset_t saved_mask, reset;
+    bool ok;
+    int rc;
+
+    pthread_once(&log_once, log_open);
 
     if (cmd == NULL) {
         syslog(LOG_ERR, "do_system: command is NULL, nothing to run");
-        closelog();
-        return false;
-    }
- 
-    int rc = system(cmd);
-    if (rc == -1) {
-        syslog(LOG_ERR, "do_system: system() failed to start command, errno=%d (%m)", errno);
-        closelog();
         return false;
     }
 
-   if (WIFEXITED(rc) && (WEXITSTATUS(rc) == 0))
-    {
-        syslog(LOG_DEBUG,"do_system: command '%s' ran successfully with exit=0", cmd);
-        closelog();
-        return true;
-    }
-    else
-    {
-        syslog(LOG_ERR,"do_system: command '%s' did not exit normally (status=0x%x)", cmd, rc);
-        closelog();
+    char *const command[] = { "/bin/sh", "-c", (char *)cmd, NULL };
+
+    rc = posix_spawnattr_init(&attr);
+    if (rc != 0) {
+        syslog(LOG_ERR, "do_system: posix_spawnattr_init() failed, errno=%d (%s)", rc, strerror(rc));
         return false;
     }
+    system_signals_hold(&saved_mask, &reset);
+    posix_spawnattr_setsigdefault(&attr, &reset);
+    posix_spawnattr_setsigmask(&attr, &saved_mask);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+
+    ok = spawn_wait("do_system", command, NULL, &attr);
+
+    system_signals_release(&saved_mask);
+    posix_spawnattr_destroy(&attr);
+    return ok;
 }
 
 /**
@@ -80,8 +210,13 @@ bool do_exec(int count, ...)
  *   as second argument to the execv() command.
  *
 */
- 
-    openlog("systemcalls.c", LOG_CONS | LOG_PID | LOG_PERROR, LOG_USER);
+
+    pthread_once(&log_once, log_open);
+
+    if (count < 1) {
+        syslog(LOG_ERR, "do_exec: bad args");
+        return false;
+    }
 
     va_list args;
     va_start(args, count);
@@ -91,42 +226,10 @@ bool do_exec(int count, ...)
         command[i] = va_arg(args, char *);
     }
     command[count] = NULL;
-   
-    fflush(NULL);
-
-    pid_t pid = fork();
-    if (pid < 0) {
-        va_end(args);
-        syslog(LOG_ERR, "do_exec: fork() failed, errno=%d (%m)", errno);
-        closelog();
-        return false;
-    }
-
-    if (pid == 0) {
-        execv(command[0], command);
-        syslog(LOG_ERR, "do_exec: execv('%s', ...) failed, errno=%d (%m)", command[0], errno);
-        _exit(127);
-    }
-
-    int status = 0;
-    if (waitpid(pid, &status, 0) < 0) {
-        va_end(args);
-        syslog(LOG_ERR, "do_exec: waitpid() failed, errno=%d (%m)", errno);
-        closelog();
-        return false;
-    }
 
     va_end(args);
 
-    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
-        syslog(LOG_DEBUG, "do_exec: child '%s' exited normally with status=0", command[0]);
-        closelog();
-        return true;
-    } else {
-        syslog(LOG_ERR, "do_exec: child '%s' exited abnormally (status=0x%x)", command[0], status);
-        closelog();
-        return false;
-    }
+    return spawn_wait("do_exec", command, NULL, NULL);
 }
 
 /**
@@ -147,73 +250,397 @@ bool do_exec_redirect(const char *outputfile, int count, ...)
  *
 */
 
-openlog("systemcalls.c", LOG_CONS | LOG_PID | LOG_PERROR, LOG_USER);
+    pthread_once(&log_once, log_open);
 
     if (outputfile == NULL || count < 1) {
-        syslog(LOG_ERR, "do_exec_redirect: bad args\n");
-        closelog();
+        syslog(LOG_ERR, "do_exec_redirect: bad args");
         return false;
     }
 
     va_list args;
     va_start(args, count);
 
-     char *command[count + 1];
+    char *command[count + 1];
     for (int i = 0; i < count; i++) {
         command[i] = va_arg(args, char *);
     }
     command[count] = NULL;
 
-    int fd = open(outputfile, O_CREAT | O_TRUNC | O_WRONLY, 0644);
-    if (fd < 0) {
-        va_end(args);
-        syslog(LOG_ERR, "do_exec_redirect: open('%s') failed with errno=%d\n", outputfile, errno);
-        closelog();
-        return false;
+    va_end(args);
+
+    return spawn_wait("do_exec_redirect", command, outputfile, NULL);
+}
+
+#define BATCH_EVENTS      64
+#define BATCH_POLL_MS     10      // waitpid() rounds for children without a pidfd
+#define CAPTURE_INITIAL   4096
+
+enum batch_fd { BATCH_OUT, BATCH_ERR, BATCH_PID, BATCH_FDS };
+
+/* The parent's side of one running batch command */
+struct batch_slot {
+    pid_t pid;
+    int fd[BATCH_FDS];      // Pipe read ends and pidfd, -1 once closed or without one
+    struct timespec start;
+};
+
+static int sys_pidfd_open(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static void slot_close(struct batch_slot *slot, enum batch_fd which)
+{
+    if (slot->fd[which] >= 0) {
+        close(slot->fd[which]);   // Last reference: drops it from the epoll set too
+        slot->fd[which] = -1;
     }
+}
 
-    fflush(NULL);
-    pid_t pid = fork();
-    if (pid < 0) {
-        va_end(args);
-        syslog(LOG_ERR, "do_exec_redirect: fork failed with errno=%d\n", errno);
-        close(fd);
-        closelog();
+/* Append @n bytes to @o; past an allocation failure they are dropped */
+static void capture_append(struct exec_output *o, const char *buf, size_t n)
+{
+    if (o->truncated) {
+        return;
+    }
+    /* One byte always spare for the terminating NUL */
+    if (o->len + n + 1 > o->cap) {
+        size_t cap = o->cap ? o->cap : CAPTURE_INITIAL;
+        char *grown;
+
+        while (o->len + n + 1 > cap) {
+            cap *= 2;
+        }
+        grown = realloc(o->data, cap);
+        if (grown == NULL) {
+            o->truncated = true;
+            return;
+        }
+        o->data = grown;
+        o->cap = cap;
+    }
+    memcpy(o->data + o->len, buf, n);
+    o->len += n;
+    o->data[o->len] = '\0';
+}
+
+/* Read @fd into @o until it would block; true at end of file or on an error */
+static bool capture_read(int fd, struct exec_output *o)
+{
+    char scratch[CAPTURE_INITIAL];
+
+    for (;;) {
+        ssize_t n;
+
+        /* Straight into the buffer while it has room, else through scratch */
+        if (!o->truncated && o->data != NULL && o->len + 1 < o->cap) {
+            n = read(fd, o->data + o->len, o->cap - o->len - 1);
+            if (n > 0) {
+                o->len += (size_t)n;
+                o->data[o->len] = '\0';
+            }
+        } else {
+            n = read(fd, scratch, sizeof(scratch));
+            if (n > 0) {
+                capture_append(o, scratch, (size_t)n);
+            }
+        }
+        if (n > 0) {
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        return n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+    }
+}
+
+/*
+ * Spawn @job with its stdout and stderr on fresh pipes and stdin on
+ * /dev/null, and add the read ends and the child's pidfd to @epfd. Every
+ * descriptor the parent holds is close-on-exec, so no other command in the
+ * batch inherits them. False if it could not be started.
+ */
+static bool batch_start(int epfd, size_t index, struct exec_job *job, struct batch_slot *slot)
+{
+    posix_spawn_file_actions_t actions;
+    int pipes[2][2] = { { -1, -1 }, { -1, -1 } };
+    bool watched = true;
+    int rc = 0;
+
+    for (int i = 0; i < BATCH_FDS; i++) {
+        slot->fd[i] = -1;
+    }
+    slot->pid = -1;
+
+    for (int i = 0; i < 2 && rc == 0; i++) {
+        if (pipe2(pipes[i], O_CLOEXEC) < 0) {
+            rc = errno;
+        }
+    }
+    if (rc == 0) {
+        rc = posix_spawn_file_actions_init(&actions);
+        if (rc == 0) {
+            /* dup2 clears close-on-exec on the child's copies */
+            rc = posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+            if (rc == 0) {
+                rc = posix_spawn_file_actions_adddup2(&actions, pipes[BATCH_OUT][1], STDOUT_FILENO);
+            }
+            if (rc == 0) {
+                rc = posix_spawn_file_actions_adddup2(&actions, pipes[BATCH_ERR][1], STDERR_FILENO);
+            }
+            if (rc == 0) {
+                clock_gettime(CLOCK_MONOTONIC, &slot->start);
+                rc = posix_spawn(&slot->pid, job->argv[0], &actions, NULL, job->argv, environ);
+            }
+            posix_spawn_file_actions_destroy(&actions);
+        }
+    }
+
+    for (int i = 0; i < 2; i++) {
+        if (pipes[i][1] >= 0) {
+            close(pipes[i][1]);
+        }
+        slot->fd[i] = pipes[i][0];
+    }
+    if (rc != 0) {
+        syslog(LOG_ERR, "do_exec_batch: could not start '%s', errno=%d (%s)", job->argv[0], rc, strerror(rc));
+        slot_close(slot, BATCH_OUT);
+        slot_close(slot, BATCH_ERR);
+        slot->pid = -1;
+        job->spawn_errno = rc;
         return false;
     }
 
-    if (pid == 0) {
-        if (dup2(fd, STDOUT_FILENO) < 0) {
-            syslog(LOG_ERR, "do_exec_redirect: dup2 failed with errno=%d\n", errno);
-            close(fd);
-            _exit(126);
+    /* Without a pidfd (before Linux 5.3) the loop polls the child instead */
+    slot->fd[BATCH_PID] = sys_pidfd_open(slot->pid);
+
+    for (int i = 0; i < BATCH_FDS; i++) {
+        struct epoll_event ev = { .events = EPOLLIN, .data.u64 = (uint64_t)index * BATCH_FDS + (uint64_t)i };
+
+        if (slot->fd[i] < 0) {
+            continue;
+        }
+        if (i != BATCH_PID) {
+            fcntl(slot->fd[i], F_SETFL, fcntl(slot->fd[i], F_GETFL) | O_NONBLOCK);
+        } else if (!watched) {
+            slot_close(slot, BATCH_PID);
+            continue;
+        }
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, slot->fd[i], &ev) < 0) {
+            syslog(LOG_ERR, "do_exec_batch: epoll_ctl() failed, errno=%d (%m)", errno);
+            watched = false;
+            if (i == BATCH_PID) {
+                slot_close(slot, BATCH_PID);
+            }
         }
-        close(fd);
-        execv(command[0], command);
-        syslog(LOG_ERR, "do_exec_redirect: execv failed with errno=%d\n", errno);
-        _exit(127);
     }
+    return true;
+}
 
-    close(fd);
+/*
+ * Reap @job if it has exited, or wait for it when @block. Its pipes are
+ * drained of whatever it wrote before exiting and closed, so a background
+ * grandchild still holding them cannot stall the batch. True once reaped.
+ */
+static bool batch_reap(struct exec_job *job, struct batch_slot *slot, bool block)
+{
+    struct timespec end;
+    pid_t rc;
 
-    int status = 0;
-    if (waitpid(pid, &status, 0) < 0) {
-        va_end(args);
-        syslog(LOG_ERR, "do_exec_redirect: waitpid() failed, errno=%d (%m)", errno);
-        closelog();
+    do {
+        rc = waitpid(slot->pid, &job->status, block ? 0 : WNOHANG);
+    } while (rc < 0 && errno == EINTR);
+    if (rc == 0) {
         return false;
     }
+    if (rc < 0) {
+        syslog(LOG_ERR, "do_exec_batch: waitpid() failed, errno=%d (%m)", errno);
+        job->status = -1;
+    }
 
-    va_end(args);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    /* Signed: the tv_nsec difference is negative across a second boundary */
+    job->elapsed_us = (uint64_t)((int64_t)(end.tv_sec - slot->start.tv_sec) * 1000000 +
+                                 (end.tv_nsec - slot->start.tv_nsec) / 1000);
+    if (slot->fd[BATCH_OUT] >= 0) {
+        capture_read(slot->fd[BATCH_OUT], &job->out);
+    }
+    if (slot->fd[BATCH_ERR] >= 0) {
+        capture_read(slot->fd[BATCH_ERR], &job->err);
+    }
+    for (int i = 0; i < BATCH_FDS; i++) {
+        slot_close(slot, (enum batch_fd)i);
+    }
+    slot->pid = -1;
 
-    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
-        syslog(LOG_DEBUG, "do_exec_redirect: child '%s' exited normally with status=0", command[0]);
-        closelog();
+    if (job->status != -1 && WIFEXITED(job->status) && WEXITSTATUS(job->status) == 0) {
+        syslog(LOG_DEBUG, "do_exec_batch: child '%s' exited normally with status=0", job->argv[0]);
+    } else {
+        syslog(LOG_ERR, "do_exec_batch: child '%s' exited abnormally (status=0x%x)", job->argv[0], job->status);
+    }
+    return true;
+}
+
+/**
+* @param jobs - The commands to run. Each one's argv must be set; every other
+*   field is overwritten with its result. Release the captured output with
+*   exec_job_release().
+* @param count - The number of entries in @param jobs
+* @param max_parallel - The most commands running at once, 0 for one per online CPU
+* @return true if every command was started and exited with status 0, false
+*   otherwise. The commands are started in order and each one runs to
+*   completion whatever happens to the others.
+*
+* Each command is spawned like do_exec(), with stdin on /dev/null and stdout
+* and stderr captured in memory through pipes. One epoll set multiplexes
+* every pipe and each child's pidfd, so output is read as it arrives and a
+* child is reaped as soon as it exits, with no temporary files.
+*/
+bool do_exec_batch(struct exec_job *jobs, size_t count, unsigned int max_parallel)
+{
+    struct epoll_event events[BATCH_EVENTS];
+    struct batch_slot *slots;
+    size_t next = 0, running = 0, finished = 0, unwatched = 0;
+    bool ok = true;
+    int epfd;
+
+    pthread_once(&log_once, log_open);
+
+    if (count == 0) {
         return true;
-    }else{
-        syslog(LOG_ERR, "do_exec_redirect: child '%s' exited abnormally (status=0x%x)", command[0], status);
-        closelog();
+    }
+    if (jobs == NULL) {
+        syslog(LOG_ERR, "do_exec_batch: bad args");
         return false;
     }
-    
+    for (size_t i = 0; i < count; i++) {
+        jobs[i].status = -1;
+        jobs[i].spawn_errno = 0;
+        jobs[i].elapsed_us = 0;
+        memset(&jobs[i].out, 0, sizeof(jobs[i].out));
+        memset(&jobs[i].err, 0, sizeof(jobs[i].err));
+        if (jobs[i].argv == NULL || jobs[i].argv[0] == NULL) {
+            syslog(LOG_ERR, "do_exec_batch: bad args");
+            return false;
+        }
+    }
+    if (max_parallel == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+        max_parallel = cpus > 0 ? (unsigned int)cpus : 1;
+    }
+
+    slots = calloc(count, sizeof(*slots));
+    if (slots == NULL) {
+        syslog(LOG_ERR, "do_exec_batch: out of memory for %zu commands", count);
+        return false;
+    }
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        syslog(LOG_ERR, "do_exec_batch: epoll_create1() failed, errno=%d (%m)", errno);
+        free(slots);
+        return false;
+    }
+
+    while (finished < count) {
+        int n;
+
+        while (running < max_parallel && next < count) {
+            if (batch_start(epfd, next, &jobs[next], &slots[next])) {
+                running++;
+                if (slots[next].fd[BATCH_PID] < 0) {
+                    unwatched++;
+                }
+            } else {
+                ok = false;
+                finished++;
+            }
+            next++;
+        }
+        if (running == 0) {
+            continue;
+        }
+
+        n = epoll_wait(epfd, events, BATCH_EVENTS, unwatched ? BATCH_POLL_MS : -1);
+        if (n < 0 && errno != EINTR) {
+            syslog(LOG_ERR, "do_exec_batch: epoll_wait() failed, errno=%d (%m)", errno);
+            break;
+        }
+
+        for (int e = 0; e < n; e++) {
+            size_t index = (size_t)(events[e].data.u64 / BATCH_FDS);
+            enum batch_fd which = (enum batch_fd)(events[e].data.u64 % BATCH_FDS);
+            struct batch_slot *slot = &slots[index];
+
+            /* An earlier event in this round may have reaped it already */
+            if (slot->fd[which] < 0) {
+                continue;
+            }
+            if (which == BATCH_PID) {
+                if (batch_reap(&jobs[index], slot, false)) {
+                    running--;
+                    finished++;
+                }
+            } else if (capture_read(slot->fd[which],
+                                    which == BATCH_OUT ? &jobs[index].out : &jobs[index].err)) {
+                slot_close(slot, which);
+            }
+        }
+
+        /* Children the epoll set cannot report: drain and try to reap each round */
+        for (size_t i = 0; unwatched && i < next; i++) {
+            struct batch_slot *slot = &slots[i];
+
+            if (slot->pid <= 0 || slot->fd[BATCH_PID] >= 0) {
+                continue;
+            }
+            if (slot->fd[BATCH_OUT] >= 0 && capture_read(slot->fd[BATCH_OUT], &jobs[i].out)) {
+                slot_close(slot, BATCH_OUT);
+            }
+            if (slot->fd[BATCH_ERR] >= 0 && capture_read(slot->fd[BATCH_ERR], &jobs[i].err)) {
+                slot_close(slot, BATCH_ERR);
+            }
+            if (batch_reap(&jobs[i], slot, false)) {
+                unwatched--;
+                running--;
+                finished++;
+            }
+        }
+    }
+
+    /* Only after an epoll failure: wait the remaining commands out */
+    for (size_t i = 0; i < next; i++) {
+        if (slots[i].pid > 0) {
+            batch_reap(&jobs[i], &slots[i], true);
+        }
+    }
+    if (finished < count) {
+        ok = false;
+    }
+
+    close(epfd);
+    free(slots);
+
+    for (size_t i = 0; ok && i < count; i++) {
+        ok = jobs[i].status != -1 && WIFEXITED(jobs[i].status) && WEXITSTATUS(jobs[i].status) == 0;
+    }
+    return ok;
+}
+
+/**
+* @param job - A job run by do_exec_batch(); frees its captured output
+*/
+void exec_job_release(struct exec_job *job)
+{
+    free(job->out.data);
+    free(job->err.data);
+    memset(&job->out, 0, sizeof(job->out));
+    memset(&job->err, 0, sizeof(job->err));
 }
@@ -1,9 +1,34 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
 
 bool do_system(const char *command);
 
 bool do_exec(int count, ...);
 
 bool do_exec_redirect(const char *outputfile, int count, ...);
+
+/* Everything a batch command wrote to one of its streams */
+struct exec_output {
+    char *data;         // NUL-terminated once anything was read, else NULL
+    size_t len;
+    size_t cap;
+    bool truncated;     // Out of memory: the rest was read and dropped
+};
+
+struct exec_job {
+    char *const *argv;  // In: full path of the command first, NULL-terminated
+
+    /* Out, filled in by do_exec_batch() */
+    int status;         // From waitpid(), -1 if the command never ran or was not reaped
+    int spawn_errno;    // posix_spawn() error when it could not be started, else 0
+    uint64_t elapsed_us;
+    struct exec_output out;
+    struct exec_output err;
+};
+
+bool do_exec_batch(struct exec_job *jobs, size_t count, unsigned int max_parallel);
+
+void exec_job_release(struct exec_job *job);
@@ -0,0 +1,96 @@
+#!/bin/sh
+# Benchmark: finder (native) against finder.sh on a generated log tree
+# Usage: finder-bench.sh [dirs] [files_per_dir] [runs] [big_files]
+# Builds finder if needed, checks both print the same line and reports the
+# best wall time of each over the runs (warm page cache).
+
+set -e
+set -u
+
+DIRS=${1:-100}
+FILES=${2:-100}
+RUNS=${3:-3}
+BIGFILES=${4:-4}
+SEARCHSTR=AELD_IS_FUN
+FINDER_APP_DIR=$(realpath "$(dirname "$0")")
+
+# finder.sh sets pipefail, which dash does not know
+SCRIPT_SHELL=sh
+if command -v bash > /dev/null 2>&1
+then
+	SCRIPT_SHELL=bash
+fi
+
+if [ ! -x "${FINDER_APP_DIR}/finder" ]
+then
+	make -C "${FINDER_APP_DIR}" finder > /dev/null
+fi
+
+TREE=$(mktemp -d /tmp/finder-bench.XXXXXX)
+trap 'rm -rf "${TREE}"' EXIT
+
+echo "Generating ${DIRS} directories of ${FILES} files and ${BIGFILES} 16 MiB logs in ${TREE}"
+LINE="Oct 27 10:00:00 target kernel: aesdchar: write of 64 bytes at offset 4096 completed"
+BLOCK=""
+for i in $(seq 1 30)
+do
+	BLOCK="${BLOCK}${LINE} ${i}
+"
+done
+BLOCK="${BLOCK}${LINE} ${SEARCHSTR}
+"
+for d in $(seq 1 "${DIRS}")
+do
+	mkdir -p "${TREE}/d$((d % 10))/run${d}"
+	for f in $(seq 1 "${FILES}")
+	do
+		printf '%s' "${BLOCK}${BLOCK}" > "${TREE}/d$((d % 10))/run${d}/log${f}.txt"
+	done
+done
+for b in $(seq 1 "${BIGFILES}")
+do
+	yes "${LINE} ${SEARCHSTR}" | head -c 16777216 > "${TREE}/big${b}.log"
+done
+
+now_ms()
+{
+	echo $(( $(date +%s%N) / 1000000 ))
+}
+
+# best_of <runs> <command...>: fastest wall time in ms; output kept in $OUT
+best_of()
+{
+	runs=$1
+	shift
+	best=
+	for r in $(seq 1 "${runs}")
+	do
+		start=$(now_ms)
+		OUT=$("$@")
+		elapsed=$(( $(now_ms) - start ))
+		if [ -z "${best}" ] || [ "${elapsed}" -lt "${best}" ]
+		then
+			best=${elapsed}
+		fi
+	done
+	BEST=${best}
+}
+
+best_of "${RUNS}" "${SCRIPT_SHELL}" "${FINDER_APP_DIR}/finder.sh" "${TREE}" "${SEARCHSTR}"
+SCRIPT_OUT=${OUT}
+SCRIPT_MS=${BEST}
+best_of "${RUNS}" "${FINDER_APP_DIR}/finder" "${TREE}" "${SEARCHSTR}"
+NATIVE_OUT=${OUT}
+NATIVE_MS=${BEST}
+
+echo "finder.sh: ${SCRIPT_MS} ms  ${SCRIPT_OUT}"
+echo "finder:    ${NATIVE_MS} ms  ${NATIVE_OUT}"
+if [ "${SCRIPT_OUT}" != "${NATIVE_OUT}" ]
+then
+	echo "failed: outputs differ"
+	exit 1
+fi
+if [ "${NATIVE_MS}" -gt 0 ]
+then
+	echo "speedup: $(( SCRIPT_MS * 10 / NATIVE_MS / 10 )).$(( SCRIPT_MS * 10 / NATIVE_MS % 10 ))x"
+fi
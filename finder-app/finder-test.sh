@@ -53,10 +53,14 @@ fi
 #make clean
 #make
 
-for i in $( seq 1 $NUMFILES)
-do
-	writer "$WRITEDIR/${username}$i.txt" "$WRITESTR"
-done
+# One writer process for all the files; a writer without batch mode (writer.sh) gets one call per file
+if ! writer -n "$NUMFILES" "$WRITEDIR/${username}%d.txt" "$WRITESTR" > /dev/null 2>&1
+then
+	for i in $( seq 1 $NUMFILES)
+	do
+		writer "$WRITEDIR/${username}$i.txt" "$WRITESTR"
+	done
+fi
 
 OUTPUTSTRING=$(finder.sh "$WRITEDIR" "$WRITESTR")
 echo "$OUTPUTSTRING" > "$OUTPUTFILE"
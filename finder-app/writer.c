@@ -1,23 +1,398 @@
-
+#define _GNU_SOURCE   // O_TMPFILE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <syslog.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * writer <file> <string>
+ * writer [-j threads] [-a] -n <count> <pattern> <string>
+ * writer [-j threads] [-a] -m < manifest
+ *
+ * Batch modes create many files from one process: -n writes <string> to
+ * <count> files named by <pattern> with its "%d" replaced by 1..count, and
+ * -m reads one "<file><TAB><string>" line per file from stdin. A pool of
+ * threads claims files from a shared counter. With -a each file is written
+ * unnamed (O_TMPFILE) and linked in only once complete, so no reader ever
+ * sees it partly written; that costs a few times the plain create on ext4.
+ */
+
+#define MAX_THREADS 64
+#define INDEX_MARK  "%d"
+
+struct batch {
+    /* -n: file i is prefix + i + suffix, all holding text */
+    const char *prefix;
+    size_t prefix_len;
+    const char *suffix;
+    const char *text;
+    /* -m: one path and text per manifest line */
+    char **paths;
+    char **texts;
+    unsigned long count;
+    bool atomic;                     // -a
+
+    atomic_ulong next;               // Next file to claim
+    atomic_ulong failed;
+    atomic_ullong bytes;
+};
+
+static atomic_bool g_tmpfile_ok = true;   // Cleared once O_TMPFILE or /proc is missing
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// An unnamed file in path's directory, or -1 (errno set) when the name must be used directly
+static int open_unnamed(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    char dir[PATH_MAX];
+    int fd;
+
+    if (!slash) {
+        strcpy(dir, ".");
+    } else if ((size_t)(slash - path) >= sizeof(dir)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    } else {
+        memcpy(dir, path, (size_t)(slash - path));
+        dir[slash - path] = '\0';
+        if (slash == path)
+            strcpy(dir, "/");
+    }
+    fd = open(dir, O_TMPFILE | O_WRONLY | O_CLOEXEC, 0666);
+    if (fd < 0 && (errno == EOPNOTSUPP || errno == EISDIR || errno == EINVAL)) {
+        if (atomic_exchange(&g_tmpfile_ok, false))
+            syslog(LOG_WARNING, "O_TMPFILE unsupported in %s, writing files in place", dir);
+    }
+    return fd;
+}
+
+// Give the unnamed file fd the name path, replacing any file there in one step
+static int link_unnamed(int fd, const char *path)
+{
+    char proc[64], tmp[PATH_MAX];
+
+    snprintf(proc, sizeof(proc), "/proc/self/fd/%d", fd);
+    if (linkat(AT_FDCWD, proc, AT_FDCWD, path, AT_SYMLINK_FOLLOW) == 0)
+        return 0;
+    if (errno != EEXIST)
+        return -1;
+    // fopen("w") semantics: an existing file is replaced
+    if (snprintf(tmp, sizeof(tmp), "%s.%d.%lx~", path, (int)getpid(),
+                 (unsigned long)pthread_self()) >= (int)sizeof(tmp)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if (linkat(AT_FDCWD, proc, AT_FDCWD, tmp, AT_SYMLINK_FOLLOW) != 0)
+        return -1;
+    if (rename(tmp, path) != 0) {
+        int err = errno;
+
+        unlink(tmp);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+// Create or truncate path to hold len bytes of text: 0, or -1 with errno set
+static int write_file(const char *path, const char *text, size_t len, bool atomic)
+{
+    int fd = -1;
+    bool unnamed = false;
+
+    if (atomic && g_tmpfile_ok) {
+        fd = open_unnamed(path);
+        if (fd < 0 && g_tmpfile_ok)
+            return -1;
+        unnamed = fd >= 0;
+    }
+    if (!unnamed)
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0)
+        return -1;
+    if (write_all(fd, text, len) != 0 || (unnamed && link_unnamed(fd, path) != 0)) {
+        int err = errno;
+
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return close(fd);
+}
+
+static void *batch_worker(void *arg)
+{
+    struct batch *b = arg;
+    char path[PATH_MAX];
+    unsigned long i;
+
+    while ((i = atomic_fetch_add(&b->next, 1)) < b->count) {
+        const char *name = path, *text = b->text;
+
+        if (b->paths) {
+            name = b->paths[i];
+            text = b->texts[i];
+        } else if (snprintf(path, sizeof(path), "%.*s%lu%s", (int)b->prefix_len, b->prefix,
+                            i + 1, b->suffix) >= (int)sizeof(path)) {
+            syslog(LOG_ERR, "File name for %lu is too long", i + 1);
+            b->failed++;
+            continue;
+        }
+        if (write_file(name, text, strlen(text), b->atomic) != 0) {
+            syslog(LOG_ERR, "Failed to write %s: %m", name);
+            b->failed++;
+            continue;
+        }
+        b->bytes += strlen(text);
+    }
+    return NULL;
+}
+
+// Read "<file><TAB><string>" lines from stdin; empty lines are skipped
+static int read_manifest(struct batch *b)
+{
+    unsigned long cap = 0;
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t n;
+
+    while ((n = getline(&line, &line_cap, stdin)) >= 0) {
+        char *tab;
+
+        if (n > 0 && line[n - 1] == '\n')
+            line[--n] = '\0';
+        if (n == 0)
+            continue;
+        tab = strchr(line, '\t');
+        if (!tab || tab == line) {
+            syslog(LOG_ERR, "Manifest line %lu is not <file><TAB><string>", b->count + 1);
+            free(line);
+            return -1;
+        }
+        if (b->count == cap) {
+            char **paths = realloc(b->paths, (cap ? cap * 2 : 1024) * sizeof(*paths));
+            char **texts = paths ? realloc(b->texts, (cap ? cap * 2 : 1024) * sizeof(*texts)) : NULL;
+
+            if (paths)
+                b->paths = paths;
+            if (!texts) {
+                syslog(LOG_ERR, "Out of memory reading the manifest");
+                free(line);
+                return -1;
+            }
+            b->texts = texts;
+            cap = cap ? cap * 2 : 1024;
+        }
+        *tab = '\0';
+        b->paths[b->count] = strdup(line);
+        b->texts[b->count] = strdup(tab + 1);
+        b->count++;
+        if (!b->paths[b->count - 1] || !b->texts[b->count - 1]) {
+            syslog(LOG_ERR, "Out of memory reading the manifest");
+            free(line);
+            return -1;
+        }
+    }
+    free(line);
+    return 0;
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int run_batch(struct batch *b, int nthreads)
+{
+    pthread_t tids[MAX_THREADS];
+    int started = 0;
+    double start = now_s(), elapsed;
+
+    if ((unsigned long)nthreads > b->count)
+        nthreads = b->count ? (int)b->count : 1;
+    // Naming an unnamed file goes through /proc/self/fd
+    if (b->atomic && access("/proc/self/fd", X_OK) != 0) {
+        syslog(LOG_WARNING, "/proc is not mounted, writing files in place");
+        g_tmpfile_ok = false;
+    }
+    // The calling thread works too
+    for (int i = 1; i < nthreads; i++) {
+        int rc = pthread_create(&tids[started], NULL, batch_worker, b);
+
+        if (rc != 0) {
+            syslog(LOG_WARNING, "Started %d of %d threads: %s", i, nthreads, strerror(rc));
+            break;
+        }
+        started++;
+    }
+    batch_worker(b);
+    for (int i = 0; i < started; i++)
+        pthread_join(tids[i], NULL);
+    elapsed = now_s() - start;
+
+    unsigned long failed = b->failed, written = b->count - failed;
+    char summary[256];
+
+    snprintf(summary, sizeof(summary),
+             "Wrote %lu files (%llu bytes) in %.3f s with %d thread(s), %.0f files/s%s",
+             written, (unsigned long long)b->bytes, elapsed, started + 1,
+             elapsed > 0 ? (double)written / elapsed : 0.0,
+             b->atomic ? (g_tmpfile_ok ? ", atomic" : ", atomic unavailable") : "");
+    syslog(LOG_INFO, "%s", summary);
+    printf("%s\n", summary);
+    if (failed) {
+        syslog(LOG_ERR, "%lu files failed", failed);
+        fprintf(stderr, "%lu files failed\n", failed);
+        return 1;
+    }
+    return 0;
+}
+
+static int parse_count(const char *s, unsigned long max, unsigned long *out)
+{
+    char *end = NULL;
+    unsigned long v;
+
+    errno = 0;
+    v = strtoul(s, &end, 10);
+    if (errno || end == s || *end != '\0' || v == 0 || v > max)
+        return -1;
+    *out = v;
+    return 0;
+}
+
+/* Whether @arg starts the batch form: -j, -a, -n or -m, alone or with its value */
+static bool batch_option(const char *arg)
+{
+    return arg[0] == '-' && arg[1] != '\0' && strchr("jnam", arg[1]) &&
+           (arg[2] == '\0' || arg[1] == 'j' || arg[1] == 'n');
+}
 
 int main(int argc, char *argv[]) {
     // Opening syslog with facility LOG_USER and tag "writer"
     openlog("writer", LOG_PID, LOG_USER);
 
+    struct batch batch = { .count = 0 };
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int nthreads = ncpu > 0 ? (int)(ncpu < MAX_THREADS ? ncpu : MAX_THREADS) : 1;
+    bool manifest = false;
+    unsigned long v;
+    int opt;
+
+    /*
+     * Only the batch forms take options, so "writer -out.txt text" still writes
+     * the file -out.txt. '+': a file or string starting with '-' after the
+     * options is not an option.
+     */
+    bool options = argc > 1 && batch_option(argv[1]);
+    while (options && (opt = getopt(argc, argv, "+j:an:m")) != -1) {
+        switch (opt) {
+        case 'j':
+            if (parse_count(optarg, MAX_THREADS, &v) != 0) {
+                syslog(LOG_ERR, "Invalid thread count %s", optarg);
+                closelog();
+                return 1;
+            }
+            nthreads = (int)v;
+            break;
+        case 'a':
+            batch.atomic = true;
+            break;
+        case 'n':
+            if (parse_count(optarg, ULONG_MAX / 2, &batch.count) != 0) {
+                syslog(LOG_ERR, "Invalid file count %s", optarg);
+                closelog();
+                return 1;
+            }
+            break;
+        case 'm':
+            manifest = true;
+            break;
+        default:
+            syslog(LOG_ERR, "Usage: %s <file> <string> | [-j threads] [-a] -n <count> <pattern> <string> | [-j threads] [-a] -m", argv[0]);
+            closelog();
+            return 1;
+        }
+    }
+
+    if (manifest) {
+        int rc;
+
+        if (batch.count || optind != argc) {
+            syslog(LOG_ERR, "Usage: %s [-j threads] [-a] -m < manifest", argv[0]);
+            closelog();
+            return 1;
+        }
+        rc = read_manifest(&batch);
+        if (rc == 0) {
+            syslog(LOG_DEBUG, "Writing %lu files from the manifest", batch.count);
+            rc = run_batch(&batch, nthreads);
+        }
+        for (unsigned long i = 0; i < batch.count; i++) {
+            free(batch.paths[i]);
+            free(batch.texts[i]);
+        }
+        free(batch.paths);
+        free(batch.texts);
+        closelog();
+        return rc ? 1 : 0;
+    }
+
+    if (batch.count) {
+        const char *mark;
+        int rc;
+
+        if (argc - optind != 2 || !(mark = strstr(argv[optind], INDEX_MARK))) {
+            syslog(LOG_ERR, "Usage: %s [-j threads] [-a] -n <count> <pattern with %s> <string>",
+                   argv[0], INDEX_MARK);
+            closelog();
+            return 1;
+        }
+        batch.prefix = argv[optind];
+        batch.prefix_len = (size_t)(mark - argv[optind]);
+        batch.suffix = mark + strlen(INDEX_MARK);
+        batch.text = argv[optind + 1];
+        syslog(LOG_DEBUG, "Writing %s to %lu files %s", batch.text, batch.count, batch.prefix);
+        rc = run_batch(&batch, nthreads);
+        closelog();
+        return rc;
+    }
+
     // Expecting two arguments: <file> <string>
-    if (argc != 3) {
+    if (argc - optind != 2) {
         syslog(LOG_ERR, "Usage: %s <file> <string>", argv[0]);
         closelog();
         return 1;
     }
 
-    const char *filepath = argv[1];
-    const char *text     = argv[2];
+    const char *filepath = argv[optind];
+    const char *text     = argv[optind + 1];
 
     // Debug log
     syslog(LOG_DEBUG, "Writing %s to %s", text, filepath);
@@ -47,4 +422,3 @@ int main(int argc, char *argv[]) {
     closelog();
     return 0;  // success
 }
-
@@ -0,0 +1,294 @@
+/*
+ * aesdsocket-append-test.c
+ *
+ * Concurrent-append check for aesdsocket: C connections each send N
+ * newline-terminated packets of S bytes at once, and every echo must be a
+ * consistent view of the history: whole packets only, none twice, each
+ * connection's in the order it sent them, ending with the packet just sent.
+ * With packets larger than a quarter of a reply chunk a reply spans several
+ * reads, so an append that shifts the char device's or the ring's offsets
+ * mid-reply shows up as a torn or repeated packet.
+ *
+ * Then a connection that asked for the history and stopped reading must not
+ * hold up another connection's append: its echo has STALL_LIMIT_S to come
+ * back. Build with "make check".
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ECHO_TIMEOUT_S 10
+#define STALL_FILL     10          // History packets in front of the stalled reply
+#define STALL_SIZE     (256 * 1024)
+#define STALL_LIMIT_S  2
+
+struct test_cfg {
+    const char *host;
+    const char *port;
+    int conns;
+    int requests;
+    size_t size;
+};
+
+struct test_worker {
+    pthread_t tid;
+    int id;
+    const struct test_cfg *cfg;
+    char *reply;         // Growable buffer holding the current echo
+    size_t cap;
+    int failed;
+};
+
+/* Connect to @host:@port, with a receive buffer of @rcvbuf bytes unless 0 */
+static int connect_to(const char *host, const char *port, int rcvbuf)
+{
+    struct addrinfo hints, *res, *ai;
+    int fd = -1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &res) != 0)
+        return -1;
+    for (ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0)
+            continue;
+        if (rcvbuf)
+            setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+static void make_packet(char *pkt, size_t size, int conn, int req)
+{
+    int n = snprintf(pkt, size, "c%d r%d ", conn, req);
+
+    memset(pkt + n, 'x', size - (size_t)n - 1);
+    pkt[size - 1] = '\n';
+}
+
+/* Read one echo into w->reply until it ends with @pkt; its length or -1 */
+static ssize_t read_echo(struct test_worker *w, int fd, const char *pkt, size_t len)
+{
+    size_t have = 0;
+
+    for (;;) {
+        ssize_t n;
+
+        if (w->cap - have < 65536) {
+            char *grown = realloc(w->reply, w->cap * 2 + 65536);
+
+            if (!grown)
+                return -1;
+            w->reply = grown;
+            w->cap = w->cap * 2 + 65536;
+        }
+        n = recv(fd, w->reply + have, w->cap - have, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            fprintf(stderr, "c%d: %s after %zu bytes of echo\n", w->id,
+                    n == 0 ? "EOF" : strerror(errno), have);
+            return -1;
+        }
+        have += (size_t)n;
+        if (have >= len && memcmp(w->reply + have - len, pkt, len) == 0)
+            return (ssize_t)have;
+    }
+}
+
+/* Check an echo of @len bytes is whole, distinct, per-connection ordered packets */
+static int check_echo(const struct test_worker *w, size_t len)
+{
+    const struct test_cfg *cfg = w->cfg;
+    int *last = malloc((size_t)cfg->conns * sizeof(*last));
+    char *expect = malloc(cfg->size);
+    int rc = 0;
+
+    if (!last || !expect) {
+        free(last);
+        free(expect);
+        return -1;
+    }
+    for (int i = 0; i < cfg->conns; i++)
+        last[i] = -1;
+
+    if (len % cfg->size) {
+        fprintf(stderr, "c%d: echo of %zu bytes is not whole packets\n", w->id, len);
+        rc = -1;
+    }
+    for (size_t off = 0; rc == 0 && off < len; off += cfg->size) {
+        const char *p = w->reply + off;
+        int conn, req;
+
+        if (sscanf(p, "c%d r%d ", &conn, &req) != 2 || conn < 0 || conn >= cfg->conns ||
+            req < 0 || req >= cfg->requests) {
+            fprintf(stderr, "c%d: torn packet at offset %zu: %.24s\n", w->id, off, p);
+            rc = -1;
+            break;
+        }
+        make_packet(expect, cfg->size, conn, req);
+        if (memcmp(p, expect, cfg->size) != 0) {
+            fprintf(stderr, "c%d: corrupt packet c%d r%d at offset %zu\n", w->id, conn, req, off);
+            rc = -1;
+        } else if (req <= last[conn]) {
+            fprintf(stderr, "c%d: c%d r%d after r%d at offset %zu\n", w->id, conn, req, last[conn], off);
+            rc = -1;
+        }
+        last[conn] = req;
+    }
+    free(last);
+    free(expect);
+    return rc;
+}
+
+static void *test_thread(void *arg)
+{
+    struct test_worker *w = arg;
+    const struct test_cfg *cfg = w->cfg;
+    struct timeval tv = { .tv_sec = ECHO_TIMEOUT_S };
+    char *pkt = malloc(cfg->size);
+    int fd = connect_to(cfg->host, cfg->port, 0);
+
+    if (fd < 0 || !pkt) {
+        w->failed = cfg->requests;
+        goto out;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    for (int r = 0; r < cfg->requests; r++) {
+        ssize_t len;
+
+        make_packet(pkt, cfg->size, w->id, r);
+        if (send(fd, pkt, cfg->size, MSG_NOSIGNAL) != (ssize_t)cfg->size ||
+            (len = read_echo(w, fd, pkt, cfg->size)) < 0 || check_echo(w, (size_t)len) != 0) {
+            w->failed = cfg->requests - r;
+            break;
+        }
+    }
+out:
+    if (fd >= 0)
+        close(fd);
+    free(pkt);
+    return NULL;
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Send @pkt on @fd and read its echo into w->reply; the echo's length or -1 */
+static ssize_t echo_once(struct test_worker *w, int fd, const char *pkt, size_t len)
+{
+    if (send(fd, pkt, len, MSG_NOSIGNAL) != (ssize_t)len)
+        return -1;
+    return read_echo(w, fd, pkt, len);
+}
+
+/*
+ * A client with a small receive buffer sends one packet and never reads the
+ * history echoed back; another client's append must still be answered.
+ */
+static int stall_check(const struct test_cfg *cfg)
+{
+    struct test_worker w = { .id = -1, .cfg = cfg };
+    struct timeval tv = { .tv_sec = ECHO_TIMEOUT_S };
+    char *pkt = malloc(STALL_SIZE);
+    int fast = connect_to(cfg->host, cfg->port, 0);
+    int slow = -1;
+    double start, took = -1;
+    int rc = -1;
+
+    if (!pkt || fast < 0)
+        goto out;
+    setsockopt(fast, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    memset(pkt, 'h', STALL_SIZE - 1);
+    pkt[STALL_SIZE - 1] = '\n';
+    for (int i = 0; i < STALL_FILL; i++) {
+        if (echo_once(&w, fast, pkt, STALL_SIZE) < 0)
+            goto out;
+    }
+
+    slow = connect_to(cfg->host, cfg->port, 4096);
+    if (slow < 0 || send(slow, "stall\n", 6, MSG_NOSIGNAL) != 6)
+        goto out;
+    /* Let its reply fill the socket buffers */
+    nanosleep(&(struct timespec){ .tv_nsec = 500 * 1000 * 1000 }, NULL);
+
+    start = now_s();
+    if (echo_once(&w, fast, "fast\n", 5) >= 0) {
+        took = now_s() - start;
+        rc = took < STALL_LIMIT_S ? 0 : -1;
+    }
+out:
+    printf("stalled reader: %s, echo took %.2f s\n", rc == 0 ? "ok" : "FAILED", took);
+    if (slow >= 0)
+        close(slow);
+    if (fast >= 0)
+        close(fast);
+    free(pkt);
+    free(w.reply);
+    return rc;
+}
+
+int main(int argc, char *argv[])
+{
+    struct test_cfg cfg = { "127.0.0.1", "9000", 8, 200, 8192 };
+    int opt;
+
+    while ((opt = getopt(argc, argv, "h:p:c:n:s:")) != -1) {
+        switch (opt) {
+        case 'h': cfg.host = optarg; break;
+        case 'p': cfg.port = optarg; break;
+        case 'c': cfg.conns = atoi(optarg); break;
+        case 'n': cfg.requests = atoi(optarg); break;
+        case 's': cfg.size = (size_t)atol(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-h host] [-p port] [-c conns] [-n requests] [-s size]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (cfg.conns < 1 || cfg.requests < 1 || cfg.size < 32) {
+        fprintf(stderr, "need conns >= 1, requests >= 1, size >= 32\n");
+        return EXIT_FAILURE;
+    }
+
+    struct test_worker *workers = calloc((size_t)cfg.conns, sizeof(*workers));
+    if (!workers)
+        return EXIT_FAILURE;
+
+    for (int i = 0; i < cfg.conns; i++) {
+        workers[i].id = i;
+        workers[i].cfg = &cfg;
+        pthread_create(&workers[i].tid, NULL, test_thread, &workers[i]);
+    }
+    int failed = 0;
+    for (int i = 0; i < cfg.conns; i++) {
+        pthread_join(workers[i].tid, NULL);
+        failed += workers[i].failed;
+        free(workers[i].reply);
+    }
+    free(workers);
+
+    printf("requests=%d failed=%d\n", cfg.conns * cfg.requests, failed);
+    if (stall_check(&cfg) != 0)
+        failed++;
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,194 @@
+/*
+ * aesdsocket-bench.c
+ *
+ * Load generator for aesdsocket: C concurrent connections each send N
+ * newline-terminated packets of S bytes and wait for the full echo, which
+ * always ends with the packet just sent. Prints throughput and latency
+ * percentiles. Build with "make bench".
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+struct bench_cfg {
+    const char *host;
+    const char *port;
+    int conns;
+    int requests;
+    size_t size;
+};
+
+struct bench_worker {
+    pthread_t tid;
+    int id;
+    const struct bench_cfg *cfg;
+    double *lat_us;      // one entry per request
+    int failed;
+};
+
+static double now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+}
+
+static int connect_to(const char *host, const char *port)
+{
+    struct addrinfo hints, *res, *ai;
+    int fd = -1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &res) != 0)
+        return -1;
+    for (ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0)
+            continue;
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+/* Read until the received stream ends with pkt; only the tail is kept */
+static int await_echo(int fd, const char *pkt, size_t len)
+{
+    char buf[65536];
+    char *tail = malloc(len);
+    size_t have = 0;
+    int rc = -1;
+
+    if (!tail)
+        return -1;
+    for (;;) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        /* Keep the last len bytes seen so far */
+        if ((size_t)n >= len) {
+            memcpy(tail, buf + n - len, len);
+            have = len;
+        } else {
+            size_t keep = have + (size_t)n > len ? len - (size_t)n : have;
+            memmove(tail, tail + have - keep, keep);
+            memcpy(tail + keep, buf, (size_t)n);
+            have = keep + (size_t)n;
+        }
+        if (have == len && memcmp(tail, pkt, len) == 0) {
+            rc = 0;
+            break;
+        }
+    }
+    free(tail);
+    return rc;
+}
+
+static void *bench_thread(void *arg)
+{
+    struct bench_worker *w = arg;
+    const struct bench_cfg *cfg = w->cfg;
+    char *pkt = malloc(cfg->size);
+    int fd = connect_to(cfg->host, cfg->port);
+
+    if (fd < 0 || !pkt) {
+        w->failed = cfg->requests;
+        goto out;
+    }
+    for (int r = 0; r < cfg->requests; r++) {
+        int n = snprintf(pkt, cfg->size, "c%d r%d ", w->id, r);
+        memset(pkt + n, 'x', cfg->size - (size_t)n - 1);
+        pkt[cfg->size - 1] = '\n';
+
+        double t0 = now_us();
+        if (send(fd, pkt, cfg->size, MSG_NOSIGNAL) != (ssize_t)cfg->size ||
+            await_echo(fd, pkt, cfg->size) != 0) {
+            w->failed = cfg->requests - r;
+            break;
+        }
+        w->lat_us[r] = now_us() - t0;
+    }
+out:
+    if (fd >= 0)
+        close(fd);
+    free(pkt);
+    return NULL;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char *argv[])
+{
+    struct bench_cfg cfg = { "127.0.0.1", "9000", 8, 100, 64 };
+    int opt;
+
+    while ((opt = getopt(argc, argv, "h:p:c:n:s:")) != -1) {
+        switch (opt) {
+        case 'h': cfg.host = optarg; break;
+        case 'p': cfg.port = optarg; break;
+        case 'c': cfg.conns = atoi(optarg); break;
+        case 'n': cfg.requests = atoi(optarg); break;
+        case 's': cfg.size = (size_t)atol(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-h host] [-p port] [-c conns] [-n requests] [-s size]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (cfg.conns < 1 || cfg.requests < 1 || cfg.size < 32) {
+        fprintf(stderr, "need conns >= 1, requests >= 1, size >= 32\n");
+        return EXIT_FAILURE;
+    }
+
+    struct bench_worker *workers = calloc((size_t)cfg.conns, sizeof(*workers));
+    double *lat = calloc((size_t)cfg.conns * (size_t)cfg.requests, sizeof(*lat));
+    if (!workers || !lat)
+        return EXIT_FAILURE;
+
+    double t0 = now_us();
+    for (int i = 0; i < cfg.conns; i++) {
+        workers[i].id = i;
+        workers[i].cfg = &cfg;
+        workers[i].lat_us = lat + (size_t)i * (size_t)cfg.requests;
+        pthread_create(&workers[i].tid, NULL, bench_thread, &workers[i]);
+    }
+    int failed = 0;
+    for (int i = 0; i < cfg.conns; i++) {
+        pthread_join(workers[i].tid, NULL);
+        failed += workers[i].failed;
+    }
+    double elapsed = now_us() - t0;
+
+    size_t total = (size_t)cfg.conns * (size_t)cfg.requests;
+    qsort(lat, total, sizeof(*lat), cmp_double);
+    size_t ok = total - (size_t)failed;
+    double *done = lat + failed;   /* failed slots stay 0 and sort first */
+
+    printf("requests=%zu failed=%d elapsed=%.3fs rate=%.0f/s", total, failed, elapsed / 1e6,
+           (double)ok / (elapsed / 1e6));
+    if (ok)
+        printf(" p50=%.0fus p99=%.0fus max=%.0fus", done[ok / 2], done[(ok * 99) / 100], done[ok - 1]);
+    printf("\n");
+
+    free(lat);
+    free(workers);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
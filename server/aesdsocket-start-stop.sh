@@ -11,7 +11,12 @@ case "$1" in
         echo "Stopping aesdsocket"
         start-stop-daemon -K -n aesdsocket
     ;;
+    upgrade)
+
+        echo "Restarting aesdsocket without dropping connections"
+        start-stop-daemon -K -s USR2 -n aesdsocket
+    ;;
     *)
-        echo "Usage: $0 {start|stop}"
+        echo "Usage: $0 {start|stop|upgrade}"
         exit 1
 esac
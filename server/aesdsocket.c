@@ -1,8 +1,11 @@
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE   // pthread_setaffinity_np, CPU_SET
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <errno.h>
 #include <netdb.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -12,32 +15,137 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <syslog.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include "../aesd-char-driver/aesd_ioctl.h" 
+#include <limits.h>
 #include <pthread.h>
+#include <poll.h>
+#include <sched.h>
 #include <sys/queue.h>
+#include <sys/eventfd.h>
 #include <time.h>
+#include "drr.h"
+#include "frame.h"
+#include "handoff.h"
+#include "replica.h"
+#include "store.h"
+#include "streams.h"
+#include "uring.h"
+#include "wheel.h"
 
 /* ========================== Config ========================== */
 #define SERVICE_PORT "9000" 
 
+/* Only picks the default store; -S selects any of them at run time */
 #ifndef USE_AESD_CHAR_DEVICE
 #define USE_AESD_CHAR_DEVICE 1  // default ON
 #endif
 
-#if USE_AESD_CHAR_DEVICE
-#define DATA_FILE "/dev/aesdchar"
-#else
+#define CHAR_DEVICE "/dev/aesdchar"
 #define DATA_FILE "/var/tmp/aesdsocketdata"
-#endif
+#define STREAM_PATH_PREFIX "/var/tmp/aesdsocketdata."   // + name, for "@name:" streams
+#define REPLICA_PATH_PREFIX "/var/tmp/aesdsocketreplica."  // + port, a replica's default store
+
+#define REPLY_CHUNK       (16 * 1024)   // Largest single pread/send while streaming a reply
+#define DEFAULT_QUANTUM   REPLY_CHUNK   // DRR bytes per round for a weight-1 client
+#define MAX_CLIENT_WEIGHTS 32
+#define URING_NBUFS       4             // Registered buffers per connection (io_uring engine)
+#define MAX_ACCEPTORS     64
+#define TIMESTAMP_PERIOD_S 10           // File-backed stores: seconds between timestamp lines
+#define PENDING_MIN       2048          // Initial receive buffer per connection
+#define DEFAULT_MAX_LINE  (1024 * 1024) // Longest packet accepted before the connection is dropped
+#define DEFAULT_MEM_BUDGET (64 * 1024 * 1024)  // Receive buffers and reply snapshots across all connections
+#define DEFAULT_MAX_CONNS 1024
+#define DEFAULT_SEND_LOWAT (64 * 1024)  // TCP_NOTSENT_LOWAT for client sockets
+#define SEND_STALL_MS     30000         // How long a reply may wait for the client to drain its socket
+#define HANDOFF_WAIT_MS   30000         // Successor's wait for the predecessor to drain its clients
+#define MEM_WAIT_MS       2000          // How long a connection may wait for receive budget
+#define DEFAULT_IDLE_TIMEOUT_S 300      // Clients that move no bytes this long are closed
+#define MAX_IDLE_TIMEOUT_S 86400
+#define MAX_STREAMS       4096
+
+enum io_engine {
+    ENGINE_BLOCKING,                    // recv/write/pread/send per chunk
+    ENGINE_URING,                       // batched io_uring submissions, falls back to blocking
+};
+
+/* Per-client DRR weight, set with -W <ip>=<weight> */
+struct client_weight {
+    char ip[INET6_ADDRSTRLEN];
+    unsigned int weight;
+};
+
+/* ========================== Runtime configuration ========================== */
+struct server_config {
+    bool daemon;                       // -d
+    const char *port;                  // -p <port>, TCP port to listen on
+    const char *unix_path;             // -U <path>, also listen on this UNIX socket
+    const char *data_file;             // -f <path>, the store's file (or device)
+    const char *primary;               // -F <address>, run as a read replica of this primary
+    size_t quantum;                    // -q <bytes>
+    enum io_engine engine;             // -E blocking|uring
+    int listeners;                     // -L <n>, SO_REUSEPORT listeners (0 = one per CPU)
+    bool pin_cpus;                     // -A, pin each listener (and its clients) to a CPU
+    enum store_engine store;           // -S file|mmap|chardev|ring
+    enum commit_mode durability;       // -D none|periodic[:ms]|group (file-backed stores)
+    unsigned int sync_interval_ms;     // interval for -D periodic
+    size_t max_line;                   // -l <bytes>
+    size_t mem_budget;                 // -m <bytes>, all receive buffers and reply snapshots together
+    unsigned int max_conns;            // -C <n>, accepting pauses at this many clients
+    unsigned int send_lowat;           // -w <bytes>, unsent bytes queued per socket (0 = kernel default)
+    unsigned int max_streams;          // -N <n>, "@name:" streams allowed (0 = prefix not special)
+    unsigned int idle_timeout_s;       // -I <seconds>, close clients idle this long (0 = never)
+    struct client_weight weights[MAX_CLIENT_WEIGHTS];
+    size_t nweights;
+};
+
+static struct server_config g_cfg = {
+    .daemon  = false,
+    .port    = SERVICE_PORT,
+    .store   = USE_AESD_CHAR_DEVICE ? STORE_CHARDEV : STORE_FILE,
+    .quantum = DEFAULT_QUANTUM,
+    .engine  = ENGINE_BLOCKING,
+    .listeners = 1,
+    .max_line = DEFAULT_MAX_LINE,
+    .mem_budget = DEFAULT_MEM_BUDGET,
+    .max_conns = DEFAULT_MAX_CONNS,
+    .send_lowat = DEFAULT_SEND_LOWAT,
+    .idle_timeout_s = DEFAULT_IDLE_TIMEOUT_S,
+};
 
 /* ========================== Global state ========================== */
 static volatile sig_atomic_t g_shutdown_requested = 0; //flag set when signals are called
 static volatile sig_atomic_t g_last_signal = 0;   //flag to identify which signal
-
-static pthread_mutex_t g_file_mutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile sig_atomic_t g_upgrade_requested = 0; // SIGUSR2: hand the listeners to a new process
+static _Atomic bool g_handed_off;  // a successor owns the listeners; drain and exit quietly
+
+/* What the successor is started from on SIGUSR2 */
+static char g_exe_path[PATH_MAX];
+static char **g_argv;
+
+static struct store g_store;      // Selected by -S, opened once and shared by all connections
+static struct drr_sched g_drr;   // Shares reply bandwidth between connections
+static struct streams g_streams;  // "@name:" streams, each with a store of its own (-N)
+static struct replica g_replica;  // Follows g_cfg.primary into g_store (-F)
+static _Atomic unsigned int g_feeds;  // Replicas following this server
+static struct timer_wheel g_wheel;  // Idle deadlines of every connection and the timestamp
+static struct timer g_timestamp;
+
+/* I/O syscalls (io_uring_enter counts as one) and packets, reported at exit */
+static _Atomic unsigned long g_io_calls;
+static _Atomic unsigned long g_packets;
+static _Atomic bool g_uring_warned;
+
+/* Receive buffers and reply snapshots charged to connections, bounded by g_cfg.mem_budget */
+static pthread_mutex_t g_mem_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_mem_cond = PTHREAD_COND_INITIALIZER;
+static size_t g_mem_used;
+
+static _Atomic unsigned int g_conns;   // client threads alive, bounded by g_cfg.max_conns
+static _Atomic unsigned long g_dropped; // connections closed for exceeding a limit
+static _Atomic unsigned long g_idle_closed; // connections closed by their idle timer
 
 /*client info struct */
 struct client_ctx {
@@ -45,16 +153,42 @@ struct client_ctx {
     char client_ip[INET6_ADDRSTRLEN]; //readable address
 };
 
+struct acceptor;
+
 //complete one client node thread struct
 struct thread_node {
     pthread_t tid;
-    _Atomic bool done;  //the flag to check if the threads are completed before to join them and making this atomic
+    struct acceptor *acc;           // acceptor that owns (and reaps) this thread
+    struct thread_node *done_next;  // link in acc->done_head once the worker has finished
     struct client_ctx ctx;
-    SLIST_ENTRY(thread_node) entries;
+    struct drr_flow flow;   // this connection's share of reply bandwidth
+    char *reply_buf;        // REPLY_CHUNK staging buffer for pread -> send
+    char *snap;             // Ring and char device replies, copied under the store lock
+    size_t snap_cap;        // Charged to the memory budget
+    off_t snap_start;       // snap holds store bytes [snap_start, snap_end)
+    off_t snap_end;
+    struct uring ring;      // per-connection ring when the io_uring engine is active
+    bool use_ring;
+    unsigned long io_calls; // I/O syscalls issued by this connection
+    struct timer idle;      // fires idle_timeout_s after arming; see conn_idle_check()
+    _Atomic uint64_t active_ms;  // wheel_clock_ms() when the last byte came in or went out
+    LIST_ENTRY(thread_node) entries;
 };
 
-SLIST_HEAD(thread_list_head, thread_node);
-static struct thread_list_head g_threads = SLIST_HEAD_INITIALIZER(g_threads);
+LIST_HEAD(thread_list_head, thread_node);
+
+/* One listening socket and the connections accepted on it */
+struct acceptor {
+    int index;
+    int listen_fd;
+    int cpu;                          // CPU to pin to, -1 for no pinning
+    pthread_t tid;
+    bool started;                     // tid is valid (index 0 runs on the main thread)
+    struct thread_list_head threads;  // client threads accepted here
+    /* Finished workers push themselves here and bump wake_fd; only the acceptor pops */
+    _Atomic(struct thread_node *) done_head;
+    int wake_fd;                      // eventfd, also used to interrupt the accept loop
+};
 
 /* ========================== Logging helpers ========================== */
 #define LOGI(fmt, ...)  syslog(LOG_INFO, "[OK]  " fmt, ##__VA_ARGS__)
@@ -75,6 +209,13 @@ static void termination_signal_handler(int signo)
     }
 }
 
+static void upgrade_signal_handler(int signo)
+{
+    (void)signo;
+    g_upgrade_requested = 1;
+    syslog(LOG_WARNING, "Caught SIGUSR2 — handing over to a new process");
+}
+
 static ssize_t write_all(int fd, const void *buf, size_t count)
 {
     const uint8_t *p = (const uint8_t *)buf; 
@@ -139,419 +280,1689 @@ static int daemonize_self(void)
     return 0;
 }
 
-/* ================= Timestamp thread: appends every 10 seconds ================= */
-#if !USE_AESD_CHAR_DEVICE
-static void *timestamp_worker(void *arg)
+/* ================= Timestamp: appended every 10 seconds ================= */
+/* Wheel callback, every TIMESTAMP_PERIOD_S */
+static void write_timestamp(void *arg)
 {
     (void)arg;
-    while (!g_shutdown_requested) {
+    time_t now = time(NULL);
+    struct tm tm_local;
+    if (localtime_r(&now, &tm_local) == NULL)
+       return;
+
+    char tbuf[128];
+    size_t n = strftime(tbuf, sizeof tbuf, "%a, %d %b %Y %T %z", &tm_local);
+    if (n == 0)
+      return;
+
+    /* SEnding the complete line; synced according to the durability policy */
+    char line[192];
+    int len = snprintf(line, sizeof line, "timestamp: %s\n", tbuf);
+    if (len > 0) {
+        int rc = store_append(&g_store, line, (size_t)len, NULL);
+        if (rc < 0)
+            LOGE("timestamp append failed: %s", strerror(-rc));
+    }
+}
 
-        /* Sleep in 1s slices just to react quickly to shutdown */
-        for (int i = 0; i < 10 && !g_shutdown_requested; ++i) 
-           sleep(1);
-        if (g_shutdown_requested) 
-            break;
-            
-            
-       time_t now = time(NULL);
-       struct tm tm_local;
-       if (localtime_r(&now, &tm_local) == NULL)
-          continue;
+/* ========================== Idle timeouts ========================== */
+/* Note traffic on the connection; the idle timer looks at this when it fires */
+static void conn_touch(struct thread_node *node)
+{
+    node->active_ms = wheel_clock_ms();
+}
 
-       char tbuf[128];
-       size_t n = strftime(tbuf, sizeof tbuf, "%a, %d %b %Y %T %z", &tm_local);
-       if (n == 0)
-         continue;
+/*
+ * Wheel callback. The timer is armed once per timeout rather than on every
+ * packet: when it fires after traffic, it is pushed to a full timeout past
+ * the last byte, and only a connection that stayed quiet is closed. The
+ * shutdown() wakes the worker from recv() or poll(); it closes the socket.
+ */
+static void conn_idle_check(void *arg)
+{
+    struct thread_node *node = arg;
+    uint64_t timeout_ms = (uint64_t)g_cfg.idle_timeout_s * 1000;
+    uint64_t quiet_ms = wheel_clock_ms() - node->active_ms;
 
-       pthread_mutex_lock(&g_file_mutex);
+    if (quiet_ms < timeout_ms) {
+        timer_arm(&g_wheel, &node->idle, (unsigned int)(timeout_ms - quiet_ms), 0);
+        return;
+    }
+    LOGI("Closing %s after %u s without traffic", node->ctx.client_ip, g_cfg.idle_timeout_s);
+    g_idle_closed++;
+    shutdown(node->ctx.client_fd, SHUT_RDWR);
+}
 
-       int fd = open(DATA_FILE, O_CREAT | O_WRONLY, 0644);
-       if (fd == -1) {
-         LOGI("failed to open the file");
-         pthread_mutex_unlock(&g_file_mutex);
-         return NULL;
-        }
-        
-        
-       /* SEnding the complete line */
-       char line[192];
-       int len = snprintf(line, sizeof line, "timestamp: %s\n", tbuf);
-       if (len > 0 && lseek(fd, 0, SEEK_END) != -1) {
-           write_all(fd, line, (size_t)len);
-           fsync(fd);
+/* Packets that read from the store instead of appending to it */
+enum read_cmd {
+    CMD_NONE,                   // Ordinary packet: append, reply with everything
+    CMD_SEEKTO,                 // AESDCHAR_IOCSEEKTO:X,Y  from byte Y of write X on
+    CMD_SINCE,                  // AESDSOCKET_SINCE:C      "CURSOR:<end>\n", then bytes [C, end)
+    CMD_RANGE,                  // AESDSOCKET_RANGE:O,L    up to L bytes from offset O
+    CMD_TAIL,                   // AESDSOCKET_TAIL:N       the last N writes
+};
+
+struct command {
+    enum read_cmd kind;
+    const char *name;           // Its prefix, for logging
+    unsigned long long arg[2];
+};
+
+static const struct {
+    const char *prefix;
+    enum read_cmd kind;
+    int nargs;
+    unsigned long long max;     // Largest value accepted for each argument
+} g_commands[] = {
+    { "AESDCHAR_IOCSEEKTO:", CMD_SEEKTO, 2, UINT32_MAX },
+    { "AESDSOCKET_SINCE:",   CMD_SINCE,  1, INT64_MAX },
+    { "AESDSOCKET_RANGE:",   CMD_RANGE,  2, INT64_MAX },
+    { "AESDSOCKET_TAIL:",    CMD_TAIL,   1, UINT32_MAX },
+};
+
+// format: PREFIX then nargs comma-separated decimals, then [\r]\n
+static bool parse_command(const char *s, size_t len, struct command *cmd)
+{
+    for (size_t c = 0; c < sizeof(g_commands) / sizeof(g_commands[0]); c++) {
+        size_t pfx = strlen(g_commands[c].prefix);
+        const char *p = s + pfx;
+        char *end = NULL;
+        int i;
+
+        if (len < pfx || strncmp(s, g_commands[c].prefix, pfx) != 0)
+            continue;
+
+        for (i = 0; i < g_commands[c].nargs; i++) {
+            if (i > 0) {
+                if (*p != ',')
+                    return false;
+                p++;
+            }
+            errno = 0;
+            cmd->arg[i] = strtoull(p, &end, 10);
+            if (errno || end == p || *p == '-' || cmd->arg[i] > g_commands[c].max)
+                return false;
+            p = end;
         }
 
-     close(fd);
-     pthread_mutex_unlock(&g_file_mutex);
+        if (p < s + len && *p == '\r') p++;
+        if (p < s + len && *p == '\n') p++;
+        if (p != s + len) return false;
 
+        cmd->kind = g_commands[c].kind;
+        cmd->name = g_commands[c].prefix;
+        return true;
     }
-    return NULL;
+    return false;
 }
-#endif
-
 
-static bool parse_seekto(const char *s, size_t len, unsigned *x, unsigned *y)
+/*
+ * "@name:payload" routes payload to stream name. Returns the prefix length
+ * with the name in @name/@name_len, or 0 for an ordinary packet. The name is
+ * validated by streams_get().
+ */
+static size_t parse_stream_prefix(const char *s, size_t len, const char **name, size_t *name_len)
 {
-    
-    static const char *prefix = "AESDCHAR_IOCSEEKTO:";
-    size_t pfx = strlen(prefix);
-    if (len < pfx || strncmp(s, prefix, pfx) != 0) 
-       return false;
-
-    // format: AESDCHAR_IOCSEEKTO:X,Y[\n]
-    const char *p = s + pfx;
-    char *end1 = NULL, *end2 = NULL;
+    const char *colon;
+
+    if (len < 2 || s[0] != '@')
+        return 0;
+    colon = memchr(s + 1, ':', len - 1 < STREAM_NAME_MAX + 1 ? len - 1 : STREAM_NAME_MAX + 1);
+    if (!colon)
+        return 0;
+    *name = s + 1;
+    *name_len = (size_t)(colon - s - 1);
+    return (size_t)(colon - s) + 1;
+}
 
-    errno = 0;
-    unsigned long vx = strtoul(p, &end1, 10);
-    if (errno || end1 == p || *end1 != ',') 
-       return false;
+/* ========================== Admission control ========================== */
+/*
+ * Charge @bytes of receive buffer or reply snapshot to the global budget,
+ * waiting up to MEM_WAIT_MS for other connections to give some back. This
+ * stops reading from the client meanwhile, so TCP flow control pushes back
+ * on it. Never called with a store lock held.
+ */
+static bool mem_reserve(size_t bytes)
+{
+    struct timespec deadline;
+    bool ok = true;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += MEM_WAIT_MS / 1000;
+    deadline.tv_nsec += (MEM_WAIT_MS % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
 
-    p = end1 + 1;
-    errno = 0;
-    unsigned long vy = strtoul(p, &end2, 10);
-    if (errno || end2 == p) 
-       return false;
+    pthread_mutex_lock(&g_mem_lock);
+    while (g_mem_used + bytes > g_cfg.mem_budget && !g_shutdown_requested) {
+        if (pthread_cond_timedwait(&g_mem_cond, &g_mem_lock, &deadline) == ETIMEDOUT) {
+            ok = false;
+            break;
+        }
+    }
+    if (ok && !g_shutdown_requested)
+        g_mem_used += bytes;
+    else
+        ok = false;
+    pthread_mutex_unlock(&g_mem_lock);
+    return ok;
+}
 
-    
-   const char *tail = end2;
-   if (tail < s + len && *tail == '\r') tail++;
-   if (tail < s + len && *tail == '\n') tail++;
-   if (tail != s + len) return false;
+static void mem_release(size_t bytes)
+{
+    if (bytes == 0)
+        return;
+    pthread_mutex_lock(&g_mem_lock);
+    g_mem_used -= bytes;
+    pthread_cond_broadcast(&g_mem_cond);
+    pthread_mutex_unlock(&g_mem_lock);
+}
 
-    *x = (unsigned)vx;
-    *y = (unsigned)vy;
+/* Resize a connection's receive buffer or snapshot, charging the difference to the budget */
+static bool pending_resize(char **pending, size_t *cap, size_t new_cap)
+{
+    char *new_buf;
+
+    if (new_cap > *cap && !mem_reserve(new_cap - *cap))
+        return false;
+    new_buf = realloc(*pending, new_cap);
+    if (!new_buf) {
+        if (new_cap > *cap)
+            mem_release(new_cap - *cap);
+        return false;
+    }
+    if (new_cap < *cap)
+        mem_release(*cap - new_cap);
+    *pending = new_buf;
+    *cap = new_cap;
     return true;
 }
 
-static void *client_worker(void *arg)
+/* ========================== Reply streaming ========================== */
+/*
+ * Wait for the client's unsent data to drop below the watermark. No store
+ * lock is held here (see reply_copied()), so a client that stops reading
+ * holds up only its own reply, but that still pins its thread and snapshot:
+ * one that takes nothing for SEND_STALL_MS is dropped, whatever its idle
+ * timeout. Shutting the server down shuts every client socket, which ends
+ * the poll() sooner.
+ */
+static int wait_writable(struct thread_node *node)
 {
-    struct thread_node *node = (struct thread_node *)arg;
-    int client_fd = node->ctx.client_fd;
-    const char *client_ip = node->ctx.client_ip;
+    struct pollfd pfd = { .fd = node->ctx.client_fd, .events = POLLOUT };
+    uint64_t deadline = wheel_clock_ms() + SEND_STALL_MS;
 
-    LOGI("Handling connection from %s", client_ip ? client_ip : "unknown");
-
-  
-     int data_fd = open(DATA_FILE, O_CREAT | O_RDWR | O_APPEND, 0644);
-     if (data_fd < 0) {
-       LOGE("open(%s O_RDWR|O_APPEND) failed: %s", DATA_FILE, strerror(errno));
-       goto out;
-     }
-    LOGI("Opened %s for read/write", DATA_FILE);
-
-    char *pending = NULL;
-    size_t pending_cap = 0;
-    size_t pending_len = 0;
+    for (;;) {
+        uint64_t now = wheel_clock_ms();
+        int rc = poll(&pfd, 1, now < deadline ? (int)(deadline - now) : 0);
 
-    while (!g_shutdown_requested) {
-        char recv_buf[1024];
-        ssize_t rcvd = recv(client_fd, recv_buf, sizeof(recv_buf), 0);
-        if (rcvd == 0) {
-            LOGI("Client %s closed connection", client_ip ? client_ip : "unknown");
-            break;
+        if (rc < 0) {
+            if (errno == EINTR)
+                continue;
+            LOGE("poll(POLLOUT) failed: %s", strerror(errno));
+            return -1;
         }
-        if (rcvd < 0) {
-            if (errno == EINTR) 
-              continue;
-            LOGE("recv failed: %s", strerror(errno));
-            break;
+        if (rc == 0) {
+            LOGE("Dropping %s: reply stalled above the send watermark for %d s",
+                 node->ctx.client_ip, SEND_STALL_MS / 1000);
+            g_dropped++;
+            return -1;
         }
-        LOGI("Received %zd bytes from %s", rcvd, client_ip ? client_ip : "unknown");
+        if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))
+            return -1;
+        return 0;
+    }
+}
 
-        /* To Grow pending buffer */
+/*
+ * Blocking engine: one store_read() (a pread() unless the store is the
+ * in-process ring) and one non-blocking send() of at most REPLY_CHUNK bytes.
+ * Returns bytes sent, -ENODATA at end of data or a negative errno; *blocked
+ * is set when the socket could not take it all.
+ */
+static ssize_t send_chunk_blocking(struct thread_node *node, struct store *st, off_t off, size_t len,
+                                   bool *blocked)
+{
+    ssize_t rn, sn;
+
+    if (len > REPLY_CHUNK)
+        len = REPLY_CHUNK;
+    do {
+        rn = store_read(st, node->reply_buf, len, off);
+        if (st->engine != STORE_RING)
+            node->io_calls++;
+    } while (rn == -EINTR);
+    if (rn < 0)
+        return rn;
+    if (rn == 0)
+        return -ENODATA;   /* history shrank under us (char device or ring wrapped) */
+
+    sn = send(node->ctx.client_fd, node->reply_buf, (size_t)rn, MSG_DONTWAIT | MSG_NOSIGNAL);
+    node->io_calls++;
+    if (sn < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            return -errno;
+        sn = 0;
+    }
+    *blocked = sn < rn;
+    return sn;
+}
 
-        if (pending_len + (size_t)rcvd > pending_cap) {
-            size_t new_cap = pending_cap ? pending_cap : 2048;
-            while (pending_len + (size_t)rcvd > new_cap) new_cap *= 2;
-            char *new_buf = realloc(pending, new_cap);
-            
-            if (!new_buf) {
-             LOGE("realloc failed"); 
-             break; 
-            }
-            
-            pending = new_buf; pending_cap = new_cap;
-        }
-        
-        memcpy(pending + pending_len, recv_buf, (size_t)rcvd);
-        pending_len += (size_t)rcvd;
+/*
+ * Bytes that stay put in memory, the mmap store's mapping or a reply
+ * snapshot: sent straight from there, with no read or staging copy
+ */
+static ssize_t send_chunk_memory(struct thread_node *node, const char *data, size_t len,
+                                 bool *blocked)
+{
+    ssize_t sn = send(node->ctx.client_fd, data, len, MSG_DONTWAIT | MSG_NOSIGNAL);
 
-        /* Processing complete packets ending with '\n' */
-        size_t scan_start = 0;
-        for (;;) {
-            if (scan_start >= pending_len) 
-               break;
-            char *nl = memchr(pending + scan_start, '\n', pending_len - scan_start);
-            if (!nl) 
-               break;
+    node->io_calls++;
+    if (sn < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            return -errno;
+        sn = 0;
+    }
+    *blocked = (size_t)sn < len;
+    return sn;
+}
 
-            size_t pkt_end = (size_t)(nl - pending) + 1;
-            size_t pkt_len = pkt_end - scan_start;
+/* io_uring engine: up to URING_NBUFS chunks read and sent with one enter */
+static ssize_t send_chunk_uring(struct thread_node *node, off_t off, size_t len, bool *blocked)
+{
+    ssize_t sn;
+
+    if (len > URING_NBUFS * REPLY_CHUNK)
+        len = URING_NBUFS * REPLY_CHUNK;
+    sn = uring_stream(&node->ring, off, len);
+    if (sn >= 0)
+        *blocked = (size_t)sn < len;
+    return sn;
+}
 
+/*
+ * Offsets into the char device and the ring shift whenever an append evicts
+ * the oldest write, so a range resolved from them is only good while
+ * st->lock is held. Their replies are copied into the connection's snapshot
+ * before the lock is dropped and sent from there; both keep at most
+ * AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED writes, so that stays small. The
+ * file engines only ever grow, so theirs stream straight from the store.
+ */
+static bool reply_copied(const struct store *st)
+{
+    return !store_is_file(st->engine);
+}
 
-           char *pkt = pending + scan_start;
+/* Grow the snapshot to hold @need bytes; st->lock must not be held */
+static bool snap_reserve(struct thread_node *node, size_t need)
+{
+    size_t cap = node->snap_cap ? node->snap_cap : REPLY_CHUNK;
+
+    while (cap < need)
+        cap *= 2;
+    if (cap == node->snap_cap || pending_resize(&node->snap, &node->snap_cap, cap))
+        return true;
+    LOGE("Dropping %s: no reply memory for %zu bytes", node->ctx.client_ip, need);
+    g_dropped++;
+    return false;
+}
 
-           pthread_mutex_lock(&g_file_mutex);
+/* Give back a snapshot a large reply needed once the reply is out */
+static void snap_trim(struct thread_node *node)
+{
+    if (node->snap_cap <= 4 * REPLY_CHUNK)
+        return;
+    free(node->snap);
+    mem_release(node->snap_cap);
+    node->snap = NULL;
+    node->snap_cap = 0;
+}
 
-           unsigned x = 0, y = 0;
-           bool is_seekto = parse_seekto(pkt, pkt_len, &x, &y);  
+/*
+ * Copy bytes [start, end) of @st into the snapshot, which is big enough;
+ * st->lock held. A store that ends early leaves snap_end short. 0 or -errno.
+ */
+static int snap_copy(struct thread_node *node, struct store *st, off_t start, off_t end)
+{
+    off_t off = start;
 
-      if (is_seekto) {
-       struct aesd_seekto st = { .write_cmd = x, .write_cmd_offset = y };
+    while (off < end) {
+        ssize_t n = store_read(st, node->snap + (off - start), (size_t)(end - off), off);
 
-      if (ioctl(data_fd, AESDCHAR_IOCSEEKTO, &st) == -1) {
-        pthread_mutex_unlock(&g_file_mutex);
-        LOGE("ioctl(AESDCHAR_IOCSEEKTO) failed: %s", strerror(errno));
-        goto out;
-      }
+        if (st->engine != STORE_RING)
+            node->io_calls++;
+        if (n == -EINTR)
+            continue;
+        if (n < 0)
+            return (int)n;
+        if (n == 0)
+            break;
+        off += n;
+    }
+    node->snap_start = start;
+    node->snap_end = off;
+    return 0;
+}
 
-      ssize_t total_sent = 0;
-      for (;;) {
-        char outbuf[1024];
-        ssize_t rn = read(data_fd, outbuf, sizeof(outbuf));
-        if (rn < 0) {
-            if (errno == EINTR) 
-              continue;
-            LOGE("read(%s after ioctl) failed: %s", DATA_FILE, strerror(errno));
-            pthread_mutex_unlock(&g_file_mutex);
-            goto out;
+/* reply_copied() stores: up to @len bytes at @off, from the snapshot */
+static ssize_t send_chunk_copied(struct thread_node *node, off_t off, size_t len, bool *blocked)
+{
+    if (off < node->snap_start || off >= node->snap_end)
+        return -ENODATA;
+    if ((off_t)len > node->snap_end - off)
+        len = (size_t)(node->snap_end - off);
+    return send_chunk_memory(node, node->snap + (off - node->snap_start), len, blocked);
+}
+
+/*
+ * Send bytes [start, end) of @st to the client without holding st->lock;
+ * for reply_copied() stores they come from the snapshot. Every quantum is
+ * granted by the DRR scheduler and sent without blocking, so a slow reader
+ * gives up its slot instead of stalling other connections.
+ */
+static off_t stream_range(struct thread_node *node, struct store *st, off_t start, off_t end)
+{
+    bool use_ring = node->use_ring && st == &g_store;   // the io_uring ring reads g_store.fd only
+    off_t off = start;
+
+    while (off < end && !g_shutdown_requested) {
+        size_t grant = drr_acquire(&g_drr, &node->flow, (size_t)(end - off));
+        bool blocked = false;
+        ssize_t sn;
+
+        if (reply_copied(st))
+            sn = send_chunk_copied(node, off, grant, &blocked);
+        else if (st->engine == STORE_MMAP)
+            sn = send_chunk_memory(node, store_data(st) + off, grant, &blocked);
+        else if (use_ring)
+            sn = send_chunk_uring(node, off, grant, &blocked);
+        else
+            sn = send_chunk_blocking(node, st, off, grant, &blocked);
+        /* A short read ends a uring batch early; finish it the plain way */
+        if (sn == -ENODATA && use_ring)
+            sn = send_chunk_blocking(node, st, off, grant, &blocked);
+        if (sn < 0) {
+            drr_release(&g_drr, &node->flow, 0, false);
+            if (sn == -ENODATA)
+                break;
+            LOGE("send to client failed: %s", strerror((int)-sn));
+            return -1;
         }
-        if (rn == 0) 
-          break;
-        if (write_all(client_fd, outbuf, (size_t)rn) < 0) {
-            LOGE("send to client failed: %s", strerror(errno));
-            pthread_mutex_unlock(&g_file_mutex);
-            goto out;
+        off += sn;
+        if (sn > 0)
+            conn_touch(node);
+
+        /* A full socket buffer ends our turn; re-queue once the peer drains it */
+        drr_release(&g_drr, &node->flow, (size_t)sn, off < end && !blocked);
+        if (blocked) {
+            node->io_calls++;
+            if (wait_writable(node) != 0)
+                return -1;
         }
-        total_sent += rn;
     }
+    /* Shutdown can end the loop mid-round, with the slot still ours */
+    drr_release(&g_drr, &node->flow, 0, false);
 
-    LOGI("Sent %zd bytes after SEEKTO %u,%u", total_sent, x, y);
-
-    pthread_mutex_unlock(&g_file_mutex);
+    LOGI("Sent %lld bytes of %s to client %s", (long long)(off - start), st->path, node->ctx.client_ip);
+    return off - start;
+}
 
-    
-    // drop the processed packet from 'pending' before continuing
-   size_t remain = pending_len - pkt_end;
-   if (remain) 
-     memmove(pending, pending + pkt_end, remain);
-   pending_len = remain;
+/* stream_range() for newline mode, where a reply cut short by the store is fine */
+static int stream_reply(struct thread_node *node, struct store *st, off_t start, off_t end)
+{
+    return stream_range(node, st, start, end) < 0 ? -1 : 0;
+}
 
-   scan_start = 0;  
-    continue;   
-}else {
+static int send_header(int client_fd, const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = send(client_fd, buf, len, MSG_NOSIGNAL);
 
-    // Regular behavior: write packet, then send full content
-    
-    if (write_all(data_fd, pkt, pkt_len) < 0) {
-        pthread_mutex_unlock(&g_file_mutex);
-        LOGE("write(%s) failed: %s", DATA_FILE, strerror(errno));
-        goto out;
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            LOGE("send to client failed: %s", strerror(errno));
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
     }
-    LOGI("Appended %zu bytes to %s", pkt_len, DATA_FILE);
+    return 0;
+}
 
-    // Rewind to start for the "full content" echo behavior
-    if (lseek(data_fd, 0, SEEK_SET) == (off_t)-1) {
-        pthread_mutex_unlock(&g_file_mutex);
-        LOGE("lseek(SET 0) failed: %s", strerror(errno));
-        goto out;
+/* Resolve a read command to the range [*start, *end) of @st; st->lock held */
+static int resolve_command(struct store *st, const struct command *cmd, off_t *start, off_t *end)
+{
+    off_t len = store_length(st);
+
+    if (len < 0)
+        return (int)len;
+    *start = 0;
+    *end = len;
+
+    switch (cmd->kind) {
+    case CMD_SEEKTO:
+        return store_seekto(st, (uint32_t)cmd->arg[0], (uint32_t)cmd->arg[1], start);
+    case CMD_SINCE:
+    case CMD_RANGE:
+        /* A cursor past the end was not handed out by this store */
+        if (cmd->arg[0] > (unsigned long long)len)
+            return -EINVAL;
+        *start = (off_t)cmd->arg[0];
+        if (cmd->kind == CMD_RANGE && cmd->arg[1] < (unsigned long long)(len - *start))
+            *end = *start + (off_t)cmd->arg[1];
+        return 0;
+    case CMD_TAIL:
+        return store_tail_offset(st, (uint32_t)cmd->arg[0], len, start);
+    default:
+        return 0;
     }
+}
 
-    ssize_t total_sent = 0;
+/*
+ * Resolve @cmd on @st, for reply_copied() stores into the snapshot as well.
+ * The snapshot only grows with st->lock dropped, so a range that outgrows
+ * it is resolved again once it is bigger. 0 or -errno.
+ */
+static int resolve_reply(struct thread_node *node, struct store *st, const struct command *cmd,
+                         off_t *start, off_t *end)
+{
     for (;;) {
-        char outbuf[1024];
-        ssize_t rn = read(data_fd, outbuf, sizeof(outbuf));
-        if (rn < 0) {
-            if (errno == EINTR) 
-              continue;
-            LOGE("read(%s) failed: %s", DATA_FILE, strerror(errno));
-            pthread_mutex_unlock(&g_file_mutex);
-            goto out;
-        }
-        if (rn == 0)
-           break;
-        if (write_all(client_fd, outbuf, (size_t)rn) < 0) {
-            LOGE("send to client failed: %s", strerror(errno));
-            pthread_mutex_unlock(&g_file_mutex);
-            goto out;
+        int rc;
+
+        pthread_mutex_lock(&st->lock);
+        rc = resolve_command(st, cmd, start, end);
+        if (rc == 0 && reply_copied(st)) {
+            if ((size_t)(*end - *start) > node->snap_cap) {
+                size_t need = (size_t)(*end - *start);
+
+                pthread_mutex_unlock(&st->lock);
+                if (!snap_reserve(node, need))
+                    return -ENOMEM;
+                continue;
+            }
+            rc = snap_copy(node, st, *start, *end);
         }
-        total_sent += rn;
+        pthread_mutex_unlock(&st->lock);
+        return rc;
     }
-    LOGI("Sent %zd bytes of %s to client %s", total_sent, DATA_FILE, client_ip ? client_ip : "unknown");
 }
 
-   pthread_mutex_unlock(&g_file_mutex);
-   scan_start = pkt_end;
+/*
+ * store_append() for a packet that is echoed with the history up to it. For
+ * reply_copied() stores the append and the copy of the echo happen under
+ * one hold of st->lock, so no later append evicts anything in between.
+ * Those engines take no durability policy, so the append never waits for a
+ * group commit leader that needs the lock.
+ */
+static int append_for_reply(struct thread_node *node, struct store *st, const char *pkt,
+                            size_t pkt_len, off_t *end)
+{
+    if (!reply_copied(st))
+        return store_append(st, pkt, pkt_len, end);
 
-        /* Any partial line left over */
-        if (scan_start > 0) {
-            size_t remain = pending_len - scan_start;
-            memmove(pending, pending + scan_start, remain);
-            pending_len = remain;
+    for (;;) {
+        off_t len;
+        int rc;
+
+        pthread_mutex_lock(&st->lock);
+        len = store_length(st);
+        /* Appending can only evict, so the echo is at most this long */
+        if (len >= 0 && (size_t)len + pkt_len > node->snap_cap) {
+            pthread_mutex_unlock(&st->lock);
+            if (!snap_reserve(node, (size_t)len + pkt_len))
+                return -ENOMEM;
+            continue;
         }
+        rc = len < 0 ? (int)len : store_append_locked(st, pkt, pkt_len, end);
+        if (rc == 0)
+            rc = snap_copy(node, st, 0, *end);
+        pthread_mutex_unlock(&st->lock);
+        return rc;
     }
-
-out:
-    if (data_fd >= 0) 
-      close(data_fd);
-    free(pending);
-    LOGI("Finished connection with %s", client_ip ? client_ip : "unknown");
-    
-    node->done = true;   /* mark for main thread to join & clean */
-    return NULL;
 }
 
-
-}
-/* ========================== Main ========================== */
-int main(int argc, char *argv[])
+/* Reply to a read command from @st without appending anything */
+static int handle_command(struct thread_node *node, struct store *st, const struct command *cmd)
 {
-    bool run_as_daemon = false;
-    if (argc == 2 && strcmp(argv[1], "-d") == 0)
-        run_as_daemon = true;
-
-    openlog("aesdsocket", LOG_PID, LOG_USER);
-    LOGI("Program start");
-   #if USE_AESD_CHAR_DEVICE
-      LOGI("MODE: char device, endpoint");
-   #else
-      LOGI("MODE: file-backed, path");
-   #endif
+    off_t start, end;
+    int rc;
 
-    /* Install signal handlers */
-    struct sigaction sa;
-    memset(&sa, 0, sizeof(sa));
-    sa.sa_handler = termination_signal_handler;
-    sigemptyset(&sa.sa_mask);
+    rc = resolve_reply(node, st, cmd, &start, &end);
+    g_packets++;
 
-    if (sigaction(SIGINT, &sa, NULL) != 0) {
-        LOGE("sigaction(SIGINT) failed: %s", strerror(errno));
-        closelog();
-        return EXIT_FAILURE;
+    if (rc < 0) {
+        LOGE("%s%llu,%llu on %s failed: %s", cmd->name, cmd->arg[0], cmd->arg[1], st->path,
+             strerror(-rc));
+        return -1;
     }
-    LOGI("Installed SIGINT handler");
+    LOGI("%s resolved to [%lld, %lld) of %s", cmd->name, (long long)start, (long long)end, st->path);
 
-    if (sigaction(SIGTERM, &sa, NULL) != 0) {
-        LOGE("sigaction(SIGTERM) failed: %s", strerror(errno));
-        closelog();
-        return EXIT_FAILURE;
-    }
-    LOGI("Installed SIGTERM handler");
-#if !USE_AESD_CHAR_DEVICE
-    /* Just to ensure the data file exists */
-    int touch_fd = open(DATA_FILE, O_CREAT | O_WRONLY, 0644);
-    
-    if (touch_fd < 0) {
-    
-        LOGE("open(%s) failed: %s", DATA_FILE, strerror(errno));
-        closelog();
-        return EXIT_FAILURE;
-    }
-    
-    close(touch_fd);
-    
-    LOGI("Ensured %s exists (or created)", DATA_FILE);
-#endif
-    /* Resolve addresses to bind on port 9000 */
-    struct addrinfo hints, *results = NULL, *ai = NULL;
-    
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family   = AF_UNSPEC;   /* IPv4 or IPv6 */
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_flags    = AI_PASSIVE;
+    /* The client resumes from here with its next AESDSOCKET_SINCE */
+    if (cmd->kind == CMD_SINCE) {
+        char hdr[32];
+        int n = snprintf(hdr, sizeof(hdr), "CURSOR:%lld\n", (long long)end);
 
-    int gai = getaddrinfo(NULL, SERVICE_PORT, &hints, &results); //get all the addr in this local system
-    if (gai != 0) {
-        LOGE("getaddrinfo(%s) failed: %s", SERVICE_PORT, gai_strerror(gai));
-        closelog();
-        return EXIT_FAILURE;
+        if (send_header(node->ctx.client_fd, hdr, (size_t)n) != 0)
+            return -1;
     }
-    
-    LOGI("getaddrinfo success for port %s", SERVICE_PORT);
+    return stream_reply(node, st, start, end);
+}
 
-    /* Create and bind the listening socket */
-    
-    int listen_fd = -1;
-    
-    for (ai = results; ai != NULL; ai = ai->ai_next) {
-    
-        listen_fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol); //create the communication end point
-        
-        if (listen_fd < 0) {
-            LOGE("socket() failed on candidate: %s", strerror(errno));
-            continue;
-        }
+/* A packet for a named stream: append it in that stream's store, or read from it */
+static int handle_stream_packet(struct thread_node *node, struct store *st, const char *pkt,
+                                size_t pkt_len)
+{
+    struct command cmd;
+    off_t end;
+    int rc;
 
-        int reuse = 1;
-        
-        if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0) {
-            LOGE("setsockopt(SO_REUSEADDR) failed: %s", strerror(errno));
-            close(listen_fd); listen_fd = -1; continue;
-        }
+    if (parse_command(pkt, pkt_len, &cmd))
+        return handle_command(node, st, &cmd);
 
-        
-        if (bind(listen_fd, ai->ai_addr, ai->ai_addrlen) == 0) { 
-            LOGI("bind success on port %s", SERVICE_PORT);
-            break;
-        } else {
-            LOGE("bind failed: %s", strerror(errno));
-            close(listen_fd); listen_fd = -1; continue;
-        }
+    rc = append_for_reply(node, st, pkt, pkt_len, &end);
+    g_packets++;
+    if (rc < 0) {
+        LOGE("write(%s) failed: %s", st->path, strerror(-rc));
+        return -1;
     }
-    freeaddrinfo(results);
+    return stream_reply(node, st, 0, end);
+}
 
-    if (listen_fd < 0) {
-        LOGE("Could not bind to any address on port %s", SERVICE_PORT);
-        closelog(); return EXIT_FAILURE;
+/*
+ * Append @pkt to g_store; the store length just past it goes in @end. With
+ * @echo the history up to it is snapshotted for the reply as by
+ * append_for_reply(). 0 or -errno.
+ */
+static int append_packet(struct thread_node *node, int data_fd, const char *pkt, size_t pkt_len,
+                         off_t *end, bool echo)
+{
+    ssize_t wn;
+
+    /*
+     * Group commit (the reply starts only once the packet is on disk), the
+     * stores whose echo is copied and the stores without a descriptor to
+     * write() append through the store.
+     */
+    if (g_cfg.durability == COMMIT_GROUP || reply_copied(&g_store) || !store_is_raw(g_store.engine)) {
+        int rc = echo ? append_for_reply(node, &g_store, pkt, pkt_len, end)
+                      : store_append(&g_store, pkt, pkt_len, end);
+
+        g_packets++;
+        if (rc < 0)
+            LOGE("write(%s) failed: %s", g_store.path, strerror(-rc));
+        return rc;
     }
 
-    /* Daemonize after successful bind, before listen/accept */
-    if (run_as_daemon) {
-        if (daemonize_self() != 0) {
-            LOGE("daemonize failed");
-            close(listen_fd);
-             closelog(); 
-             return EXIT_FAILURE;
-        }
-    }
- // make the listen as passive to the server
-    if (listen(listen_fd, SOMAXCONN) != 0) {
-        LOGE("listen failed: %s", strerror(errno));
-        close(listen_fd); 
-        closelog(); 
-        return EXIT_FAILURE;
+    pthread_mutex_lock(&g_store.lock);
+
+    if (node->use_ring) {
+        wn = uring_append(&node->ring, pkt, pkt_len);
+        if (wn < 0)
+            errno = (int)-wn;
+    } else {
+        wn = write_all(data_fd, pkt, pkt_len);
+        node->io_calls++;
     }
-    LOGI("Listening on TCP port %s", SERVICE_PORT);
-#if !USE_AESD_CHAR_DEVICE
+    if (wn < 0) {
+        int err = errno;
 
-    /* timestamp thread  */
-    
-    pthread_t ts_tid;
-    
-    int ts_rc = pthread_create(&ts_tid, NULL, timestamp_worker, NULL);
-    
-    if (ts_rc != 0) {
-    
-        LOGE("timestamp pthread_create failed: %s", strerror(ts_rc));
+        pthread_mutex_unlock(&g_store.lock);
+        LOGE("write(%s) failed: %s", g_store.path, strerror(err));
+        return -err;
     }
-#endif
+    LOGI("Appended %zu bytes to %s", pkt_len, g_store.path);
+
+    /* Snapshot the reply range while our packet is still the newest one */
+    *end = store_length(&g_store);
+    node->io_calls++;   /* lseek() */
+    g_packets++;
+    if (*end < 0) {
+        pthread_mutex_unlock(&g_store.lock);
+        LOGE("lseek(%s) failed: %s", g_store.path, strerror((int)-*end));
+        return (int)*end;
+    }
+    store_note_write(&g_store, pkt, pkt_len, *end);
+    pthread_mutex_unlock(&g_store.lock);
+    return 0;
+}
 
-    /* ========================== Accept loop (multi-client) ========================== */
-    while (!g_shutdown_requested) {
+/* Append one packet (or serve a read command) and stream the resulting reply */
+static int handle_packet(struct thread_node *node, int data_fd, const char *pkt, size_t pkt_len)
+{
+    struct command cmd;
+    off_t end;
+    const char *name;
+    size_t name_len, prefix;
+    int rc;
 
-        struct sockaddr_storage client_addr;
-        
-        socklen_t client_len = sizeof(client_addr);
+    if (g_cfg.max_streams && (prefix = parse_stream_prefix(pkt, pkt_len, &name, &name_len)) > 0) {
+        struct store *st;
 
-        int client_fd = accept(listen_fd, (struct sockaddr *)&client_addr, &client_len);
-        
+        rc = streams_get(&g_streams, name, name_len, &st);
+
+        if (rc < 0) {
+            LOGE("stream '%.*s' unavailable: %s", (int)name_len, name, strerror(-rc));
+            return -1;
+        }
+        return handle_stream_packet(node, st, pkt + prefix, pkt_len - prefix);
+    }
+
+    if (parse_command(pkt, pkt_len, &cmd))
+        return handle_command(node, &g_store, &cmd);
+
+    /*
+     * A replica's history is the primary's: refuse the write where the
+     * client sees it, as binary mode does with EROFS, by closing the
+     * connection without an echo
+     */
+    if (g_cfg.primary) {
+        LOGE("Dropping %s: write of %zu bytes to a read-only replica of %s", node->ctx.client_ip,
+             pkt_len, g_cfg.primary);
+        g_dropped++;
+        return -1;
+    }
+
+    if (append_packet(node, data_fd, pkt, pkt_len, &end, true) != 0)
+        return -1;
+    return stream_reply(node, &g_store, 0, end);
+}
+
+/* ========================== Binary frames ========================== */
+/* Bytes that arrived behind FRAME_MAGIC in newline mode, consumed before the socket */
+struct frame_input {
+    char *data;
+    size_t off;
+    size_t len;
+};
+
+/* Read exactly @len bytes: 0, 1 on EOF before the first byte, -1 otherwise */
+static int frame_recv(struct thread_node *node, struct frame_input *in, void *buf, size_t len)
+{
+    size_t got = 0;
+
+    if (in->off < in->len) {
+        got = in->len - in->off < len ? in->len - in->off : len;
+        memcpy(buf, in->data + in->off, got);
+        in->off += got;
+    }
+    while (got < len) {
+        /* One call per header or payload while the client keeps up */
+        ssize_t n = recv(node->ctx.client_fd, (char *)buf + got, len - got, MSG_WAITALL);
+
+        node->io_calls++;
+        if (n == 0) {
+            if (got == 0)
+                return 1;
+            LOGE("Client %s closed mid-frame", node->ctx.client_ip);
+            return -1;
+        }
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            LOGE("recv failed: %s", strerror(errno));
+            return -1;
+        }
+        got += (size_t)n;
+        conn_touch(node);
+    }
+    return 0;
+}
+
+static int frame_reply(struct thread_node *node, uint8_t op, int status, uint64_t len)
+{
+    struct frame_hdr h = { .op = op, .status = (uint8_t)(status > 255 ? EIO : status), .len = len };
+    char buf[FRAME_HDR_LEN];
+
+    frame_encode(buf, &h);
+    return send_header(node->ctx.client_fd, buf, sizeof(buf));
+}
+
+/* A frame carrying bytes [start, end) of g_store */
+static int frame_reply_range(struct thread_node *node, uint8_t op, off_t start, off_t end)
+{
+    if (frame_reply(node, op, 0, (uint64_t)(end - start)) != 0)
+        return -1;
+    /* The length is already on the wire: a shorter payload would desync the client */
+    if (stream_range(node, &g_store, start, end) != end - start) {
+        LOGE("Reply to %s cut short, closing", node->ctx.client_ip);
+        return -1;
+    }
+    return 0;
+}
+
+static int frame_stats(struct thread_node *node)
+{
+    char buf[512];
+    off_t len;
+    int n;
+
+    pthread_mutex_lock(&g_store.lock);
+    len = store_length(&g_store);
+    pthread_mutex_unlock(&g_store.lock);
+
+    n = snprintf(buf, sizeof(buf),
+                 "length=%lld\npackets=%lu\nconnections=%u\ndropped=%lu\nstreams=%u\n"
+                 "role=%s\nreplicas=%u\nidle_closed=%lu\ntimers=%lu\n",
+                 (long long)len, (unsigned long)g_packets, (unsigned)g_conns,
+                 (unsigned long)g_dropped, (unsigned)atomic_load(&g_streams.count),
+                 g_cfg.primary ? "replica" : "primary", (unsigned)g_feeds,
+                 (unsigned long)g_idle_closed, (unsigned long)g_wheel.armed);
+    if (g_cfg.primary)
+        n += snprintf(buf + n, sizeof(buf) - (size_t)n,
+                      "following=%d\nreplicated_frames=%llu\nreplicated_bytes=%llu\n",
+                      (int)atomic_load(&g_replica.connected),
+                      (unsigned long long)g_replica.frames, (unsigned long long)g_replica.bytes);
+    if (frame_reply(node, FRAME_STATS, 0, (uint64_t)n) != 0)
+        return -1;
+    return send_header(node->ctx.client_fd, buf, (size_t)n);
+}
+
+static int frame_chunk(struct thread_node *node, uint32_t raw_len, uint32_t zlen)
+{
+    uint32_t hdr[2] = { htobe32(raw_len), htobe32(zlen) };
+
+    return send_header(node->ctx.client_fd, (const char *)hdr, FRAME_CHUNK_HDR);
+}
+
+/*
+ * FRAME_READ_ZLIB: sealed segments go out as the zlib streams already on
+ * disk, with no inflating here; the tail goes raw. The lock is dropped
+ * before anything is sent, but segments are append-only and every read is
+ * by logical offset: the first @nsegs segments and bytes [sealed, end)
+ * stay as they were when resolved even if more are sealed meanwhile, so
+ * the reply length computed up front holds.
+ */
+static int frame_send_zlib(struct thread_node *node, off_t end, size_t nsegs, off_t sealed)
+{
+    struct store_segment seg;
+    uint64_t total = 0;
+    off_t off, raw;
+    size_t i;
+    ssize_t n;
+
+    for (i = 0; i < nsegs && store_segment(&g_store, i, &seg) == 0; i++)
+        total += FRAME_CHUNK_HDR + seg.zlen;
+    raw = end - sealed;
+    total += (uint64_t)raw + (uint64_t)(raw + FRAME_CHUNK_RAW_MAX - 1) / FRAME_CHUNK_RAW_MAX * FRAME_CHUNK_HDR;
+    if (frame_reply(node, FRAME_READ_ZLIB, 0, total) != 0)
+        return -1;
+
+    for (i = 0; i < nsegs; i++) {
+        if (store_segment(&g_store, i, &seg) != 0 || frame_chunk(node, seg.raw_len, seg.zlen) != 0)
+            return -1;
+        for (off = 0; off < (off_t)seg.zlen; off += n) {
+            n = store_read_compressed(&g_store, &seg, node->reply_buf, REPLY_CHUNK, off);
+            node->io_calls++;
+            if (n <= 0) {
+                LOGE("Reading segment %zu of %s failed: %s", i, g_store.path,
+                     strerror(n < 0 ? (int)-n : EIO));
+                return -1;
+            }
+            if (send_header(node->ctx.client_fd, node->reply_buf, (size_t)n) != 0)
+                return -1;
+        }
+    }
+    for (off = sealed; off < end; off += n) {
+        n = end - off < FRAME_CHUNK_RAW_MAX ? end - off : FRAME_CHUNK_RAW_MAX;
+        if (frame_chunk(node, (uint32_t)n, 0) != 0)
+            return -1;
+        if (stream_range(node, &g_store, off, off + n) != n) {
+            LOGE("Reply to %s cut short, closing", node->ctx.client_ip);
+            return -1;
+        }
+    }
+    LOGI("Sent %zu compressed segment(s) and %lld raw bytes to %s", nsegs, (long long)raw,
+         node->ctx.client_ip);
+    return 0;
+}
+
+/* Resolve a FRAME_READ_ZLIB reply and send it; only the compressed store has segments */
+static int frame_read_zlib(struct thread_node *node)
+{
+    struct command all = { .kind = CMD_NONE, .name = "FRAME_READ_ZLIB" };
+    off_t start, end, sealed = 0;
+    size_t nsegs = 0;
+
+    if (reply_copied(&g_store)) {
+        int rc = resolve_reply(node, &g_store, &all, &start, &end);
+
+        if (rc < 0)
+            end = rc;
+    } else {
+        pthread_mutex_lock(&g_store.lock);
+        end = store_length(&g_store);
+        nsegs = store_segments(&g_store, &sealed);
+        pthread_mutex_unlock(&g_store.lock);
+    }
+    g_packets++;
+    if (end < 0)
+        return frame_reply(node, FRAME_READ_ZLIB, (int)-end, 0);
+    return frame_send_zlib(node, end, nsegs, sealed);
+}
+
+/*
+ * Feed a replica g_store from @from on until it goes away, we shut down or
+ * we hand off (the replica then resumes from the successor). The bytes go
+ * out through stream_range() like any reply, so replicas get their DRR
+ * share of bandwidth and nothing is copied here. Returns when the feed ends.
+ */
+static int replicate_feed(struct thread_node *node, off_t from)
+{
+    uint64_t seq = 0;
+    off_t off = from;
+    int rc = 0;
+
+    g_feeds++;
+    LOGI("Replica %s following from offset %lld", node->ctx.client_ip, (long long)from);
+
+    while (!g_shutdown_requested && !g_handed_off) {
+        char hdr[FRAME_HDR_LEN + FRAME_REPL_PREFIX];
+        struct frame_hdr h = { .op = FRAME_REPLICATE };
+        uint64_t be;
+        off_t end, n;
+
+        /* New data, or an empty frame every REPLICA_HEARTBEAT_MS */
+        pthread_mutex_lock(&g_store.lock);
+        if (g_shutdown_requested || g_handed_off) {
+            /* Checked under the lock so store_wake() cannot slip in before the wait */
+            pthread_mutex_unlock(&g_store.lock);
+            break;
+        }
+        end = store_wait_length(&g_store, off, REPLICA_HEARTBEAT_MS);
+        pthread_mutex_unlock(&g_store.lock);
+        if (end < 0) {
+            LOGE("Replication: length of %s unknown: %s", g_store.path, strerror((int)-end));
+            rc = -1;
+            break;
+        }
+        n = end > off ? end - off : 0;
+        if (n > REPLICA_BATCH)
+            n = REPLICA_BATCH;
+
+        h.len = FRAME_REPL_PREFIX + (uint64_t)n;
+        frame_encode(hdr, &h);
+        be = htobe64(++seq);
+        memcpy(hdr + FRAME_HDR_LEN, &be, sizeof(be));
+        be = htobe64((uint64_t)off);
+        memcpy(hdr + FRAME_HDR_LEN + sizeof(be), &be, sizeof(be));
+        if (send_header(node->ctx.client_fd, hdr, sizeof(hdr)) != 0) {
+            rc = -1;
+            break;
+        }
+        conn_touch(node);   /* heartbeats keep an idle feed open */
+        if (n > 0 && stream_range(node, &g_store, off, off + n) != n) {
+            LOGE("Replication to %s cut short, closing", node->ctx.client_ip);
+            rc = -1;
+            break;
+        }
+        off += n;
+    }
+
+    g_feeds--;
+    LOGI("Replica %s detached at offset %lld", node->ctx.client_ip, (long long)off);
+    return rc;
+}
+
+/*
+ * Serve frames until the client closes. An append's payload is received
+ * straight into the connection's buffer at its final size: no scanning for
+ * '\n', no memmove and no restriction on the bytes it may contain. Errors
+ * the client can recover from are reported in the reply's status; anything
+ * that breaks the framing closes the connection.
+ */
+static int binary_session(struct thread_node *node, int data_fd, char **pending, size_t *cap,
+                          const char *rest, size_t rest_len)
+{
+    struct frame_input in = { .len = rest_len };
+    const char *client_ip = node->ctx.client_ip;
+    int rc = 0;
+
+    /* @rest points into *pending, which the first append may move */
+    if (rest_len > 0) {
+        in.data = malloc(rest_len);
+        if (!in.data)
+            return -1;
+        memcpy(in.data, rest, rest_len);
+    }
+    if (frame_reply(node, FRAME_HELLO, 0, 0) != 0) {
+        free(in.data);
+        return -1;
+    }
+    LOGI("Client %s switched to binary frames", client_ip);
+
+    while (rc == 0 && !g_shutdown_requested) {
+        char hdr[FRAME_HDR_LEN];
+        struct frame_hdr h;
+        int r = frame_recv(node, &in, hdr, sizeof(hdr));
+
+        if (r != 0) {
+            rc = r > 0 ? 0 : -1;
+            break;
+        }
+        frame_decode(hdr, &h);
+
+        switch (h.op) {
+        case FRAME_APPEND: {
+            off_t end;
+            uint64_t be_end;
+
+            if (h.len > g_cfg.max_line) {
+                LOGE("Dropping %s: frame exceeds %zu bytes", client_ip, g_cfg.max_line);
+                g_dropped++;
+                rc = -1;
+                break;
+            }
+            if (h.len == 0) {
+                rc = frame_reply(node, h.op, EINVAL, 0);
+                break;
+            }
+            if (h.len > *cap && !pending_resize(pending, cap, (size_t)h.len)) {
+                LOGE("Dropping %s: no receive buffer memory for %llu bytes", client_ip,
+                     (unsigned long long)h.len);
+                g_dropped++;
+                rc = -1;
+                break;
+            }
+            if (frame_recv(node, &in, *pending, (size_t)h.len) != 0) {
+                rc = -1;
+                break;
+            }
+            /* Replicas only take appends from their primary */
+            /* Only the end offset goes back, so nothing is snapshotted */
+            r = g_cfg.primary ? -EROFS
+                              : append_packet(node, data_fd, *pending, (size_t)h.len, &end, false);
+            if (r < 0) {
+                rc = frame_reply(node, h.op, -r, 0);
+            } else {
+                be_end = htobe64((uint64_t)end);
+                rc = frame_reply(node, h.op, 0, sizeof(be_end));
+                if (rc == 0)
+                    rc = send_header(node->ctx.client_fd, (const char *)&be_end, sizeof(be_end));
+            }
+            /* Give back what a large frame needed */
+            if (*cap > 16 * PENDING_MIN)
+                pending_resize(pending, cap, PENDING_MIN);
+            break;
+        }
+        case FRAME_READ_ALL:
+        case FRAME_SEEK: {
+            struct command cmd = { .kind = CMD_NONE, .name = "FRAME_READ_ALL" };
+            uint32_t arg[2];
+            off_t start, end;
+
+            if (h.len != (h.op == FRAME_SEEK ? sizeof(arg) : 0)) {
+                LOGE("Dropping %s: bad length %llu for opcode %u", client_ip,
+                     (unsigned long long)h.len, h.op);
+                rc = -1;
+                break;
+            }
+            if (h.op == FRAME_SEEK) {
+                if (frame_recv(node, &in, arg, sizeof(arg)) != 0) {
+                    rc = -1;
+                    break;
+                }
+                cmd.kind = CMD_SEEKTO;
+                cmd.name = "FRAME_SEEK";
+                cmd.arg[0] = be32toh(arg[0]);
+                cmd.arg[1] = be32toh(arg[1]);
+            }
+            r = resolve_reply(node, &g_store, &cmd, &start, &end);
+            g_packets++;
+            if (r < 0) {
+                LOGE("%s %llu,%llu failed: %s", cmd.name, cmd.arg[0], cmd.arg[1], strerror(-r));
+                rc = frame_reply(node, h.op, -r, 0);
+            } else {
+                rc = frame_reply_range(node, h.op, start, end);
+            }
+            break;
+        }
+        case FRAME_STATS:
+            rc = h.len == 0 ? frame_stats(node) : -1;
+            break;
+        case FRAME_READ_ZLIB:
+            rc = h.len == 0 ? frame_read_zlib(node) : -1;
+            break;
+        case FRAME_REPLICATE: {
+            uint64_t from;
+            off_t len;
+
+            if (h.len != sizeof(from) || frame_recv(node, &in, &from, sizeof(from)) != 0) {
+                rc = -1;
+                break;
+            }
+            from = be64toh(from);
+            /* Offsets into the device or the ring move as old writes drop out */
+            if (!store_is_file(g_store.engine)) {
+                rc = frame_reply(node, h.op, EOPNOTSUPP, 0);
+                break;
+            }
+            pthread_mutex_lock(&g_store.lock);
+            len = store_length(&g_store);
+            pthread_mutex_unlock(&g_store.lock);
+            if (len < 0 || from > (uint64_t)len) {
+                rc = frame_reply(node, h.op, len < 0 ? (int)-len : ERANGE, 0);
+                break;
+            }
+            free(in.data);
+            return replicate_feed(node, (off_t)from);
+        }
+        default:
+            LOGE("Dropping %s: unknown frame opcode %u", client_ip, h.op);
+            rc = -1;
+            break;
+        }
+        snap_trim(node);
+    }
+    free(in.data);
+    return rc;
+}
+
+/* Hand a finished worker to its acceptor for joining; lock-free, any thread */
+static void completion_push(struct thread_node *node)
+{
+    struct acceptor *acc = node->acc;
+    struct thread_node *head = atomic_load(&acc->done_head);
+    uint64_t one = 1;
+
+    do {
+        node->done_next = head;
+    } while (!atomic_compare_exchange_weak(&acc->done_head, &head, node));
+
+    if (write(acc->wake_fd, &one, sizeof(one)) < 0)
+        LOGE("eventfd write failed: %s", strerror(errno));
+}
+
+static void *client_worker(void *arg)
+{
+    struct thread_node *node = (struct thread_node *)arg;
+    int client_fd = node->ctx.client_fd;
+    const char *client_ip = node->ctx.client_ip;
+    char *pending = NULL;
+    size_t pending_cap = 0;
+    size_t pending_len = 0;
+    size_t scanned = 0;      /* bytes of pending already known to hold no '\n' */
+    bool first_line = true;  /* only the first line may switch to binary frames */
+    int data_fd = store_is_raw(g_store.engine) ? g_store.fd : -1;   // for write() and io_uring
+
+    LOGI("Handling connection from %s", client_ip);
+
+    conn_touch(node);
+    timer_init(&node->idle, conn_idle_check, node);
+    if (g_cfg.idle_timeout_s)
+        timer_arm(&g_wheel, &node->idle, g_cfg.idle_timeout_s * 1000, 0);
+
+    node->reply_buf = malloc(REPLY_CHUNK);
+    if (!node->reply_buf) {
+        LOGE("malloc reply buffer failed");
+        goto out;
+    }
+
+    /* io_uring reads and writes store offsets straight on the descriptor */
+    if (g_cfg.engine == ENGINE_URING && data_fd >= 0) {
+        int rc = uring_conn_init(&node->ring, data_fd, client_fd, URING_NBUFS, REPLY_CHUNK);
+        if (rc == 0) {
+            node->use_ring = true;
+        } else if (!g_uring_warned) {
+            g_uring_warned = true;
+            LOGE("io_uring unavailable (%s), using blocking I/O", strerror(-rc));
+        }
+    }
+
+    while (!g_shutdown_requested) {
+        char recv_buf[1024];
+        ssize_t rcvd;
+
+        if (node->use_ring) {
+            rcvd = uring_recv(&node->ring, recv_buf, sizeof(recv_buf));
+            if (rcvd < 0) {
+                errno = (int)-rcvd;
+                rcvd = -1;
+            }
+        } else {
+            rcvd = recv(client_fd, recv_buf, sizeof(recv_buf), 0);
+            node->io_calls++;
+        }
+        if (rcvd == 0) {
+            LOGI("Client %s closed connection", client_ip);
+            break;
+        }
+        if (rcvd < 0) {
+            if (errno == EINTR) 
+              continue;
+            LOGE("recv failed: %s", strerror(errno));
+            break;
+        }
+        LOGI("Received %zd bytes from %s", rcvd, client_ip);
+        conn_touch(node);
+
+        /* To Grow pending buffer, within the line limit and the global budget */
+
+        if (pending_len + (size_t)rcvd > pending_cap) {
+            size_t new_cap = pending_cap ? pending_cap : PENDING_MIN;
+            while (pending_len + (size_t)rcvd > new_cap) new_cap *= 2;
+            
+            if (!pending_resize(&pending, &pending_cap, new_cap)) {
+             LOGE("Dropping %s: no receive buffer memory for %zu bytes", client_ip, new_cap);
+             g_dropped++;
+             break; 
+            }
+        }
+        
+        memcpy(pending + pending_len, recv_buf, (size_t)rcvd);
+        pending_len += (size_t)rcvd;
+
+        /* Processing complete packets ending with '\n' */
+        size_t consumed = 0;
+        char *nl;
+        while ((nl = memchr(pending + scanned, '\n', pending_len - scanned)) != NULL) {
+            size_t pkt_end = (size_t)(nl - pending) + 1;
+
+            if (first_line && pkt_end == sizeof(FRAME_MAGIC) &&
+                memcmp(pending, FRAME_MAGIC "\n", sizeof(FRAME_MAGIC)) == 0) {
+                binary_session(node, data_fd, &pending, &pending_cap, pending + pkt_end,
+                               pending_len - pkt_end);
+                goto out_close;
+            }
+            first_line = false;
+
+            if (handle_packet(node, data_fd, pending + consumed, pkt_end - consumed) != 0)
+                goto out_close;
+            snap_trim(node);
+            consumed = scanned = pkt_end;
+        }
+        scanned = pending_len;
+
+        /* Any partial line left over */
+        if (consumed > 0) {
+            memmove(pending, pending + consumed, pending_len - consumed);
+            pending_len -= consumed;
+            scanned -= consumed;
+        }
+
+        if (pending_len > g_cfg.max_line) {
+            LOGE("Dropping %s: line exceeds %zu bytes", client_ip, g_cfg.max_line);
+            g_dropped++;
+            break;
+        }
+
+        /* Give back what a long line needed once it is done */
+        if (pending_cap > 16 * PENDING_MIN && pending_len < pending_cap / 4) {
+            size_t new_cap = PENDING_MIN;
+            while (new_cap < pending_len) new_cap *= 2;
+            pending_resize(&pending, &pending_cap, new_cap);
+        }
+    }
+
+out_close:
+    if (node->use_ring) {
+        node->io_calls += node->ring.enters;
+        uring_conn_exit(&node->ring);
+        node->use_ring = false;
+    }
+out:
+    /* After this the callback cannot run, so the acceptor may free node */
+    timer_cancel(&g_wheel, &node->idle);
+    g_io_calls += node->io_calls;
+    free(pending);
+    mem_release(pending_cap);
+    free(node->snap);
+    mem_release(node->snap_cap);
+    free(node->reply_buf);
+    node->reply_buf = NULL;
+    LOGI("Finished connection with %s", client_ip);
+    
+    g_conns--;
+    completion_push(node);   /* node may be freed by the acceptor from here on */
+    return NULL;
+}
+
+/* ========================== Command line ========================== */
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-d] [-p port] [-U path] [-f file] [-F primary] [-E blocking|uring]\n"
+            "          [-L listeners] [-A] [-S store] [-D durability] [-l max_line] [-m mem_budget]\n"
+            "          [-C max_conns] [-w send_lowat] [-I idle_s] [-N streams] [-q quantum_bytes]\n"
+            "          [-W ip=weight]...\n"
+            "  -d            run as a daemon\n"
+            "  -p port       TCP port to listen on (default " SERVICE_PORT ")\n"
+            "  -U path       also accept clients and replicas on a UNIX socket at path\n"
+            "  -f file       store file (default " DATA_FILE ", " REPLICA_PATH_PREFIX "PORT for -F)\n"
+            "  -F primary    read replica of the server at /unix/path, host:port or port;\n"
+            "                serves read commands; a write closes the client's connection\n"
+            "  -E engine     I/O engine: blocking (default) or uring\n"
+            "  -L n          n SO_REUSEPORT listeners with their own accept threads, 0 = one per CPU\n"
+            "  -A            pin each listener thread and its clients to one CPU\n"
+            "  -S store      file, mmap, compressed (zlib segments), chardev (" CHAR_DEVICE ")\n"
+            "                or ring (in memory), default %s\n"
+            "  -D policy     file-backed durability: none (default), periodic[:ms] or group\n"
+            "  -l bytes      longest packet accepted before dropping the client (default %d)\n"
+            "  -m bytes      receive buffer and reply snapshot budget across all clients (default %d)\n"
+            "  -C n          stop accepting while n clients are connected (default %d)\n"
+            "  -w bytes      per-client unsent data watermark, 0 = kernel default (default %d);\n"
+            "                a reply stuck above it for %d s drops the client\n"
+            "  -I seconds    close clients that send and receive nothing this long, 0 = never\n"
+            "                (default %d)\n"
+            "  -N n          route \"@name:\" packets to up to n separate streams in %sNAME\n"
+            "  -q bytes      reply bytes per DRR round for a weight-1 client (default %d)\n"
+            "  -W ip=weight  give a client address a larger share of reply bandwidth\n"
+            "SIGUSR2 starts a new instance on the same listeners and drains this one.\n",
+            prog, store_engine_name(USE_AESD_CHAR_DEVICE ? STORE_CHARDEV : STORE_FILE), DEFAULT_MAX_LINE, DEFAULT_MEM_BUDGET, DEFAULT_MAX_CONNS, DEFAULT_SEND_LOWAT,
+            SEND_STALL_MS / 1000, DEFAULT_IDLE_TIMEOUT_S, STREAM_PATH_PREFIX, DEFAULT_QUANTUM);
+}
+
+static bool parse_ulong(const char *s, unsigned long *out)
+{
+    char *end = NULL;
+
+    errno = 0;
+    unsigned long v = strtoul(s, &end, 10);
+    if (errno || end == s || *end != '\0')
+        return false;
+    *out = v;
+    return true;
+}
+
+static int parse_args(int argc, char *argv[])
+{
+    int opt;
+    unsigned long v;
+
+    while ((opt = getopt(argc, argv, "dp:U:f:F:E:L:AS:D:l:m:C:w:I:N:q:W:")) != -1) {
+        switch (opt) {
+        case 'd':
+            g_cfg.daemon = true;
+            break;
+        case 'p':
+            if (!parse_ulong(optarg, &v) || v == 0 || v > 65535) {
+                fprintf(stderr, "invalid port '%s'\n", optarg);
+                return -1;
+            }
+            g_cfg.port = optarg;
+            break;
+        case 'U':
+            if (optarg[0] == '\0' || strlen(optarg) >= sizeof(((struct sockaddr_un *)0)->sun_path)) {
+                fprintf(stderr, "invalid UNIX socket path '%s'\n", optarg);
+                return -1;
+            }
+            g_cfg.unix_path = optarg;
+            break;
+        case 'f':
+            g_cfg.data_file = optarg;
+            break;
+        case 'F':
+            if (optarg[0] == '\0') {
+                fprintf(stderr, "invalid primary address '%s'\n", optarg);
+                return -1;
+            }
+            g_cfg.primary = optarg;
+            break;
+        case 'L':
+            if (!parse_ulong(optarg, &v) || v > MAX_ACCEPTORS) {
+                fprintf(stderr, "invalid listener count '%s'\n", optarg);
+                return -1;
+            }
+            g_cfg.listeners = (int)v;
+            break;
+        case 'A':
+            g_cfg.pin_cpus = true;
+            break;
+        case 'l':
+            if (!parse_ulong(optarg, &v) || v == 0) {
+                fprintf(stderr, "invalid line limit '%s'\n", optarg);
+                return -1;
+            }
+            g_cfg.max_line = v;
+            break;
+        case 'm':
+            if (!parse_ulong(optarg, &v) || v < PENDING_MIN) {
+                fprintf(stderr, "invalid memory budget '%s'\n", optarg);
+                return -1;
+            }
+            g_cfg.mem_budget = v;
+            break;
+        case 'C':
+            if (!parse_ulong(optarg, &v) || v == 0 || v > 1000000) {
+                fprintf(stderr, "invalid connection limit '%s'\n", optarg);
+                return -1;
+            }
+            g_cfg.max_conns = (unsigned int)v;
+            break;
+        case 'w':
+            if (!parse_ulong(optarg, &v) || v > (1UL << 30)) {
+                fprintf(stderr, "invalid send watermark '%s'\n", optarg);
+                return -1;
+            }
+            g_cfg.send_lowat = (unsigned int)v;
+            break;
+        case 'I':
+            if (!parse_ulong(optarg, &v) || v > MAX_IDLE_TIMEOUT_S) {
+                fprintf(stderr, "invalid idle timeout '%s'\n", optarg);
+                return -1;
+            }
+            g_cfg.idle_timeout_s = (unsigned int)v;
+            break;
+        case 'N':
+            if (!parse_ulong(optarg, &v) || v > MAX_STREAMS) {
+                fprintf(stderr, "invalid stream count '%s'\n", optarg);
+                return -1;
+            }
+            g_cfg.max_streams = (unsigned int)v;
+            break;
+        case 'S':
+            if (strcmp(optarg, "file") == 0) {
+                g_cfg.store = STORE_FILE;
+            } else if (strcmp(optarg, "mmap") == 0) {
+                g_cfg.store = STORE_MMAP;
+            } else if (strcmp(optarg, "chardev") == 0) {
+                g_cfg.store = STORE_CHARDEV;
+            } else if (strcmp(optarg, "ring") == 0) {
+                g_cfg.store = STORE_RING;
+            } else if (strcmp(optarg, "compressed") == 0) {
+                if (!USE_ZLIB) {
+                    fprintf(stderr, "built without zlib support\n");
+                    return -1;
+                }
+                g_cfg.store = STORE_COMPRESSED;
+            } else {
+                fprintf(stderr, "unknown store '%s'\n", optarg);
+                return -1;
+            }
+            break;
+        case 'D':
+            if (strcmp(optarg, "none") == 0) {
+                g_cfg.durability = COMMIT_NONE;
+            } else if (strcmp(optarg, "group") == 0) {
+                g_cfg.durability = COMMIT_GROUP;
+            } else if (strncmp(optarg, "periodic", 8) == 0 &&
+                       (optarg[8] == '\0' ||
+                        (optarg[8] == ':' && parse_ulong(optarg + 9, &v) && v > 0 && v <= 3600000))) {
+                g_cfg.durability = COMMIT_PERIODIC;
+                g_cfg.sync_interval_ms = optarg[8] ? (unsigned int)v : COMMIT_DEFAULT_INTERVAL_MS;
+            } else {
+                fprintf(stderr, "unknown durability policy '%s'\n", optarg);
+                return -1;
+            }
+            break;
+        case 'E':
+            if (strcmp(optarg, "blocking") == 0) {
+                g_cfg.engine = ENGINE_BLOCKING;
+            } else if (strcmp(optarg, "uring") == 0) {
+                if (!USE_IO_URING) {
+                    fprintf(stderr, "built without io_uring support\n");
+                    return -1;
+                }
+                g_cfg.engine = ENGINE_URING;
+            } else {
+                fprintf(stderr, "unknown engine '%s'\n", optarg);
+                return -1;
+            }
+            break;
+        case 'q':
+            if (!parse_ulong(optarg, &v) || v == 0) {
+                fprintf(stderr, "invalid quantum '%s'\n", optarg);
+                return -1;
+            }
+            g_cfg.quantum = v;
+            break;
+        case 'W': {
+            const char *eq = strrchr(optarg, '=');
+            struct client_weight *w = &g_cfg.weights[g_cfg.nweights];
+
+            if (g_cfg.nweights == MAX_CLIENT_WEIGHTS || !eq ||
+                (size_t)(eq - optarg) >= sizeof(w->ip) ||
+                !parse_ulong(eq + 1, &v) || v == 0 || v > 1024) {
+                fprintf(stderr, "invalid weight '%s'\n", optarg);
+                return -1;
+            }
+            memcpy(w->ip, optarg, (size_t)(eq - optarg));
+            w->ip[eq - optarg] = '\0';
+            w->weight = (unsigned int)v;
+            g_cfg.nweights++;
+            break;
+        }
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if (optind != argc) {
+        usage(argv[0]);
+        return -1;
+    }
+    if (g_cfg.durability != COMMIT_NONE && !store_is_file(g_cfg.store)) {
+        fprintf(stderr, "durability policies apply to the file, mmap and compressed stores only\n");
+        return -1;
+    }
+    /* Replication ships byte offsets, which only the file stores keep stable */
+    if (g_cfg.primary && !store_is_file(g_cfg.store)) {
+        fprintf(stderr, "a replica needs the file, mmap or compressed store\n");
+        return -1;
+    }
+    if (g_cfg.primary && g_cfg.max_streams) {
+        fprintf(stderr, "streams are not replicated; -N cannot be used with -F\n");
+        return -1;
+    }
+    return 0;
+}
+
+static unsigned int weight_for_client(const char *client_ip)
+{
+    for (size_t i = 0; i < g_cfg.nweights; i++) {
+        if (strcmp(g_cfg.weights[i].ip, client_ip) == 0)
+            return g_cfg.weights[i].weight;
+    }
+    return 1;
+}
+
+/* ========================== Listeners and acceptors ========================== */
+/* Create and bind a socket on the TCP port (-p); -1 on failure */
+static int open_listener(bool reuseport)
+{
+    /* Resolve addresses to bind on the service port */
+    struct addrinfo hints, *results = NULL, *ai = NULL;
+    int listen_fd = -1;
+    
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;   /* IPv4 or IPv6 */
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags    = AI_PASSIVE;
+
+    int gai = getaddrinfo(NULL, g_cfg.port, &hints, &results); //get all the addr in this local system
+    if (gai != 0) {
+        LOGE("getaddrinfo(%s) failed: %s", g_cfg.port, gai_strerror(gai));
+        return -1;
+    }
+    
+    LOGI("getaddrinfo success for port %s", g_cfg.port);
+
+    /* Create and bind the listening socket */
+    for (ai = results; ai != NULL; ai = ai->ai_next) {
+    
+        listen_fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol); //create the communication end point
+        
+        if (listen_fd < 0) {
+            LOGE("socket() failed on candidate: %s", strerror(errno));
+            continue;
+        }
+
+        int reuse = 1;
+        
+        if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0) {
+            LOGE("setsockopt(SO_REUSEADDR) failed: %s", strerror(errno));
+            close(listen_fd); listen_fd = -1; continue;
+        }
+
+        /* Let several listeners share the port; the kernel spreads connections */
+        if (reuseport && setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) != 0) {
+            LOGE("setsockopt(SO_REUSEPORT) failed: %s", strerror(errno));
+            close(listen_fd); listen_fd = -1; continue;
+        }
+        
+        if (bind(listen_fd, ai->ai_addr, ai->ai_addrlen) == 0) { 
+            LOGI("bind success on port %s", g_cfg.port);
+            break;
+        } else {
+            LOGE("bind failed: %s", strerror(errno));
+            close(listen_fd); listen_fd = -1; continue;
+        }
+    }
+    freeaddrinfo(results);
+    return listen_fd;
+}
+
+/* Create and bind a UNIX stream socket at @path; -1 on failure */
+static int open_unix_listener(const char *path)
+{
+    struct sockaddr_un sun = { .sun_family = AF_UNIX };
+    struct stat sb;
+    int listen_fd;
+
+    /* Length checked by parse_args() */
+    strcpy(sun.sun_path, path);
+
+    /* A socket left behind by a previous run would make bind() fail */
+    if (lstat(path, &sb) == 0 && S_ISSOCK(sb.st_mode))
+        unlink(path);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        LOGE("socket(AF_UNIX) failed: %s", strerror(errno));
+        return -1;
+    }
+    if (bind(listen_fd, (struct sockaddr *)&sun, sizeof(sun)) != 0) {
+        LOGE("bind(%s) failed: %s", path, strerror(errno));
+        close(listen_fd);
+        return -1;
+    }
+    LOGI("bind success on %s", path);
+    return listen_fd;
+}
+
+/*
+ * pthread_create() with SIGINT/SIGTERM/SIGUSR2 blocked in the new thread, so
+ * that these signals always interrupt the main thread's accept().
+ */
+static int spawn_thread(pthread_t *tid, void *(*fn)(void *), void *arg)
+{
+    sigset_t block, old;
+    int rc;
+
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGTERM);
+    sigaddset(&block, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
+    rc = pthread_create(tid, NULL, fn, arg);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return rc;
+}
+
+/* Client threads inherit the acceptor's affinity, so a connection stays on its core */
+static void pin_to_cpu(struct acceptor *acc)
+{
+    cpu_set_t set;
+    int rc;
+
+    if (acc->cpu < 0)
+        return;
+    CPU_ZERO(&set);
+    CPU_SET(acc->cpu, &set);
+    rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rc != 0)
+        LOGE("listener %d: pinning to CPU %d failed: %s", acc->index, acc->cpu, strerror(rc));
+    else
+        LOGI("listener %d pinned to CPU %d", acc->index, acc->cpu);
+}
+
+/* Join and free client threads that have finished; cost is per completion */
+static void reap_finished(struct acceptor *acc)
+{
+    uint64_t count;
+
+    if (read(acc->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        LOGE("eventfd read failed: %s", strerror(errno));
+
+    struct thread_node *cur = atomic_exchange(&acc->done_head, NULL);
+    
+    while (cur) {
+        struct thread_node *next = cur->done_next;
+        
+        pthread_join(cur->tid, NULL);
+        
+        LIST_REMOVE(cur, entries);
+        
+        if (cur->ctx.client_fd >= 0) 
+          close(cur->ctx.client_fd);
+        
+        drr_flow_destroy(&cur->flow);
+        free(cur);
+        cur = next;
+    }
+}
+
+/* ========================== Accept loop (multi-client) ========================== */
+/* Shutdown, or a hot restart: listener 0 returns to main to start the successor */
+static bool accept_stopping(const struct acceptor *acc)
+{
+    return g_shutdown_requested || g_handed_off || (acc->index == 0 && g_upgrade_requested);
+}
+
+static void accept_loop(struct acceptor *acc)
+{
+    struct pollfd pfd[2] = {
+        { .fd = acc->listen_fd, .events = POLLIN },
+        { .fd = acc->wake_fd,   .events = POLLIN },
+    };
+    bool paused = false;
+
+    while (!accept_stopping(acc)) {
+
+        /*
+         * At the connection limit, leave new clients in the listen backlog.
+         * Our own reaps wake us; slots freed on other listeners are noticed
+         * by polling again shortly.
+         */
+        bool full = g_conns >= g_cfg.max_conns;
+        if (full != paused) {
+            paused = full;
+            LOGI("Listener %d %s accepting (%u connections)", acc->index,
+                 paused ? "paused" : "resumed", (unsigned)g_conns);
+        }
+        pfd[0].fd = paused ? -1 : acc->listen_fd;
+
+        /* Wait for a new client or finished workers to reap */
+        if (poll(pfd, 2, paused ? 50 : -1) < 0) {
+            if (errno != EINTR)
+                LOGE("poll failed: %s", strerror(errno));
+            continue;
+        }
+        if (accept_stopping(acc))
+            break;
+
+        /*just removing the threads that has finished */
+        if (pfd[1].revents & POLLIN)
+            reap_finished(acc);
+
+        if (!(pfd[0].revents & POLLIN))
+            continue;
+
+        struct sockaddr_storage client_addr;
+        
+        socklen_t client_len = sizeof(client_addr);
+
+        int client_fd = accept4(acc->listen_fd, (struct sockaddr *)&client_addr, &client_len,
+                                SOCK_CLOEXEC);
+        
         if (client_fd < 0) {
         
-            if (errno == EINTR && g_shutdown_requested)
+            if (g_shutdown_requested)
               break;
               
-            else 
+            if (errno != EINTR)
               LOGE("accept failed: %s", strerror(errno));
         } else {
             //convert the binary addr to the human readable format
@@ -565,8 +1976,21 @@ int main(int argc, char *argv[])
             }
 
             if (addr_ptr) inet_ntop(client_addr.ss_family, addr_ptr, client_ip, sizeof(client_ip));
+            else if (client_addr.ss_family == AF_UNIX) snprintf(client_ip, sizeof(client_ip), "unix");
             
-            LOGI("Accepted connection from %s", client_ip[0] ? client_ip : "unknown");
+            LOGI("Accepted connection from %s on listener %d", client_ip[0] ? client_ip : "unknown", acc->index);
+
+            /* Replies go out in multi-KiB chunks; don't let Nagle hold the tail back */
+            int nodelay = 1;
+            bool tcp = client_addr.ss_family != AF_UNIX;
+            if (tcp && setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay)) != 0)
+                LOGE("setsockopt(TCP_NODELAY) failed: %s", strerror(errno));
+
+            /* Only report writable once the unsent queue drains below the watermark */
+            if (tcp && g_cfg.send_lowat &&
+                setsockopt(client_fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &g_cfg.send_lowat,
+                           sizeof(g_cfg.send_lowat)) != 0)
+                LOGE("setsockopt(TCP_NOTSENT_LOWAT) failed: %s", strerror(errno));
 
             //allocate the zero initialized memory for the node
             struct thread_node *node = calloc(1, sizeof(*node));
@@ -578,96 +2002,456 @@ int main(int argc, char *argv[])
                 
             } else {
             
+                node->acc = acc;
                 node->ctx.client_fd = client_fd;
-                node->done = false;
+                snprintf(node->ctx.client_ip, sizeof(node->ctx.client_ip), "%s",
+                         client_ip[0] ? client_ip : "unknown");
+                drr_flow_init(&node->flow, weight_for_client(node->ctx.client_ip));
                 
 
                   //creating thread for each client connection
 
-                int rc = pthread_create(&node->tid, NULL, client_worker, node);
+                g_conns++;
+                int rc = spawn_thread(&node->tid, client_worker, node);
                 
                 if (rc != 0) {
                 
                     LOGE("pthread_create failed: %s", strerror(rc));
+                    g_conns--;
                     
                     close(client_fd);
                     
+                    drr_flow_destroy(&node->flow);
                     free(node);
                     
                 } else {
                 
-                    SLIST_INSERT_HEAD(&g_threads, node, entries);//adding that thread to the list
+                    LIST_INSERT_HEAD(&acc->threads, node, entries);//adding that thread to the list
                 }
             }
         }
-
-        /*just removing the threads that has finished */
-        
-        struct thread_node *cur = SLIST_FIRST(&g_threads);
-        
-        while (cur) {
-            struct thread_node *next = SLIST_NEXT(cur, entries);
-            
-            if (cur->done) {
-            
-                pthread_join(cur->tid, NULL);
-                
-                SLIST_REMOVE(&g_threads, cur, thread_node, entries);
-                
-                if (cur->ctx.client_fd >= 0) 
-                  close(cur->ctx.client_fd);
-                
-                free(cur);
-            }
-            cur = next;
-        }
     }
+}
 
+/* Stop accepting on this listener and wait for its clients to finish */
+static void acceptor_drain(struct acceptor *acc)
+{
     /* Stop new connections */
     
-    if (close(listen_fd) != 0) 
+    if (close(acc->listen_fd) != 0) 
       LOGE("close(listen_fd) failed: %s", strerror(errno));
     else                       
-      LOGI("Closed listening socket");
+      LOGI("Closed listening socket %d", acc->index);
+    acc->listen_fd = -1;
+
+    /*
+     * Handed off: let clients finish the packets already received. Their
+     * next recv() sees EOF, so each worker replies and exits on its own.
+     * Shutting down: end replies in flight too, and do not wait for idle
+     * clients to send something first.
+     */
+    struct thread_node *cur;
+    LIST_FOREACH(cur, &acc->threads, entries)
+        shutdown(cur->ctx.client_fd, g_handed_off ? SHUT_RD : SHUT_RDWR);
 
     /* Final join for any remaining client threads after closing the listening socket */
     // safer case to join 
     
-    struct thread_node *cur = SLIST_FIRST(&g_threads);
+    cur = LIST_FIRST(&acc->threads);
     
     while (cur) {
-        struct thread_node *next = SLIST_NEXT(cur, entries);
+        struct thread_node *next = LIST_NEXT(cur, entries);
         pthread_join(cur->tid, NULL);
         if (cur->ctx.client_fd >= 0) 
           close(cur->ctx.client_fd);
+        drr_flow_destroy(&cur->flow);
         free(cur);
         cur = next;
     }
-    SLIST_INIT(&g_threads);
-#if !USE_AESD_CHAR_DEVICE
-    /* Join the timestamp thread last */
-    if (ts_rc == 0) 
-      pthread_join(ts_tid, NULL);
+    LIST_INIT(&acc->threads);
+    atomic_store(&acc->done_head, NULL);
+    close(acc->wake_fd);
+    acc->wake_fd = -1;
+}
+
+/* Error-path cleanup for acceptors that never started */
+static void close_acceptors(struct acceptor *acceptors, int n)
+{
+    for (int i = 0; i < n; i++) {
+        if (acceptors[i].listen_fd >= 0)
+            close(acceptors[i].listen_fd);
+        if (acceptors[i].wake_fd >= 0)
+            close(acceptors[i].wake_fd);
+    }
+    free(acceptors);
+}
+
+static void *acceptor_main(void *arg)
+{
+    struct acceptor *acc = arg;
+
+    pin_to_cpu(acc);
+    accept_loop(acc);
+    acceptor_drain(acc);
+    return NULL;
+}
+
+/* ========================== Hot restart ========================== */
+/*
+ * Start a new aesdsocket from the same executable and arguments and pass it
+ * our listening sockets. Returns the handoff socket, or -1 if we keep serving.
+ */
+static int start_successor(struct acceptor *acceptors, int n)
+{
+    int fds[MAX_ACCEPTORS];
+    int nfds = 0;
+    int sock;
+    pid_t pid;
+    int rc;
+
+    for (int i = 0; i < n; i++)
+        if (acceptors[i].listen_fd >= 0)
+            fds[nfds++] = acceptors[i].listen_fd;
+
+    pid = handoff_spawn(g_exe_path, g_argv, &sock);
+    if (pid < 0) {
+        LOGE("Starting %s failed: %s", g_exe_path, strerror(-pid));
+        return -1;
+    }
+    rc = handoff_send_fds(sock, fds, nfds);
+    if (rc < 0) {
+        /* It never got the sockets and will exit; keep serving */
+        LOGE("Passing listeners to pid %d failed: %s", (int)pid, strerror(-rc));
+        close(sock);
+        return -1;
+    }
+    LOGI("Handed %d listener(s) to pid %d", nfds, (int)pid);
+    return sock;
+}
+
+/* ========================== Main ========================== */
+int main(int argc, char *argv[])
+{
+    if (parse_args(argc, argv) != 0)
+        return EXIT_FAILURE;
+
+    g_argv = argv;
+    ssize_t exe_len = readlink("/proc/self/exe", g_exe_path, sizeof(g_exe_path) - 1);
+    if (exe_len > 0)
+        g_exe_path[exe_len] = '\0';
+    else
+        snprintf(g_exe_path, sizeof(g_exe_path), "%s", argv[0]);
+
+    /* More concurrent senders than CPUs only adds contention */
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    drr_init(&g_drr, g_cfg.quantum, ncpus > 0 ? (unsigned int)ncpus : 1);
+
+    openlog("aesdsocket", LOG_PID, LOG_USER);
+    LOGI("Program start");
+    LOGI("MODE: %s store", store_engine_name(g_cfg.store));
+
+    /* Install signal handlers */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = termination_signal_handler;
+    sigemptyset(&sa.sa_mask);
+
+    if (sigaction(SIGINT, &sa, NULL) != 0) {
+        LOGE("sigaction(SIGINT) failed: %s", strerror(errno));
+        closelog();
+        return EXIT_FAILURE;
+    }
+    LOGI("Installed SIGINT handler");
 
-    /* Remove the data file  */
-    if (unlink(DATA_FILE) != 0) {
-        if (errno == ENOENT) 
-           LOGI("%s already removed", DATA_FILE);
+    if (sigaction(SIGTERM, &sa, NULL) != 0) {
+        LOGE("sigaction(SIGTERM) failed: %s", strerror(errno));
+        closelog();
+        return EXIT_FAILURE;
+    }
+    LOGI("Installed SIGTERM handler");
+
+    sa.sa_handler = upgrade_signal_handler;
+    if (sigaction(SIGUSR2, &sa, NULL) != 0) {
+        LOGE("sigaction(SIGUSR2) failed: %s", strerror(errno));
+        closelog();
+        return EXIT_FAILURE;
+    }
+
+    /*
+     * Started by a predecessor on SIGUSR2: take its listeners, then wait for
+     * it to drain its clients and close the store before opening it here.
+     */
+    int inherited[MAX_ACCEPTORS];
+    int ninherited = 0;
+    int handoff_sock = handoff_inherited();
+    if (handoff_sock >= 0) {
+        ninherited = handoff_recv_fds(handoff_sock, inherited, MAX_ACCEPTORS);
+        if (ninherited <= 0) {
+            LOGE("No listeners received from predecessor: %s",
+                 strerror(ninherited < 0 ? -ninherited : EPROTO));
+            close(handoff_sock);
+            closelog();
+            return EXIT_FAILURE;
+        }
+        LOGI("Inherited %d listener(s)", ninherited);
+        if (handoff_wait_done(handoff_sock, HANDOFF_WAIT_MS) < 0)
+            LOGE("Predecessor still draining after %d ms, taking over anyway", HANDOFF_WAIT_MS);
+        close(handoff_sock);
+    }
+    /* One handle on the data file for the whole run (creating it in file mode) */
+    static char replica_path[sizeof(REPLICA_PATH_PREFIX) + 8];
+    const char *data_path = g_cfg.store == STORE_CHARDEV ? CHAR_DEVICE : DATA_FILE;
+    if (g_cfg.data_file) {
+        data_path = g_cfg.data_file;
+    } else if (g_cfg.primary) {
+        /* Not DATA_FILE: a replica usually runs next to its primary */
+        snprintf(replica_path, sizeof(replica_path), REPLICA_PATH_PREFIX "%s", g_cfg.port);
+        data_path = replica_path;
+    }
+    int src = store_open(&g_store, data_path, g_cfg.store, store_is_file(g_cfg.store));
+    
+    if (src < 0) {
+    
+        LOGE("open(%s) failed: %s", data_path, strerror(-src));
+        closelog();
+        return EXIT_FAILURE;
+    }
+    
+    LOGI("Opened %s (%s store)", g_store.path, store_engine_name(g_cfg.store));
+    /* One listener per CPU unless a count was given, plus the UNIX socket last */
+    int ntcp = g_cfg.listeners;
+    if (ntcp == 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        ntcp = ncpu > 0 ? (int)(ncpu < MAX_ACCEPTORS ? ncpu : MAX_ACCEPTORS) : 1;
+    }
+    if (g_cfg.unix_path && ntcp == MAX_ACCEPTORS)
+        ntcp--;
+    int nlisteners = ninherited ? ninherited : ntcp + (g_cfg.unix_path ? 1 : 0);
+    bool reuseport = ntcp > 1;
+
+    struct acceptor *acceptors = calloc((size_t)nlisteners, sizeof(*acceptors));
+    if (!acceptors) {
+        LOGE("calloc acceptors failed");
+        store_close(&g_store);
+        closelog();
+        return EXIT_FAILURE;
+    }
+
+    /* CPUs we may run on, for -A */
+    cpu_set_t allowed;
+    int allowed_cpus[CPU_SETSIZE];
+    int nallowed = 0;
+    CPU_ZERO(&allowed);
+    if (g_cfg.pin_cpus && sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int c = 0; c < CPU_SETSIZE; c++)
+            if (CPU_ISSET(c, &allowed))
+                allowed_cpus[nallowed++] = c;
+    }
+
+    for (int i = 0; i < nlisteners; i++) {
+        acceptors[i].index = i;
+        acceptors[i].cpu = nallowed ? allowed_cpus[i % nallowed] : -1;
+        LIST_INIT(&acceptors[i].threads);
+        atomic_init(&acceptors[i].done_head, NULL);
+        acceptors[i].wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (ninherited)
+            acceptors[i].listen_fd = inherited[i];
+        else if (acceptors[i].wake_fd < 0)
+            acceptors[i].listen_fd = -1;
+        else
+            acceptors[i].listen_fd = i < ntcp ? open_listener(reuseport)
+                                              : open_unix_listener(g_cfg.unix_path);
+        if (acceptors[i].listen_fd < 0) {
+            LOGE("Could not set up listener %d on port %s", i, g_cfg.port);
+            close_acceptors(acceptors, i + 1);
+            store_close(&g_store);
+            closelog(); return EXIT_FAILURE;
+        }
+    }
+
+    /* Daemonize after successful bind, before listen/accept */
+    if (g_cfg.daemon) {
+        if (daemonize_self() != 0) {
+            LOGE("daemonize failed");
+            close_acceptors(acceptors, nlisteners);
+            store_close(&g_store);
+             closelog(); 
+             return EXIT_FAILURE;
+        }
+    }
+ // make the listen as passive to the server
+    for (int i = 0; i < nlisteners; i++) {
+        if (listen(acceptors[i].listen_fd, SOMAXCONN) != 0) {
+            LOGE("listen failed: %s", strerror(errno));
+            close_acceptors(acceptors, nlisteners);
+            store_close(&g_store);
+            closelog(); 
+            return EXIT_FAILURE;
+        }
+    }
+    LOGI("Listening on TCP port %s with %d listener(s)", g_cfg.port, nlisteners);
+    /* After daemonize: the periodic policy runs its own thread */
+    int crc = store_start(&g_store, g_cfg.durability, g_cfg.sync_interval_ms);
+    if (crc < 0) {
+        LOGE("durability setup failed: %s", strerror(-crc));
+        close_acceptors(acceptors, nlisteners);
+        store_close(&g_store);
+        closelog();
+        return EXIT_FAILURE;
+    }
+    LOGI("Durability policy: %s", commit_mode_name(g_cfg.durability));
+    /* One thread for every connection's idle timer, started before any client */
+    crc = wheel_start(&g_wheel);
+    if (crc < 0) {
+        LOGE("timer wheel failed to start: %s", strerror(-crc));
+        close_acceptors(acceptors, nlisteners);
+        store_close(&g_store);
+        closelog();
+        return EXIT_FAILURE;
+    }
+    /* Streams open their stores on first use, after daemonizing as well */
+    /* There is only one device: streams of a char device server are files */
+    streams_init(&g_streams, STREAM_PATH_PREFIX,
+                 g_cfg.store == STORE_CHARDEV ? STORE_FILE : g_cfg.store, g_cfg.durability,
+                 g_cfg.sync_interval_ms, g_cfg.max_streams);
+
+    /* A replica appends what its primary sends, timestamps included */
+    if (g_cfg.primary) {
+        crc = replica_start(&g_replica, g_cfg.primary, &g_store);
+        if (crc < 0) {
+            LOGE("starting replication from %s failed: %s", g_cfg.primary, strerror(-crc));
+            close_acceptors(acceptors, nlisteners);
+            wheel_stop(&g_wheel);
+            store_close(&g_store);
+            closelog();
+            return EXIT_FAILURE;
+        }
+        LOGI("Replica of %s", g_cfg.primary);
+    }
+
+    /* The timestamp runs on the wheel next to the connections' idle timers */
+    if (store_is_file(g_cfg.store) && !g_cfg.primary) {
+        timer_init(&g_timestamp, write_timestamp, NULL);
+        timer_arm(&g_wheel, &g_timestamp, TIMESTAMP_PERIOD_S * 1000, TIMESTAMP_PERIOD_S * 1000);
+    }
+
+    /* Listeners 1..n-1 get their own threads; the main thread serves listener 0 */
+    for (int i = 1; i < nlisteners; i++) {
+        int rc = spawn_thread(&acceptors[i].tid, acceptor_main, &acceptors[i]);
+        if (rc != 0) {
+            LOGE("acceptor %d pthread_create failed: %s", i, strerror(rc));
+            close(acceptors[i].listen_fd);
+            close(acceptors[i].wake_fd);
+            acceptors[i].listen_fd = acceptors[i].wake_fd = -1;
+        } else {
+            acceptors[i].started = true;
+        }
+    }
+
+    pin_to_cpu(&acceptors[0]);
+    int successor_sock = -1;
+    for (;;) {
+        accept_loop(&acceptors[0]);
+        if (g_shutdown_requested || !g_upgrade_requested)
+            break;
+        g_upgrade_requested = 0;
+        successor_sock = start_successor(acceptors, nlisteners);
+        if (successor_sock >= 0) {
+            g_handed_off = true;
+            break;
+        }
+    }
+
+    /* Signals land on the main thread; wake the other acceptors' poll() */
+    for (int i = 1; i < nlisteners; i++) {
+        uint64_t one = 1;
+        if (acceptors[i].started && write(acceptors[i].wake_fd, &one, sizeof(one)) < 0)
+            LOGE("eventfd write failed: %s", strerror(errno));
+    }
+
+    timer_cancel(&g_wheel, &g_timestamp);
+    /* Replication feeds wait on the store; let them see the shutdown now */
+    store_wake(&g_store);
+    replica_stop(&g_replica);
+    acceptor_drain(&acceptors[0]);
+    for (int i = 1; i < nlisteners; i++)
+        if (acceptors[i].started)
+            pthread_join(acceptors[i].tid, NULL);
+    free(acceptors);
+    /* Every worker cancelled its idle timer on the way out */
+    wheel_stop(&g_wheel);
+
+    unsigned long commit_appends = g_store.commit.appends, commit_syncs = g_store.commit.syncs;
+    store_close(&g_store);
+    if (g_cfg.max_streams)
+        LOGI("Closing %u stream(s)", atomic_load(&g_streams.count));
+    /* Stream files are ours in either build; the successor reopens them */
+    streams_close(&g_streams, !g_handed_off);
+    LOGI("Durability %s: %lu syncs (%lu grouped appends)", commit_mode_name(g_cfg.durability),
+         commit_syncs, commit_appends);
+    if (!g_cfg.daemon && g_cfg.durability != COMMIT_NONE)
+        fprintf(stderr, "durability=%s syncs=%lu grouped_appends=%lu\n",
+                commit_mode_name(g_cfg.durability), commit_syncs, commit_appends);
+
+    /* The store is closed: the successor may open it now */
+    if (successor_sock >= 0) {
+        int rc = handoff_notify_done(successor_sock);
+        if (rc < 0)
+            LOGE("Notifying successor failed: %s", strerror(-rc));
+        close(successor_sock);
+    }
+
+    /* Remove the data file, unless the successor carries on with it */
+    int urc;
+    if (!store_is_file(g_cfg.store)) {
+        /* The device keeps its history; the ring goes with the process */
+    } else if (g_handed_off) {
+        LOGI("Leaving %s to the successor", data_path);
+    } else if ((urc = store_unlink(data_path, g_cfg.store)) != 0) {
+        if (urc == -ENOENT) 
+           LOGI("%s already removed", data_path);
         else                 
-           LOGE("unlink(%s) failed: %s", DATA_FILE, strerror(errno));
+           LOGE("unlink(%s) failed: %s", data_path, strerror(-urc));
     } else {
-        LOGI("Removed %s", DATA_FILE);
+        LOGI("Removed %s", data_path);
     }
-#endif
+    if (g_cfg.unix_path && !g_handed_off)
+        unlink(g_cfg.unix_path);
     /* Final exit reason to know if any signal occured */
 
     if (g_last_signal == SIGINT)  
        LOGI("Exiting after SIGINT");
     else if (g_last_signal == SIGTERM) 
        LOGI("Exiting after SIGTERM");
+    else if (g_handed_off)
+       LOGI("Exiting after handing over to the successor");
     else                               
        LOGI("Exiting normally");
 
+    unsigned long packets = g_packets;
+    unsigned long io_calls = g_io_calls;
+    LOGI("Engine %s: %lu I/O syscalls for %lu packets (%.2f per packet)",
+         g_cfg.engine == ENGINE_URING ? "uring" : "blocking", io_calls, packets,
+         packets ? (double)io_calls / (double)packets : 0.0);
+    if (!g_cfg.daemon)
+        fprintf(stderr, "engine=%s io_syscalls=%lu packets=%lu per_packet=%.2f\n",
+                g_cfg.engine == ENGINE_URING ? "uring" : "blocking", io_calls, packets,
+                packets ? (double)io_calls / (double)packets : 0.0);
+    if (g_dropped)
+        LOGI("Dropped %lu connections over the line or memory limits", (unsigned long)g_dropped);
+    if (g_idle_closed)
+        LOGI("Closed %lu idle connections", (unsigned long)g_idle_closed);
+    if (g_cfg.primary) {
+        LOGI("Replicated %llu bytes in %llu frames over %lu connection(s)",
+             (unsigned long long)g_replica.bytes, (unsigned long long)g_replica.frames,
+             (unsigned long)g_replica.connects);
+        if (!g_cfg.daemon)
+            fprintf(stderr, "replicated_bytes=%llu frames=%llu connects=%lu\n",
+                    (unsigned long long)g_replica.bytes, (unsigned long long)g_replica.frames,
+                    (unsigned long)g_replica.connects);
+    }
+
+    drr_destroy(&g_drr);
     closelog();
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,28 @@
+#!/bin/sh
+# Concurrent appends against the stores whose offsets move as old writes are
+# evicted: the in-process ring always, the aesdchar device when it is loaded.
+# Every echo must stay a consistent view of the history (see
+# aesdsocket-append-test.c). Run from the server directory after
+# "make all check", with port 9000 free. Extra arguments go to the test.
+
+set -e
+cd `dirname $0`
+
+engines=ring
+if [ -c /dev/aesdchar ]; then
+    engines="$engines chardev"
+else
+    echo "== chardev: /dev/aesdchar not present, skipped"
+fi
+
+status=0
+for engine in $engines; do
+    ./aesdsocket -S $engine 2> /tmp/aesdsocket-append-$engine.log &
+    pid=$!
+    sleep 1
+    echo "== $engine"
+    ./aesdsocket-append-test "$@" || status=1
+    kill -TERM $pid
+    wait $pid || true
+done
+exit $status
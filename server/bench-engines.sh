@@ -0,0 +1,20 @@
+#!/bin/sh
+# Compare aesdsocket I/O engines: run the same load against each engine and
+# print the client-side latency summary next to the server's count of I/O
+# syscalls per packet (printed on exit when not running as a daemon).
+# Usage: ./bench-engines.sh [aesdsocket-bench options]
+# Run from the server directory after "make all bench", with port 9000 free.
+
+set -e
+cd `dirname $0`
+
+for engine in blocking uring; do
+    ./aesdsocket -E $engine 2> /tmp/aesdsocket-bench-$engine.log &
+    pid=$!
+    sleep 1
+    echo "== $engine"
+    ./aesdsocket-bench "$@" || true
+    kill -TERM $pid
+    wait $pid || true
+    tail -n 1 /tmp/aesdsocket-bench-$engine.log
+done
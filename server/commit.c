@@ -0,0 +1,230 @@
+/*
+ * commit.c
+ *
+ * Group commit follows the usual leader/follower scheme: every caller queues
+ * its append, and whichever caller finds no batch in flight takes the whole
+ * queue, appends it in one go (a single writev() on the file store), syncs
+ * it once and wakes everyone in it. Appends that arrive meanwhile form the
+ * next batch, so under load the number of syncs tracks the disk's latency
+ * rather than the packet rate.
+ */
+
+#include "commit.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+
+#define COMMIT_MAX_BATCH 256      // iovecs per writev()
+
+/*
+ * Write and sync one batch from the head of the queue. Called and returns
+ * with log->lock held; drops it around the I/O.
+ */
+static void commit_lead(struct commit_log *log)
+{
+    struct commit_req *batch[COMMIT_MAX_BATCH];
+    struct iovec iov[COMMIT_MAX_BATCH];
+    size_t total = 0;
+    int n = 0;
+    int err = 0;
+    off_t end;
+
+    while (n < COMMIT_MAX_BATCH && !TAILQ_EMPTY(&log->queue)) {
+        struct commit_req *req = TAILQ_FIRST(&log->queue);
+
+        TAILQ_REMOVE(&log->queue, req, link);
+        batch[n] = req;
+        iov[n].iov_base = (void *)req->buf;
+        iov[n].iov_len = req->len;
+        total += req->len;
+        n++;
+    }
+    log->leading = true;
+    pthread_mutex_unlock(&log->lock);
+
+    /* Only the write needs the file lock; other writers may proceed during the sync */
+    pthread_mutex_lock(log->file_lock);
+    end = log->ops->append(log->ops_ctx, iov, n);
+    if (end < 0)
+        err = (int)end;
+    if (!err) {
+        off_t off = end - (off_t)total;
+
+        for (int i = 0; i < n; i++) {
+            off += (off_t)batch[i]->len;
+            batch[i]->end = off;
+            if (log->written)
+                log->written(log->written_ctx, batch[i]->buf, batch[i]->len, off);
+        }
+    }
+    pthread_mutex_unlock(log->file_lock);
+
+    if (!err)
+        err = log->ops->sync(log->ops_ctx);
+
+    pthread_mutex_lock(&log->lock);
+    for (int i = 0; i < n; i++) {
+        batch[i]->err = err;
+        batch[i]->done = true;
+    }
+    log->appends += (unsigned long)n;
+    log->syncs++;
+    log->leading = false;
+    pthread_cond_broadcast(&log->done_cond);
+}
+
+static void *commit_syncer(void *arg)
+{
+    struct commit_log *log = arg;
+
+    pthread_mutex_lock(&log->lock);
+    while (!log->stop) {
+        struct timespec deadline;
+
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += log->interval_ms / 1000;
+        deadline.tv_nsec += (long)(log->interval_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while (!log->stop &&
+               pthread_cond_timedwait(&log->stop_cond, &log->lock, &deadline) != ETIMEDOUT)
+            ;
+
+        if (atomic_exchange(&log->dirty, false)) {
+            pthread_mutex_unlock(&log->lock);
+            log->ops->sync(log->ops_ctx);
+            pthread_mutex_lock(&log->lock);
+            log->syncs++;
+        }
+    }
+    pthread_mutex_unlock(&log->lock);
+    return NULL;
+}
+
+int commit_init(struct commit_log *log, enum commit_mode mode, const struct commit_ops *ops,
+                void *ops_ctx, pthread_mutex_t *file_lock, unsigned int interval_ms)
+{
+    pthread_condattr_t attr;
+
+    log->mode = mode;
+    log->ops = ops;
+    log->ops_ctx = ops_ctx;
+    log->file_lock = file_lock;
+    log->interval_ms = interval_ms ? interval_ms : COMMIT_DEFAULT_INTERVAL_MS;
+    log->written = NULL;
+    log->written_ctx = NULL;
+    log->leading = false;
+    log->stop = false;
+    log->syncer_started = false;
+    log->appends = 0;
+    log->syncs = 0;
+    atomic_init(&log->dirty, false);
+    TAILQ_INIT(&log->queue);
+    pthread_mutex_init(&log->lock, NULL);
+    pthread_cond_init(&log->done_cond, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&log->stop_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (mode == COMMIT_PERIODIC) {
+        sigset_t all, old;
+        int rc;
+
+        /* Leave signal delivery to the application's own threads */
+        sigfillset(&all);
+        pthread_sigmask(SIG_BLOCK, &all, &old);
+        rc = pthread_create(&log->syncer, NULL, commit_syncer, log);
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+        if (rc != 0) {
+            commit_destroy(log);
+            return -rc;
+        }
+        log->syncer_started = true;
+    }
+    return 0;
+}
+
+void commit_destroy(struct commit_log *log)
+{
+    if (log->syncer_started) {
+        pthread_mutex_lock(&log->lock);
+        log->stop = true;
+        pthread_cond_signal(&log->stop_cond);
+        pthread_mutex_unlock(&log->lock);
+        pthread_join(log->syncer, NULL);
+        log->syncer_started = false;
+    }
+    if (atomic_exchange(&log->dirty, false))
+        log->ops->sync(log->ops_ctx);
+
+    pthread_cond_destroy(&log->stop_cond);
+    pthread_cond_destroy(&log->done_cond);
+    pthread_mutex_destroy(&log->lock);
+}
+
+int commit_append(struct commit_log *log, const void *buf, size_t len, off_t *end)
+{
+    struct commit_req req = { .buf = buf, .len = len };
+
+    if (log->mode != COMMIT_GROUP) {
+        int rc;
+
+        pthread_mutex_lock(log->file_lock);
+        rc = commit_append_locked(log, buf, len, end);
+        pthread_mutex_unlock(log->file_lock);
+        return rc;
+    }
+
+    pthread_mutex_lock(&log->lock);
+    TAILQ_INSERT_TAIL(&log->queue, &req, link);
+    while (!req.done) {
+        if (!log->leading)
+            commit_lead(log);
+        else
+            pthread_cond_wait(&log->done_cond, &log->lock);
+    }
+    pthread_mutex_unlock(&log->lock);
+
+    if (req.err)
+        return req.err;
+    if (end)
+        *end = req.end;
+    return 0;
+}
+
+int commit_append_locked(struct commit_log *log, const void *buf, size_t len, off_t *end)
+{
+    struct iovec iov = { .iov_base = (void *)buf, .iov_len = len };
+    off_t at = log->ops->append(log->ops_ctx, &iov, 1);
+
+    if (at < 0)
+        return (int)at;
+    if (log->written)
+        log->written(log->written_ctx, buf, len, at);
+    commit_note_write(log);
+    if (end)
+        *end = at;
+    return 0;
+}
+
+void commit_note_write(struct commit_log *log)
+{
+    if (log->mode == COMMIT_PERIODIC)
+        atomic_store(&log->dirty, true);
+}
+
+const char *commit_mode_name(enum commit_mode mode)
+{
+    switch (mode) {
+    case COMMIT_PERIODIC:
+        return "periodic";
+    case COMMIT_GROUP:
+        return "group";
+    default:
+        return "none";
+    }
+}
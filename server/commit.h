@@ -0,0 +1,109 @@
+/*
+ * commit.h
+ *
+ * Durability policy for appends to aesdsocket's file-backed store: no
+ * syncing, a periodic background sync, or group commit where concurrent
+ * appends share one write and one sync.
+ */
+
+#ifndef AESDSOCKET_COMMIT_H
+#define AESDSOCKET_COMMIT_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/queue.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+enum commit_mode {
+    COMMIT_NONE,                  // Leave write-back to the kernel
+    COMMIT_PERIODIC,              // Sync every interval if anything was appended
+    COMMIT_GROUP,                 // Appends return only once they are on disk
+};
+
+#define COMMIT_DEFAULT_INTERVAL_MS 1000
+
+/* How the store underneath actually appends and syncs */
+struct commit_ops {
+    /*
+     * Append @iovcnt buffers as one contiguous range; called with file_lock
+     * held. Returns the store length just past them, or -errno.
+     */
+    off_t (*append)(void *ctx, const struct iovec *iov, int iovcnt);
+    /* Make everything appended so far durable; 0 or -errno */
+    int (*sync)(void *ctx);
+};
+
+/* One caller's append waiting in a group; lives on the caller's stack */
+struct commit_req {
+    const void *buf;
+    size_t len;
+    off_t end;                    // File offset just past this append
+    int err;                      // 0 or -errno for the whole batch
+    bool done;
+    TAILQ_ENTRY(commit_req) link;
+};
+
+TAILQ_HEAD(commit_queue, commit_req);
+
+struct commit_log {
+    enum commit_mode mode;
+    const struct commit_ops *ops;
+    void *ops_ctx;
+    pthread_mutex_t *file_lock;   // Serialises our writes with other writers of the file
+    unsigned int interval_ms;     // COMMIT_PERIODIC sync interval
+    /**
+     * Optional hook called with file_lock held after every append made here,
+     * in file order, with the offset just past the appended bytes.
+     */
+    void (*written)(void *ctx, const void *buf, size_t len, off_t end);
+    void *written_ctx;
+
+    pthread_mutex_t lock;
+    pthread_cond_t done_cond;     // Signalled when a batch completes
+    bool leading;                 // Some caller is writing and syncing a batch
+    struct commit_queue queue;    // Appends not yet picked up by a leader
+
+    _Atomic bool dirty;           // COMMIT_PERIODIC: appended since the last sync
+    bool stop;
+    pthread_cond_t stop_cond;
+    pthread_t syncer;
+    bool syncer_started;
+
+    /* Reported at exit */
+    unsigned long appends;
+    unsigned long syncs;
+};
+
+/*
+ * Set up @log over a store's @ops. COMMIT_PERIODIC starts a background
+ * thread with all signals blocked. Returns 0 or -errno.
+ */
+int commit_init(struct commit_log *log, enum commit_mode mode, const struct commit_ops *ops,
+                void *ops_ctx, pthread_mutex_t *file_lock, unsigned int interval_ms);
+
+/* Stop the syncer and flush anything outstanding */
+void commit_destroy(struct commit_log *log);
+
+/*
+ * Append @len bytes as one unit. On success returns 0 and stores the file
+ * offset just past them in @end (if not NULL); in COMMIT_GROUP mode the bytes
+ * are durable by then. Returns -errno on failure.
+ */
+int commit_append(struct commit_log *log, const void *buf, size_t len, off_t *end);
+
+/*
+ * commit_append() for a caller already holding file_lock, so it can act on
+ * the store before anyone appends after it. Not for COMMIT_GROUP, whose
+ * leader needs the lock.
+ */
+int commit_append_locked(struct commit_log *log, const void *buf, size_t len, off_t *end);
+
+/* Record an append made directly on the store, for COMMIT_PERIODIC */
+void commit_note_write(struct commit_log *log);
+
+const char *commit_mode_name(enum commit_mode mode);
+
+#endif /* AESDSOCKET_COMMIT_H */
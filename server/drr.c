@@ -0,0 +1,102 @@
+/*
+ * drr.c
+ *
+ * Deficit round robin (Shreedhar & Varghese) over threads. Up to sched->slots
+ * flows send at once and the rest wait in arrival order; a flow keeps its
+ * slot until its deficit is spent, then hands it straight to the first
+ * waiting flow and queues behind the others. Uncontended flows never wait,
+ * and a release wakes only the one flow that gets the slot.
+ */
+
+#include "drr.h"
+
+void drr_init(struct drr_sched *sched, size_t quantum, unsigned int slots)
+{
+    pthread_mutex_init(&sched->lock, NULL);
+    sched->quantum = quantum ? quantum : 1;
+    sched->slots = slots ? slots : 1;
+    sched->busy = 0;
+    TAILQ_INIT(&sched->waiting);
+}
+
+void drr_destroy(struct drr_sched *sched)
+{
+    pthread_mutex_destroy(&sched->lock);
+}
+
+void drr_flow_init(struct drr_flow *flow, unsigned int weight)
+{
+    flow->weight = weight ? weight : 1;
+    flow->deficit = 0;
+    flow->sending = false;
+    flow->waiting = false;
+    pthread_cond_init(&flow->turn_cond, NULL);
+}
+
+void drr_flow_destroy(struct drr_flow *flow)
+{
+    pthread_cond_destroy(&flow->turn_cond);
+}
+
+size_t drr_acquire(struct drr_sched *sched, struct drr_flow *flow, size_t want)
+{
+    size_t grant;
+
+    pthread_mutex_lock(&sched->lock);
+
+    if (!flow->sending) {
+        if (sched->busy < sched->slots && TAILQ_EMPTY(&sched->waiting)) {
+            sched->busy++;
+            flow->sending = true;
+        } else {
+            TAILQ_INSERT_TAIL(&sched->waiting, flow, link);
+            flow->waiting = true;
+            while (!flow->sending)
+                pthread_cond_wait(&flow->turn_cond, &sched->lock);
+        }
+    }
+
+    /* Each new slot starts a new round for this flow */
+    if (flow->deficit == 0)
+        flow->deficit = sched->quantum * flow->weight;
+
+    grant = want < flow->deficit ? want : flow->deficit;
+
+    pthread_mutex_unlock(&sched->lock);
+    return grant ? grant : 1;
+}
+
+void drr_release(struct drr_sched *sched, struct drr_flow *flow, size_t used, bool more)
+{
+    struct drr_flow *next;
+
+    pthread_mutex_lock(&sched->lock);
+
+    flow->deficit -= used < flow->deficit ? used : flow->deficit;
+    if (!flow->sending) {
+        /* Already released; only the deficit is left to forfeit */
+        flow->deficit = 0;
+        pthread_mutex_unlock(&sched->lock);
+        return;
+    }
+    if (more && flow->deficit > 0) {
+        pthread_mutex_unlock(&sched->lock);
+        return;
+    }
+    if (!more)
+        flow->deficit = 0;
+
+    /* Round spent or nothing left to send: pass the slot on */
+    flow->sending = false;
+    next = TAILQ_FIRST(&sched->waiting);
+    if (next) {
+        TAILQ_REMOVE(&sched->waiting, next, link);
+        next->waiting = false;
+        next->sending = true;
+        pthread_cond_signal(&next->turn_cond);
+    } else {
+        sched->busy--;
+    }
+
+    pthread_mutex_unlock(&sched->lock);
+}
@@ -0,0 +1,55 @@
+/*
+ * drr.h
+ *
+ * Deficit-round-robin scheduler that hands out reply bandwidth to
+ * aesdsocket connections in bounded quanta.
+ */
+
+#ifndef AESDSOCKET_DRR_H
+#define AESDSOCKET_DRR_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/queue.h>
+
+/* One connection with reply data to send */
+struct drr_flow {
+    unsigned int weight;          // Quanta earned per round, >= 1
+    size_t deficit;               // Bytes this flow may still send in the current round
+    bool sending;                 // Holds one of the scheduler's send slots
+    bool waiting;                 // On the scheduler's wait queue
+    pthread_cond_t turn_cond;     // Signalled when a slot is handed to this flow
+    TAILQ_ENTRY(drr_flow) link;
+};
+
+struct drr_sched {
+    pthread_mutex_t lock;
+    size_t quantum;               // Bytes added to a flow's deficit per round
+    unsigned int slots;           // Flows that may send at once
+    unsigned int busy;            // Slots held
+    TAILQ_HEAD(drr_flow_list, drr_flow) waiting;
+};
+
+/* @slots flows send concurrently; only flows beyond that queue, in DRR order */
+void drr_init(struct drr_sched *sched, size_t quantum, unsigned int slots);
+void drr_destroy(struct drr_sched *sched);
+void drr_flow_init(struct drr_flow *flow, unsigned int weight);
+void drr_flow_destroy(struct drr_flow *flow);
+
+/*
+ * Block until @flow holds a send slot and return how many of @want bytes it
+ * may send now (at least 1, at most its deficit). Must be paired with
+ * drr_release().
+ */
+size_t drr_acquire(struct drr_sched *sched, struct drr_flow *flow, size_t want);
+
+/*
+ * Account for @used bytes sent. With @more and deficit left the flow keeps
+ * its slot for the rest of its round; otherwise the slot goes to the first
+ * waiting flow. Without @more the flow forfeits any remaining deficit, and
+ * then releasing a flow that holds no slot is harmless.
+ */
+void drr_release(struct drr_sched *sched, struct drr_flow *flow, size_t used, bool more);
+
+#endif /* AESDSOCKET_DRR_H */
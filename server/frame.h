@@ -0,0 +1,93 @@
+/*
+ * frame.h
+ *
+ * aesdsocket's binary protocol. A connection whose first line is
+ * FRAME_MAGIC "\n" switches from newline-terminated packets to frames; the
+ * server answers with a FRAME_HELLO frame and every request gets exactly
+ * one reply frame from then on.
+ *
+ * Every frame starts with a FRAME_HDR_LEN byte header:
+ *
+ *   byte 0     opcode
+ *   byte 1     status: 0, or an errno value in replies
+ *   bytes 2-3  reserved, zero
+ *   bytes 4-11 payload length, big-endian
+ *
+ * Requests and their replies:
+ *
+ *   FRAME_APPEND    payload appended as is  -> 8-byte store length after it
+ *   FRAME_READ_ALL  no payload              -> the whole store
+ *   FRAME_SEEK      u32 write, u32 offset   -> the store from that point on
+ *   FRAME_STATS     no payload              -> "key=value\n" lines
+ *   FRAME_REPLICATE u64 store offset        -> replication frames, see below
+ *   FRAME_READ_ZLIB no payload              -> the whole store in chunks, see below
+ *
+ * A reply with a non-zero status has no payload; the connection stays open
+ * unless the request itself could not be framed.
+ *
+ * FRAME_REPLICATE turns the connection into a one-way feed of the store
+ * from the given offset on. Every frame the server sends from then on is a
+ * FRAME_REPLICATE frame whose payload starts with FRAME_REPL_PREFIX bytes,
+ * a u64 sequence number counting frames from 1 and the u64 offset of the
+ * bytes that follow; a frame without bytes is a heartbeat. The client sends
+ * nothing more.
+ *
+ * FRAME_READ_ZLIB is FRAME_READ_ALL for clients that can inflate: the
+ * payload is a run of chunks, each a u32 raw length and a u32 compressed
+ * length (FRAME_CHUNK_HDR bytes, big-endian) followed by a zlib stream of
+ * that many bytes, or by the raw bytes themselves when the compressed
+ * length is 0. The compressed store sends its sealed segments as they are
+ * on disk and only the unsealed tail raw; other stores send raw chunks.
+ */
+
+#ifndef AESDSOCKET_FRAME_H
+#define AESDSOCKET_FRAME_H
+
+#include <endian.h>
+#include <stdint.h>
+#include <string.h>
+
+#define FRAME_MAGIC   "AESDSOCKET_BINARY"
+#define FRAME_HDR_LEN 12
+
+enum frame_op {
+    FRAME_HELLO     = 0,
+    FRAME_APPEND    = 1,
+    FRAME_READ_ALL  = 2,
+    FRAME_SEEK      = 3,
+    FRAME_STATS     = 4,
+    FRAME_REPLICATE = 5,
+    FRAME_READ_ZLIB = 6,
+};
+
+#define FRAME_REPL_PREFIX 16
+#define FRAME_CHUNK_HDR   8
+#define FRAME_CHUNK_RAW_MAX (1024 * 1024)   // Largest raw chunk in a FRAME_READ_ZLIB reply
+
+struct frame_hdr {
+    uint8_t op;
+    uint8_t status;
+    uint64_t len;
+};
+
+static inline void frame_encode(char *out, const struct frame_hdr *h)
+{
+    uint64_t len = htobe64(h->len);
+
+    out[0] = (char)h->op;
+    out[1] = (char)h->status;
+    out[2] = out[3] = 0;
+    memcpy(out + 4, &len, sizeof(len));
+}
+
+static inline void frame_decode(const char *in, struct frame_hdr *h)
+{
+    uint64_t len;
+
+    h->op = (uint8_t)in[0];
+    h->status = (uint8_t)in[1];
+    memcpy(&len, in + 4, sizeof(len));
+    h->len = be64toh(len);
+}
+
+#endif /* AESDSOCKET_FRAME_H */
@@ -0,0 +1,199 @@
+/*
+ * handoff.c
+ *
+ * The listening sockets stay open in the kernel for the whole upgrade:
+ * the copies in flight over the socket pair keep them alive even after the
+ * predecessor closes its own, so clients that connect meanwhile wait in the
+ * backlog instead of being refused.
+ */
+
+#define _GNU_SOURCE   // MSG_CMSG_CLOEXEC, environ
+#include "handoff.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define HANDOFF_DONE 'D'
+
+pid_t handoff_spawn(const char *exe, char *const argv[], int *sock)
+{
+    char fdvar[sizeof(HANDOFF_ENV) + 16];
+    char **envp;
+    size_t n = 0, k = 0;
+    int sv[2];
+    pid_t pid;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0)
+        return -errno;
+    /* The successor's end must survive exec */
+    if (fcntl(sv[1], F_SETFD, 0) != 0) {
+        int err = errno;
+        close(sv[0]);
+        close(sv[1]);
+        return -err;
+    }
+
+    /*
+     * Our environment plus the handoff socket, built before fork: the
+     * child may only make async-signal-safe calls, and setenv() here would
+     * race with getenv() on every other thread of the live server.
+     */
+    while (environ[n])
+        n++;
+    envp = malloc((n + 2) * sizeof(*envp));
+    if (!envp) {
+        close(sv[0]);
+        close(sv[1]);
+        return -ENOMEM;
+    }
+    snprintf(fdvar, sizeof(fdvar), HANDOFF_ENV "=%d", sv[1]);
+    for (size_t i = 0; i < n; i++)
+        if (strncmp(environ[i], HANDOFF_ENV "=", sizeof(HANDOFF_ENV)) != 0)
+            envp[k++] = environ[i];
+    envp[k++] = fdvar;
+    envp[k] = NULL;
+
+    pid = fork();
+    if (pid == 0) {
+        close(sv[0]);
+        execve(exe, argv, envp);
+        _exit(127);
+    }
+    if (pid < 0) {
+        int err = errno;
+        free(envp);
+        close(sv[0]);
+        close(sv[1]);
+        return -err;
+    }
+    free(envp);
+    close(sv[1]);
+    *sock = sv[0];
+    return pid;
+}
+
+int handoff_inherited(void)
+{
+    const char *s = getenv(HANDOFF_ENV);
+    char *end = NULL;
+    long fd;
+
+    if (!s)
+        return -1;
+    fd = strtol(s, &end, 10);
+    unsetenv(HANDOFF_ENV);
+    if (end == s || *end != '\0' || fd < 0 || fcntl((int)fd, F_GETFD) < 0)
+        return -1;
+    fcntl((int)fd, F_SETFD, FD_CLOEXEC);
+    return (int)fd;
+}
+
+int handoff_send_fds(int sock, const int *fds, int n)
+{
+    char count = (char)n;
+    struct iovec iov = { .iov_base = &count, .iov_len = 1 };
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+        struct cmsghdr align;
+    } u;
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = u.buf,
+        .msg_controllen = CMSG_SPACE(sizeof(int) * (size_t)n),
+    };
+    struct cmsghdr *cmsg;
+
+    if (n < 1 || n > HANDOFF_MAX_FDS)
+        return -EINVAL;
+    memset(&u, 0, sizeof(u));
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * (size_t)n);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * (size_t)n);
+
+    while (sendmsg(sock, &msg, MSG_NOSIGNAL) < 0) {
+        if (errno != EINTR)
+            return -errno;
+    }
+    return 0;
+}
+
+int handoff_recv_fds(int sock, int *fds, int max)
+{
+    char count;
+    struct iovec iov = { .iov_base = &count, .iov_len = 1 };
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+        struct cmsghdr align;
+    } u;
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = u.buf,
+        .msg_controllen = sizeof(u.buf),
+    };
+    struct cmsghdr *cmsg;
+    ssize_t n;
+    int nfds;
+
+    do {
+        n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0)
+        return -errno;
+    if (n == 0)
+        return -ECONNRESET;
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+        return -EPROTO;
+    nfds = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+    if (nfds > max) {
+        int extra[HANDOFF_MAX_FDS];
+
+        memcpy(extra, CMSG_DATA(cmsg), sizeof(int) * (size_t)nfds);
+        for (int i = 0; i < nfds; i++)
+            close(extra[i]);
+        return -E2BIG;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * (size_t)nfds);
+    return nfds;
+}
+
+int handoff_notify_done(int sock)
+{
+    char done = HANDOFF_DONE;
+
+    while (send(sock, &done, 1, MSG_NOSIGNAL) < 0) {
+        if (errno != EINTR)
+            return -errno;
+    }
+    return 0;
+}
+
+int handoff_wait_done(int sock, int timeout_ms)
+{
+    struct pollfd pfd = { .fd = sock, .events = POLLIN };
+    char c;
+    int rc;
+
+    do {
+        rc = poll(&pfd, 1, timeout_ms);
+    } while (rc < 0 && errno == EINTR);
+    if (rc < 0)
+        return -errno;
+    if (rc == 0)
+        return -ETIMEDOUT;
+    /* Either the byte or EOF: a predecessor that died is done too */
+    if (recv(sock, &c, 1, 0) < 0)
+        return -errno;
+    return 0;
+}
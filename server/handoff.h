@@ -0,0 +1,42 @@
+/*
+ * handoff.h
+ *
+ * Zero-downtime restart: the running aesdsocket starts its successor with
+ * a UNIX socket pair, passes its listening sockets over it with SCM_RIGHTS
+ * and reports when it has drained its own clients and closed the store.
+ */
+
+#ifndef AESDSOCKET_HANDOFF_H
+#define AESDSOCKET_HANDOFF_H
+
+#include <sys/types.h>
+
+/* Environment variable carrying the successor's end of the socket pair */
+#define HANDOFF_ENV "AESDSOCKET_HANDOFF_FD"
+#define HANDOFF_MAX_FDS 64
+
+/*
+ * Start @exe with @argv as a successor. On success returns its pid and
+ * stores our end of the handoff socket in @sock; -errno on failure.
+ */
+pid_t handoff_spawn(const char *exe, char *const argv[], int *sock);
+
+/* Successor side: the inherited handoff socket, or -1 if started normally */
+int handoff_inherited(void);
+
+/* Pass @n descriptors; the receiver gets its own copies. 0 or -errno */
+int handoff_send_fds(int sock, const int *fds, int n);
+
+/* Receive up to @max descriptors (close-on-exec); returns the count or -errno */
+int handoff_recv_fds(int sock, int *fds, int max);
+
+/* Predecessor: tell the successor the store is closed and it may take over */
+int handoff_notify_done(int sock);
+
+/*
+ * Successor: wait up to @timeout_ms for handoff_notify_done(). Returns 0
+ * once it arrived or the predecessor is gone, -ETIMEDOUT otherwise.
+ */
+int handoff_wait_done(int sock, int timeout_ms);
+
+#endif /* AESDSOCKET_HANDOFF_H */
@@ -0,0 +1,335 @@
+/*
+ * replica.c
+ *
+ * The follower thread. Every frame is checked against the sequence number
+ * and the local store length before it is applied, so a lost, repeated or
+ * misplaced frame ends the connection instead of corrupting the copy; the
+ * next connection asks again from whatever the store actually holds.
+ */
+
+#include "replica.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <netdb.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "frame.h"
+
+#define LOGI(fmt, ...)  syslog(LOG_INFO, "[OK]  " fmt, ##__VA_ARGS__)
+#define LOGE(fmt, ...)  syslog(LOG_ERR,  "[ERR] " fmt, ##__VA_ARGS__)
+
+/* A connected socket to @primary, or -errno */
+static int connect_primary(const char *primary)
+{
+    int fd, err = ECONNREFUSED;
+
+    if (primary[0] == '/') {
+        struct sockaddr_un sun = { .sun_family = AF_UNIX };
+
+        if (strlen(primary) >= sizeof(sun.sun_path))
+            return -ENAMETOOLONG;
+        strcpy(sun.sun_path, primary);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            return -errno;
+        if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) != 0) {
+            err = errno;
+            close(fd);
+            return -err;
+        }
+        return fd;
+    }
+
+    const char *colon = strrchr(primary, ':');
+    const char *port = colon ? colon + 1 : primary;
+    char host[256] = "localhost";
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *results = NULL, *ai;
+
+    if (colon && colon > primary) {
+        if ((size_t)(colon - primary) >= sizeof(host))
+            return -ENAMETOOLONG;
+        memcpy(host, primary, (size_t)(colon - primary));
+        host[colon - primary] = '\0';
+    }
+    if (getaddrinfo(host, port, &hints, &results) != 0)
+        return -EHOSTUNREACH;
+    fd = -1;
+    for (ai = results; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) {
+            err = errno;
+            continue;
+        }
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        err = errno;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(results);
+    return fd >= 0 ? fd : -err;
+}
+
+/* Receive exactly @len bytes: 0, -ECONNRESET on EOF, -ETIMEDOUT or -errno */
+static int recv_exact(int fd, void *buf, size_t len)
+{
+    size_t got = 0;
+
+    while (got < len) {
+        ssize_t n = recv(fd, (char *)buf + got, len - got, MSG_WAITALL);
+
+        if (n == 0)
+            return -ECONNRESET;
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK ? -ETIMEDOUT : -errno;
+        }
+        got += (size_t)n;
+    }
+    return 0;
+}
+
+static int send_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static bool stopping(struct replica *r)
+{
+    bool stop;
+
+    pthread_mutex_lock(&r->lock);
+    stop = r->stop;
+    pthread_mutex_unlock(&r->lock);
+    return stop;
+}
+
+/* Switch @fd to frames, ask for the store from our length on and apply the feed */
+static int follow(struct replica *r, int fd, char *buf)
+{
+    char hdr[FRAME_HDR_LEN + sizeof(uint64_t)];
+    char prefix[FRAME_REPL_PREFIX];
+    struct frame_hdr h;
+    uint64_t seq = 0, be;
+    off_t off;
+    int rc;
+
+    rc = send_all(fd, FRAME_MAGIC "\n", sizeof(FRAME_MAGIC));
+    if (rc == 0)
+        rc = recv_exact(fd, hdr, FRAME_HDR_LEN);
+    if (rc < 0)
+        return rc;
+    frame_decode(hdr, &h);
+    if (h.op != FRAME_HELLO || h.status != 0 || h.len != 0)
+        return -EPROTO;
+
+    pthread_mutex_lock(&r->st->lock);
+    off = store_length(r->st);
+    pthread_mutex_unlock(&r->st->lock);
+    if (off < 0)
+        return (int)off;
+
+    h = (struct frame_hdr){ .op = FRAME_REPLICATE, .len = sizeof(be) };
+    frame_encode(hdr, &h);
+    be = htobe64((uint64_t)off);
+    memcpy(hdr + FRAME_HDR_LEN, &be, sizeof(be));
+    rc = send_all(fd, hdr, sizeof(hdr));
+    if (rc < 0)
+        return rc;
+    LOGI("Following %s from offset %lld", r->primary, (long long)off);
+
+    while (!stopping(r)) {
+        uint64_t in_seq, in_off;
+        size_t n;
+        off_t end;
+
+        rc = recv_exact(fd, hdr, FRAME_HDR_LEN);
+        if (rc < 0)
+            return rc;
+        frame_decode(hdr, &h);
+        if (h.op != FRAME_REPLICATE)
+            return -EPROTO;
+        if (h.status != 0)
+            return -h.status;
+        if (h.len < FRAME_REPL_PREFIX || h.len - FRAME_REPL_PREFIX > REPLICA_BATCH)
+            return -EPROTO;
+        rc = recv_exact(fd, prefix, sizeof(prefix));
+        if (rc < 0)
+            return rc;
+        memcpy(&in_seq, prefix, sizeof(in_seq));
+        memcpy(&in_off, prefix + sizeof(in_seq), sizeof(in_off));
+        in_seq = be64toh(in_seq);
+        in_off = be64toh(in_off);
+        if (in_seq != seq + 1 || in_off != (uint64_t)off) {
+            LOGE("Replication frame %llu at %llu, expected %llu at %lld",
+                 (unsigned long long)in_seq, (unsigned long long)in_off,
+                 (unsigned long long)seq + 1, (long long)off);
+            return -EPROTO;
+        }
+        seq = in_seq;
+
+        n = (size_t)(h.len - FRAME_REPL_PREFIX);
+        if (n > 0) {
+            rc = recv_exact(fd, buf, n);
+            if (rc == 0)
+                rc = store_append(r->st, buf, n, &end);
+            if (rc < 0)
+                return rc;
+            /* Only the feed appends here; anything else means the copies diverged */
+            if (end != off + (off_t)n)
+                return -EIO;
+            off = end;
+            r->bytes += n;
+        }
+        r->frames++;
+    }
+    return 0;
+}
+
+/* Sleep @ms unless replica_stop() comes first */
+static void backoff_wait(struct replica *r, unsigned int ms)
+{
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += ms / 1000;
+    deadline.tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    pthread_mutex_lock(&r->lock);
+    while (!r->stop && pthread_cond_timedwait(&r->wake, &r->lock, &deadline) != ETIMEDOUT)
+        ;
+    pthread_mutex_unlock(&r->lock);
+}
+
+static void *replica_main(void *arg)
+{
+    struct replica *r = arg;
+    unsigned int backoff = REPLICA_BACKOFF_MIN_MS;
+    char *buf = malloc(REPLICA_BATCH);
+    int last_err = 0;
+
+    if (!buf) {
+        LOGE("Replica buffer allocation failed; not following %s", r->primary);
+        return NULL;
+    }
+
+    while (!stopping(r)) {
+        uint64_t frames = r->frames;
+        int fd = connect_primary(r->primary);
+        int rc = fd;
+
+        if (fd >= 0) {
+            struct timeval tv = {
+                .tv_sec = REPLICA_TIMEOUT_MS / 1000,
+                .tv_usec = (REPLICA_TIMEOUT_MS % 1000) * 1000,
+            };
+
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            pthread_mutex_lock(&r->lock);
+            r->fd = r->stop ? -1 : fd;
+            pthread_mutex_unlock(&r->lock);
+
+            r->connects++;
+            r->connected = true;
+            rc = r->fd >= 0 ? follow(r, fd, buf) : 0;
+            r->connected = false;
+
+            pthread_mutex_lock(&r->lock);
+            r->fd = -1;
+            pthread_mutex_unlock(&r->lock);
+            close(fd);
+        }
+        if (stopping(r))
+            break;
+
+        /* Log once per kind of failure rather than on every retry */
+        if (rc != last_err) {
+            if (rc == -ERANGE)
+                LOGE("Replica store is ahead of %s; it must be emptied to follow it",
+                     r->primary);
+            else
+                LOGE("Replication from %s stopped: %s", r->primary,
+                     rc ? strerror(-rc) : "primary closed the feed");
+            last_err = rc;
+        }
+        /* Back off only while nothing is coming through */
+        backoff = r->frames != frames ? REPLICA_BACKOFF_MIN_MS :
+                  backoff * 2 > REPLICA_BACKOFF_MAX_MS ? REPLICA_BACKOFF_MAX_MS : backoff * 2;
+        backoff_wait(r, backoff);
+    }
+    free(buf);
+    return NULL;
+}
+
+int replica_start(struct replica *r, const char *primary, struct store *st)
+{
+    pthread_condattr_t attr;
+    sigset_t all, old;
+    int rc;
+
+    memset(r, 0, sizeof(*r));
+    r->primary = primary;
+    r->st = st;
+    r->fd = -1;
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&r->wake, &attr);
+    pthread_condattr_destroy(&attr);
+
+    /* Leave signal delivery to the application's own threads */
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    rc = pthread_create(&r->tid, NULL, replica_main, r);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (rc != 0) {
+        pthread_cond_destroy(&r->wake);
+        pthread_mutex_destroy(&r->lock);
+        return -rc;
+    }
+    r->started = true;
+    return 0;
+}
+
+void replica_stop(struct replica *r)
+{
+    if (!r->started)
+        return;
+    pthread_mutex_lock(&r->lock);
+    r->stop = true;
+    if (r->fd >= 0)
+        shutdown(r->fd, SHUT_RDWR);
+    pthread_cond_signal(&r->wake);
+    pthread_mutex_unlock(&r->lock);
+    pthread_join(r->tid, NULL);
+    r->started = false;
+    pthread_cond_destroy(&r->wake);
+    pthread_mutex_destroy(&r->lock);
+}
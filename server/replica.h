@@ -0,0 +1,55 @@
+/*
+ * replica.h
+ *
+ * Read replicas for aesdsocket. A replica (-F) keeps a connection to its
+ * primary, asks for the primary's store from its own length on with
+ * FRAME_REPLICATE and appends every replicated byte to its own store, so
+ * echo replies, SEEKTO and the other read commands are served locally while
+ * the primary only takes appends. Reconnects resume where the local store
+ * ends, which also carries a replica across the primary's hot restart.
+ */
+
+#ifndef AESDSOCKET_REPLICA_H
+#define AESDSOCKET_REPLICA_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "store.h"
+
+#define REPLICA_HEARTBEAT_MS   1000          // Primary: an empty frame after this long idle
+#define REPLICA_TIMEOUT_MS     5000          // Replica: reconnect after this long without a frame
+#define REPLICA_BATCH          (256 * 1024)  // Primary: most bytes per replication frame
+#define REPLICA_BACKOFF_MIN_MS 100           // Replica: first reconnect delay, doubled ...
+#define REPLICA_BACKOFF_MAX_MS 2000          // ... up to this
+
+struct replica {
+    const char *primary;              // "/path" (UNIX socket), "host:port" or "port"
+    struct store *st;
+    pthread_t tid;
+    bool started;
+
+    pthread_mutex_t lock;             // Protects fd and stop against replica_stop()
+    pthread_cond_t wake;              // Cuts a reconnect backoff short on stop
+    int fd;
+    bool stop;
+
+    /* Reported in STATS and at exit */
+    _Atomic bool connected;
+    _Atomic uint64_t frames;
+    _Atomic uint64_t bytes;
+    _Atomic unsigned long connects;
+};
+
+/*
+ * Start following @primary into @st, which must be a file-backed store
+ * already started. The thread runs with all signals blocked. 0 or -errno.
+ */
+int replica_start(struct replica *r, const char *primary, struct store *st);
+
+/* Disconnect and join the thread */
+void replica_stop(struct replica *r);
+
+#endif /* AESDSOCKET_REPLICA_H */
@@ -0,0 +1,220 @@
+/*
+ * store-bench.c
+ *
+ * Store engine benchmark: T threads each append N lines of S bytes through
+ * the store under a durability policy, then the whole store is streamed
+ * into a socket the way replies are (send straight from the mapping for
+ * mmap, store_read + send otherwise). Prints append and readback rates and
+ * the bytes the history takes on disk.
+ * The ring and char device engines keep only the last few writes, so their
+ * readback covers just those.
+ * Build with "make bench".
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "store.h"
+
+#define READ_CHUNK (16 * 1024)   // Same as aesdsocket's REPLY_CHUNK
+
+struct bench_cfg {
+    const char *path;
+    enum store_engine engine;
+    enum commit_mode durability;
+    int threads;
+    int lines;
+    size_t size;
+};
+
+struct bench_worker {
+    pthread_t tid;
+    int id;
+    const struct bench_cfg *cfg;
+    struct store *st;
+    int failed;
+};
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void *append_thread(void *arg)
+{
+    struct bench_worker *w = arg;
+    const struct bench_cfg *cfg = w->cfg;
+    char *line = malloc(cfg->size);
+
+    if (!line) {
+        w->failed = cfg->lines;
+        return NULL;
+    }
+    for (int i = 0; i < cfg->lines; i++) {
+        int n = snprintf(line, cfg->size, "t%d l%d ", w->id, i);
+        off_t end;
+
+        memset(line + n, 'x', cfg->size - (size_t)n - 1);
+        line[cfg->size - 1] = '\n';
+        if (store_append(w->st, line, cfg->size, &end) != 0)
+            w->failed++;
+    }
+    free(line);
+    return NULL;
+}
+
+/* Discards whatever arrives on the other end of the socket pair */
+static void *drain_thread(void *arg)
+{
+    int fd = *(int *)arg;
+    char buf[65536];
+
+    while (recv(fd, buf, sizeof(buf), 0) > 0)
+        ;
+    return NULL;
+}
+
+static int read_back(struct store *st, int sock, off_t len)
+{
+    char *buf = malloc(READ_CHUNK);
+    off_t off = 0;
+
+    if (!buf)
+        return -1;
+    while (off < len) {
+        size_t want = len - off < READ_CHUNK ? (size_t)(len - off) : READ_CHUNK;
+        const char *src = buf;
+        ssize_t n;
+
+        if (st->engine == STORE_MMAP) {
+            src = store_data(st) + off;
+        } else {
+            n = store_read(st, buf, want, off);
+            if (n <= 0)
+                break;
+            want = (size_t)n;
+        }
+        n = send(sock, src, want, 0);
+        if (n <= 0)
+            break;
+        off += n;
+    }
+    free(buf);
+    return off == len ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    struct bench_cfg cfg = { "/tmp/store-bench.data", STORE_FILE, COMMIT_NONE, 4, 10000, 64 };
+    struct store st;
+    int opt, rc;
+
+    while ((opt = getopt(argc, argv, "p:e:D:t:n:s:")) != -1) {
+        switch (opt) {
+        case 'p': cfg.path = optarg; break;
+        case 'e':
+            cfg.engine = strcmp(optarg, "mmap") == 0 ? STORE_MMAP :
+                         strcmp(optarg, "chardev") == 0 ? STORE_CHARDEV :
+                         strcmp(optarg, "ring") == 0 ? STORE_RING :
+                         strcmp(optarg, "compressed") == 0 ? STORE_COMPRESSED : STORE_FILE;
+            break;
+        case 'D':
+            cfg.durability = strcmp(optarg, "group") == 0 ? COMMIT_GROUP :
+                             strcmp(optarg, "periodic") == 0 ? COMMIT_PERIODIC : COMMIT_NONE;
+            break;
+        case 't': cfg.threads = atoi(optarg); break;
+        case 'n': cfg.lines = atoi(optarg); break;
+        case 's': cfg.size = (size_t)atol(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-p path] [-e file|mmap|compressed|chardev|ring] [-D none|periodic|group] "
+                    "[-t threads] [-n lines] [-s size]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (cfg.threads < 1 || cfg.lines < 1 || cfg.size < 32) {
+        fprintf(stderr, "need threads >= 1, lines >= 1, size >= 32\n");
+        return EXIT_FAILURE;
+    }
+
+    if (store_is_file(cfg.engine))
+        store_unlink(cfg.path, cfg.engine);
+    rc = store_open(&st, cfg.path, cfg.engine, true);
+    if (rc == 0)
+        rc = store_start(&st, cfg.durability, 0);
+    if (rc != 0) {
+        fprintf(stderr, "%s: %s\n", cfg.path, strerror(-rc));
+        return EXIT_FAILURE;
+    }
+
+    struct bench_worker *workers = calloc((size_t)cfg.threads, sizeof(*workers));
+    if (!workers)
+        return EXIT_FAILURE;
+
+    double t0 = now_s();
+    for (int i = 0; i < cfg.threads; i++) {
+        workers[i].id = i;
+        workers[i].cfg = &cfg;
+        workers[i].st = &st;
+        pthread_create(&workers[i].tid, NULL, append_thread, &workers[i]);
+    }
+    int failed = 0;
+    for (int i = 0; i < cfg.threads; i++) {
+        pthread_join(workers[i].tid, NULL);
+        failed += workers[i].failed;
+    }
+    double append_s = now_s() - t0;
+
+    pthread_mutex_lock(&st.lock);
+    off_t len = store_length(&st);
+    pthread_mutex_unlock(&st.lock);
+
+    int sv[2];
+    pthread_t drain;
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+        return EXIT_FAILURE;
+    pthread_create(&drain, NULL, drain_thread, &sv[1]);
+    t0 = now_s();
+    rc = read_back(&st, sv[0], len);
+    double read_s = now_s() - t0;
+    shutdown(sv[0], SHUT_WR);
+    pthread_join(drain, NULL);
+    close(sv[0]);
+    close(sv[1]);
+
+    size_t total = (size_t)cfg.threads * (size_t)cfg.lines;
+    unsigned long syncs = st.commit.syncs;
+    store_close(&st);
+
+    /* What the history costs on disk, segments included */
+    double disk_mb = 0;
+    if (store_is_file(cfg.engine)) {
+        char seg_path[4096];
+        struct stat sb;
+
+        snprintf(seg_path, sizeof(seg_path), "%s" STORE_SEGMENT_SUFFIX, cfg.path);
+        if (stat(cfg.path, &sb) == 0)
+            disk_mb += (double)sb.st_size / 1e6;
+        if (cfg.engine == STORE_COMPRESSED && stat(seg_path, &sb) == 0)
+            disk_mb += (double)sb.st_size / 1e6;
+    }
+    printf("engine=%s durability=%s lines=%zu failed=%d append=%.0f lines/s (%.1f MB/s) "
+           "readback=%.1f MB/s data=%.1f MB disk=%.1f MB syncs=%lu%s\n",
+           store_engine_name(cfg.engine), commit_mode_name(cfg.durability), total, failed,
+           (double)total / append_s, (double)len / append_s / 1e6, (double)len / read_s / 1e6,
+           (double)len / 1e6, disk_mb, syncs, rc ? " (short readback)" : "");
+
+    if (store_is_file(cfg.engine))
+        store_unlink(cfg.path, cfg.engine);
+    free(workers);
+    return failed || rc ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,1152 @@
+/*
+ * store.c
+ *
+ * Opening DATA_FILE once keeps open()/close() off the per-connection and
+ * per-timestamp paths; every reader uses pread() at explicit offsets, so a
+ * single descriptor is safe to share between threads.
+ *
+ * The line index only ever grows at the end, in the same order as the file,
+ * because it is updated under the lock that serialises appends.
+ *
+ * STORE_MMAP maps a fixed-size reservation once, larger than the file will
+ * ever get, so the data never moves and readers can send from it without
+ * the lock. Pages past EOF are never touched: appends first extend the file
+ * by whole extents, and readers stay below the published length. The header
+ * length is what survives a crash; with a durability policy it is advanced
+ * only after the data below it has been synced.
+ *
+ * STORE_CHARDEV and STORE_RING only hold the last few writes, so offsets
+ * into them move as old writes drop out, exactly as on the device; they
+ * keep no line index because the driver core resolves SEEKTO itself.
+ *
+ * STORE_COMPRESSED seals the whole tail at once under the store lock, so a
+ * segment never splits an append and its raw length is STORE_SEGMENT_SIZE
+ * plus at most one packet. The segment is written (and synced, under a
+ * durability policy) before the tail is emptied; a crash in between leaves
+ * a tail equal to the last segment, which store_open() recognises by its
+ * crc. Readers don't take the store lock: they find the segment by binary
+ * search under seg_lock and inflate it once per thread, so a reply that
+ * streams a segment in REPLY_CHUNK pieces inflates it only once.
+ */
+
+#define _GNU_SOURCE   // fallocate
+#include "store.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#if USE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "../aesd-char-driver/aesd_ioctl.h"
+#include "../aesd-char-driver/aesdchar-core.h"
+
+#define STORE_SCAN_CHUNK (64 * 1024)
+#define STORE_MMAP_MAGIC "AESDMMAP"
+#define STORE_MMAP_VERSION 1
+
+/* Address space reserved for the mapping; bounds the mmap store's size */
+#define STORE_MMAP_RESERVE ((size_t)(sizeof(void *) >= 8 ? (64ULL << 30) : (256UL << 20)))
+
+/* Record the lines completed by @len bytes that end at file offset @end */
+static void index_append(struct store *st, const char *buf, size_t len, off_t end)
+{
+    struct line_index *li = &st->lines;
+    off_t base = end - (off_t)len;
+    const char *p = buf;
+    const char *stop = buf + len;
+
+    if (!st->indexed)
+        return;
+
+    while ((p = memchr(p, '\n', (size_t)(stop - p))) != NULL) {
+        if (li->count == li->cap) {
+            size_t cap = li->cap ? li->cap * 2 : 1024;
+            off_t *ends = realloc(li->ends, cap * sizeof(*ends));
+
+            if (!ends) {
+                /* A gap would misplace every later line; stop serving SEEKTO instead */
+                st->indexed = false;
+                return;
+            }
+            li->ends = ends;
+            li->cap = cap;
+        }
+        p++;
+        li->ends[li->count++] = base + (p - buf);
+    }
+}
+
+/* After every append through the commit log, in file order */
+static void store_written(void *ctx, const void *buf, size_t len, off_t end)
+{
+    struct store *st = ctx;
+
+    index_append(st, buf, len, end);
+    pthread_cond_broadcast(&st->grown);
+}
+
+static void store_init_sync(struct store *st)
+{
+    pthread_condattr_t attr;
+
+    pthread_mutex_init(&st->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&st->grown, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+/* Index whatever a previous run left in the file */
+static int index_existing(struct store *st)
+{
+    char *buf;
+    off_t off = 0;
+    ssize_t n;
+
+    if (st->engine == STORE_MMAP) {
+        off = atomic_load(&st->published);
+        index_append(st, store_data(st), (size_t)off, off);
+        return st->indexed ? 0 : -ENOMEM;
+    }
+
+    buf = malloc(STORE_SCAN_CHUNK);
+    if (!buf)
+        return -ENOMEM;
+    while ((n = store_read(st, buf, STORE_SCAN_CHUNK, off)) > 0) {
+        off += n;
+        index_append(st, buf, (size_t)n, off);
+    }
+    free(buf);
+    if (n < 0)
+        return (int)n;
+    return st->indexed ? 0 : -ENOMEM;
+}
+
+/* ========================== STORE_FILE ========================== */
+static ssize_t writev_all(int fd, struct iovec *iov, int iovcnt)
+{
+    ssize_t total = 0;
+
+    while (iovcnt > 0) {
+        ssize_t n = writev(fd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        total += n;
+        /* Skip what was written and resume mid-iovec if needed */
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= (ssize_t)iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
+    }
+    return total;
+}
+
+static ssize_t pread_all(int fd, void *buf, size_t len, off_t off)
+{
+    size_t got = 0;
+
+    while (got < len) {
+        ssize_t n = pread(fd, (char *)buf + got, len - got, off + (off_t)got);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        if (n == 0)
+            break;
+        got += (size_t)n;
+    }
+    return (ssize_t)got;
+}
+
+static off_t file_append(void *ctx, const struct iovec *iov, int iovcnt)
+{
+    struct store *st = ctx;
+    struct iovec local[iovcnt];
+    off_t end;
+
+    memcpy(local, iov, sizeof(local));
+    if (writev_all(st->fd, local, iovcnt) < 0)
+        return -errno;
+    end = lseek(st->fd, 0, SEEK_END);
+    return end < 0 ? -errno : end;
+}
+
+static int file_sync(void *ctx)
+{
+    struct store *st = ctx;
+
+    return fdatasync(st->fd) == 0 ? 0 : -errno;
+}
+
+static const struct commit_ops file_ops = {
+    .append = file_append,
+    .sync = file_sync,
+};
+
+/* ========================== STORE_MMAP ========================== */
+/* Extend the file from @from to @to bytes, allocating the blocks up front */
+static int grow_file(int fd, off_t from, off_t to)
+{
+    if (fallocate(fd, 0, from, to - from) == 0)
+        return 0;
+    if (errno != EOPNOTSUPP && errno != ENOSYS)
+        return -errno;
+    return ftruncate(fd, to) == 0 ? 0 : -errno;
+}
+
+static struct store_mmap_header *mmap_header(struct store *st)
+{
+    return (struct store_mmap_header *)st->map;
+}
+
+static int mmap_open(struct store *st)
+{
+    struct store_mmap_header *hdr;
+    struct stat sb;
+    bool fresh = false;
+    off_t length;
+    int rc;
+
+    if (fstat(st->fd, &sb) != 0)
+        return -errno;
+    if (sb.st_size == 0) {
+        rc = grow_file(st->fd, 0, STORE_MMAP_HEADER + STORE_MMAP_EXTENT);
+        if (rc < 0)
+            return rc;
+        sb.st_size = STORE_MMAP_HEADER + STORE_MMAP_EXTENT;
+        fresh = true;
+    } else if (sb.st_size < STORE_MMAP_HEADER) {
+        return -EINVAL;
+    }
+
+    st->map_size = STORE_MMAP_RESERVE;
+    st->map = mmap(NULL, st->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, st->fd, 0);
+    if (st->map == MAP_FAILED) {
+        st->map = NULL;
+        return -errno;
+    }
+
+    hdr = mmap_header(st);
+    if (fresh) {
+        memcpy(hdr->magic, STORE_MMAP_MAGIC, sizeof(hdr->magic));
+        hdr->version = STORE_MMAP_VERSION;
+        hdr->header_size = STORE_MMAP_HEADER;
+        hdr->length = 0;
+    } else if (memcmp(hdr->magic, STORE_MMAP_MAGIC, sizeof(hdr->magic)) != 0 ||
+               hdr->version != STORE_MMAP_VERSION || hdr->header_size != STORE_MMAP_HEADER) {
+        /* Not ours, e.g. left behind by the plain file engine */
+        munmap(st->map, st->map_size);
+        st->map = NULL;
+        return -EINVAL;
+    }
+
+    st->alloc = sb.st_size - STORE_MMAP_HEADER;
+    length = (off_t)hdr->length;
+    if (length > st->alloc) {
+        /* The header claims more than the file holds: keep whole lines only */
+        length = st->alloc;
+        while (length > 0 && store_data(st)[length - 1] != '\n')
+            length--;
+        hdr->length = (uint64_t)length;
+    }
+    atomic_init(&st->published, length);
+    st->synced = length;
+    return 0;
+}
+
+static off_t mmap_append(void *ctx, const struct iovec *iov, int iovcnt)
+{
+    struct store *st = ctx;
+    off_t len = atomic_load_explicit(&st->published, memory_order_relaxed);
+    size_t total = 0;
+    char *dst;
+
+    for (int i = 0; i < iovcnt; i++)
+        total += iov[i].iov_len;
+
+    if (len + (off_t)total > st->alloc) {
+        off_t want = (len + (off_t)total + STORE_MMAP_EXTENT - 1) / STORE_MMAP_EXTENT * STORE_MMAP_EXTENT;
+        int rc;
+
+        if ((size_t)(STORE_MMAP_HEADER + want) > st->map_size)
+            return -ENOSPC;
+        rc = grow_file(st->fd, STORE_MMAP_HEADER + st->alloc, STORE_MMAP_HEADER + want);
+        if (rc < 0)
+            return rc;
+        st->alloc = want;
+    }
+
+    dst = st->map + STORE_MMAP_HEADER + len;
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(dst, iov[i].iov_base, iov[i].iov_len);
+        dst += iov[i].iov_len;
+    }
+    len += (off_t)total;
+
+    /* Readers load with acquire, so the bytes are visible before the length */
+    atomic_store_explicit(&st->published, len, memory_order_release);
+    if (!st->header_on_sync)
+        mmap_header(st)->length = (uint64_t)len;
+    return len;
+}
+
+/* Sync the data, then publish its length in the header and sync that */
+static int mmap_sync(void *ctx)
+{
+    struct store *st = ctx;
+    off_t len = atomic_load_explicit(&st->published, memory_order_acquire);
+    long page = sysconf(_SC_PAGESIZE);
+
+    if (len > st->synced) {
+        off_t from = (STORE_MMAP_HEADER + st->synced) / page * page;
+
+        if (msync(st->map + from, (size_t)(STORE_MMAP_HEADER + len - from), MS_SYNC) != 0)
+            return -errno;
+        st->synced = len;
+    }
+    if (st->header_on_sync && mmap_header(st)->length != (uint64_t)len) {
+        mmap_header(st)->length = (uint64_t)len;
+        if (msync(st->map, STORE_MMAP_HEADER, MS_SYNC) != 0)
+            return -errno;
+    }
+    return 0;
+}
+
+static const struct commit_ops mmap_ops = {
+    .append = mmap_append,
+    .sync = mmap_sync,
+};
+
+/* ========================== STORE_RING ========================== */
+static off_t ring_append(void *ctx, const struct iovec *iov, int iovcnt)
+{
+    struct store *st = ctx;
+    loff_t pos = 0;
+
+    for (int i = 0; i < iovcnt; i++) {
+        ssize_t n = aesd_core_write(st->ring, iov[i].iov_base, iov[i].iov_len, &pos);
+
+        if (n < 0)
+            return n;
+    }
+    return aesd_core_llseek(st->ring, 0, 0, SEEK_END);
+}
+
+/* Nothing to make durable */
+static int ring_sync(void *ctx)
+{
+    (void)ctx;
+    return 0;
+}
+
+static const struct commit_ops ring_ops = {
+    .append = ring_append,
+    .sync = ring_sync,
+};
+
+/* ========================== STORE_COMPRESSED ========================== */
+#define SEG_MAGIC "AZSG"
+#define SEG_CACHE_SLOTS 4         // Stores whose last inflated segment a reader thread keeps
+
+/* In front of every zlib stream in the segment file */
+struct seg_header {
+    char magic[4];
+    uint32_t raw_len;
+    uint32_t zlen;
+    uint32_t crc;
+    uint64_t raw_off;
+};
+
+/* A reader thread's last inflated segment of one store */
+struct seg_cache {
+    uint64_t store_id;            // st->cache_id of the store it came from
+    size_t seg;                   // Index into st->segs; valid while raw is set
+    char *raw;
+    size_t raw_cap;
+    char *z;
+    size_t z_cap;
+};
+
+/*
+ * One key for every compressed store: PTHREAD_KEYS_MAX is far below the
+ * number of streams -N allows. Entries are tagged with a store id, never a
+ * pointer, so a store reopened at the same address cannot hit a stale one.
+ */
+struct seg_caches {
+    struct seg_cache slot[SEG_CACHE_SLOTS];
+    unsigned int next;            // Slot to reuse when none matches
+};
+
+static pthread_key_t seg_caches_key;
+static pthread_once_t seg_caches_once = PTHREAD_ONCE_INIT;
+static int seg_caches_err;
+static _Atomic uint64_t seg_cache_ids;
+
+static uint32_t seg_crc(const void *buf, size_t len)
+{
+#if USE_ZLIB
+    return (uint32_t)crc32(crc32(0L, Z_NULL, 0), buf, (uInt)len);
+#else
+    (void)buf;
+    (void)len;
+    return 0;
+#endif
+}
+
+static size_t seg_bound(size_t len)
+{
+#if USE_ZLIB
+    return compressBound((uLong)len);
+#else
+    return len;
+#endif
+}
+
+/* Fastest zlib level: sealing happens inline in an append */
+static int seg_deflate(const void *raw, size_t len, void *z, size_t *zlen)
+{
+#if USE_ZLIB
+    uLongf out = (uLongf)*zlen;
+
+    if (compress2(z, &out, raw, (uLong)len, Z_BEST_SPEED) != Z_OK)
+        return -ENOMEM;
+    *zlen = (size_t)out;
+    return 0;
+#else
+    (void)raw; (void)len; (void)z; (void)zlen;
+    return -ENOTSUP;
+#endif
+}
+
+static int seg_inflate(const void *z, size_t zlen, void *raw, size_t raw_len)
+{
+#if USE_ZLIB
+    uLongf out = (uLongf)raw_len;
+
+    if (uncompress(raw, &out, z, (uLong)zlen) != Z_OK || out != raw_len)
+        return -EIO;
+    return 0;
+#else
+    (void)z; (void)zlen; (void)raw; (void)raw_len;
+    return -ENOTSUP;
+#endif
+}
+
+static bool grow_buf(char **buf, size_t *cap, size_t want)
+{
+    char *p;
+
+    if (*cap >= want)
+        return true;
+    p = realloc(*buf, want);
+    if (!p)
+        return false;
+    *buf = p;
+    *cap = want;
+    return true;
+}
+
+static void seg_cache_drop(struct seg_cache *c)
+{
+    free(c->raw);
+    free(c->z);
+    memset(c, 0, sizeof(*c));
+}
+
+static void seg_caches_free(void *p)
+{
+    struct seg_caches *t = p;
+
+    for (int i = 0; i < SEG_CACHE_SLOTS; i++)
+        seg_cache_drop(&t->slot[i]);
+    free(t);
+}
+
+static void seg_caches_init(void)
+{
+    seg_caches_err = pthread_key_create(&seg_caches_key, seg_caches_free);
+}
+
+/* Add a sealed segment; seg_lock held exclusively (or not yet shared) */
+static int seg_push(struct store *st, const struct store_segment *seg)
+{
+    if (st->nsegs == st->segs_cap) {
+        size_t cap = st->segs_cap ? st->segs_cap * 2 : 64;
+        struct store_segment *segs = realloc(st->segs, cap * sizeof(*segs));
+
+        if (!segs)
+            return -ENOMEM;
+        st->segs = segs;
+        st->segs_cap = cap;
+    }
+    st->segs[st->nsegs++] = *seg;
+    st->sealed = seg->raw_off + seg->raw_len;
+    return 0;
+}
+
+static off_t seg_file_end(const struct store *st)
+{
+    const struct store_segment *last = st->nsegs ? &st->segs[st->nsegs - 1] : NULL;
+
+    return last ? last->zoff + last->zlen : 0;
+}
+
+/* Compress the whole tail into a new segment and empty the tail; st->lock held */
+static int seg_seal(struct store *st)
+{
+    struct store_segment seg = { .raw_off = st->sealed, .raw_len = (uint32_t)st->tail_len };
+    struct seg_header hdr = { .magic = SEG_MAGIC };
+    off_t base = seg_file_end(st);
+    size_t zlen = seg_bound((size_t)st->tail_len);
+    char *raw = malloc((size_t)st->tail_len);
+    char *z = malloc(sizeof(hdr) + zlen);
+    struct iovec iov;
+    ssize_t n;
+    int rc;
+
+    if (st->tail_len > UINT32_MAX) {
+        rc = -EFBIG;
+        goto out;
+    }
+    if (!raw || !z) {
+        rc = -ENOMEM;
+        goto out;
+    }
+    n = pread_all(st->fd, raw, (size_t)st->tail_len, 0);
+    if (n != (ssize_t)st->tail_len) {
+        rc = n < 0 ? (int)n : -EIO;
+        goto out;
+    }
+    rc = seg_deflate(raw, (size_t)st->tail_len, z + sizeof(hdr), &zlen);
+    if (rc < 0)
+        goto out;
+
+    seg.zlen = (uint32_t)zlen;
+    seg.zoff = base + (off_t)sizeof(hdr);
+    seg.crc = seg_crc(raw, (size_t)st->tail_len);
+    hdr.raw_len = seg.raw_len;
+    hdr.zlen = seg.zlen;
+    hdr.crc = seg.crc;
+    hdr.raw_off = (uint64_t)seg.raw_off;
+    memcpy(z, &hdr, sizeof(hdr));
+    iov = (struct iovec){ .iov_base = z, .iov_len = sizeof(hdr) + zlen };
+
+    /* The segment must be on disk before the tail that also holds its bytes is emptied */
+    if (writev_all(st->seg_fd, &iov, 1) < 0 ||
+        (st->commit.mode != COMMIT_NONE && fdatasync(st->seg_fd) != 0)) {
+        rc = -errno;
+        if (ftruncate(st->seg_fd, base) != 0)
+            rc = -EIO;
+        goto out;
+    }
+
+    pthread_rwlock_wrlock(&st->seg_lock);
+    rc = seg_push(st, &seg);
+    if (rc == 0 && ftruncate(st->fd, 0) != 0) {
+        rc = -errno;
+        st->nsegs--;
+        st->sealed = seg.raw_off;
+    }
+    if (rc == 0)
+        st->tail_len = 0;
+    pthread_rwlock_unlock(&st->seg_lock);
+    if (rc < 0 && ftruncate(st->seg_fd, base) != 0)
+        rc = -EIO;
+out:
+    free(raw);
+    free(z);
+    return rc;
+}
+
+static off_t compressed_append(void *ctx, const struct iovec *iov, int iovcnt)
+{
+    struct store *st = ctx;
+    struct iovec local[iovcnt];
+    ssize_t n;
+    off_t end;
+
+    memcpy(local, iov, sizeof(local));
+    n = writev_all(st->fd, local, iovcnt);
+    if (n < 0)
+        return -errno;
+    st->tail_len += n;
+    end = st->sealed + st->tail_len;
+
+    /* A failed seal leaves the bytes in the tail; the next append tries again */
+    if (st->tail_len >= STORE_SEGMENT_SIZE)
+        seg_seal(st);
+    return end;
+}
+
+/* Sealed segments were synced as they were written; only the tail is left */
+static int compressed_sync(void *ctx)
+{
+    struct store *st = ctx;
+
+    return fdatasync(st->fd) == 0 ? 0 : -errno;
+}
+
+static const struct commit_ops compressed_ops = {
+    .append = compressed_append,
+    .sync = compressed_sync,
+};
+
+static int compressed_open(struct store *st, const char *path)
+{
+    struct seg_header hdr;
+    struct stat sb;
+    off_t pos = 0;
+    int rc;
+
+    pthread_once(&seg_caches_once, seg_caches_init);
+    if (seg_caches_err != 0)
+        return -seg_caches_err;
+    st->cache_id = ++seg_cache_ids;
+
+    /* compressed_close() undoes all of this once seg_path is set */
+    st->seg_path = malloc(strlen(path) + sizeof(STORE_SEGMENT_SUFFIX));
+    if (!st->seg_path)
+        return -ENOMEM;
+    pthread_rwlock_init(&st->seg_lock, NULL);
+    strcpy(st->seg_path, path);
+    strcat(st->seg_path, STORE_SEGMENT_SUFFIX);
+    st->seg_fd = open(st->seg_path, O_CREAT | O_RDWR | O_APPEND | O_CLOEXEC, 0644);
+    if (st->seg_fd < 0 || fstat(st->seg_fd, &sb) != 0)
+        return -errno;
+
+    /* Walk the headers; a torn segment at the end is from a crash while sealing */
+    while (pos + (off_t)sizeof(hdr) <= sb.st_size &&
+           pread_all(st->seg_fd, &hdr, sizeof(hdr), pos) == (ssize_t)sizeof(hdr)) {
+        struct store_segment seg = {
+            .raw_off = (off_t)hdr.raw_off, .raw_len = hdr.raw_len, .zlen = hdr.zlen,
+            .zoff = pos + (off_t)sizeof(hdr), .crc = hdr.crc,
+        };
+
+        if (memcmp(hdr.magic, SEG_MAGIC, sizeof(hdr.magic)) != 0 || hdr.raw_len == 0 ||
+            seg.raw_off != st->sealed || seg.zoff + seg.zlen > sb.st_size)
+            break;
+        rc = seg_push(st, &seg);
+        if (rc < 0)
+            return rc;
+        pos = seg.zoff + seg.zlen;
+    }
+    if (pos < sb.st_size && ftruncate(st->seg_fd, pos) != 0)
+        return -errno;
+
+    if (fstat(st->fd, &sb) != 0)
+        return -errno;
+    st->tail_len = sb.st_size;
+
+    /* Crashed after sealing but before emptying the tail: it holds the last segment */
+    if (st->nsegs && st->tail_len == st->segs[st->nsegs - 1].raw_len) {
+        char *raw = malloc((size_t)st->tail_len);
+        bool dup = raw && pread_all(st->fd, raw, (size_t)st->tail_len, 0) == st->tail_len &&
+                   seg_crc(raw, (size_t)st->tail_len) == st->segs[st->nsegs - 1].crc;
+
+        free(raw);
+        if (dup) {
+            if (ftruncate(st->fd, 0) != 0)
+                return -errno;
+            st->tail_len = 0;
+        }
+    }
+    return 0;
+}
+
+static void compressed_close(struct store *st)
+{
+    struct seg_caches *t;
+
+    if (!st->seg_path)
+        return;
+    /* Free the closing thread's entry; other threads' age out or go with their threads */
+    t = pthread_getspecific(seg_caches_key);
+    for (int i = 0; t && i < SEG_CACHE_SLOTS; i++)
+        if (t->slot[i].store_id == st->cache_id)
+            seg_cache_drop(&t->slot[i]);
+    pthread_rwlock_destroy(&st->seg_lock);
+    if (st->seg_fd >= 0)
+        close(st->seg_fd);
+    st->seg_fd = -1;
+    free(st->seg_path);
+    st->seg_path = NULL;
+    free(st->segs);
+    st->segs = NULL;
+    st->nsegs = st->segs_cap = 0;
+}
+
+/* Index of the segment holding @off, which is below st->sealed; seg_lock held */
+static size_t seg_find(const struct store *st, off_t off)
+{
+    size_t lo = 0, hi = st->nsegs;
+
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (st->segs[mid].raw_off <= off)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Segment @i inflated, from this thread's cache when it was the last one read */
+static const char *seg_inflated(struct store *st, size_t i, const struct store_segment *seg,
+                                int *err)
+{
+    struct seg_caches *t = pthread_getspecific(seg_caches_key);
+    struct seg_cache *c = NULL;
+    ssize_t n;
+
+    if (!t) {
+        t = calloc(1, sizeof(*t));
+        if (!t || pthread_setspecific(seg_caches_key, t) != 0) {
+            free(t);
+            *err = -ENOMEM;
+            return NULL;
+        }
+    }
+    for (int s = 0; s < SEG_CACHE_SLOTS && !c; s++)
+        if (t->slot[s].store_id == st->cache_id)
+            c = &t->slot[s];
+    if (!c) {
+        /* Hand the next slot over to this store, keeping its buffers */
+        c = &t->slot[t->next];
+        t->next = (t->next + 1) % SEG_CACHE_SLOTS;
+        free(c->raw);
+        c->raw = NULL;
+        c->raw_cap = 0;
+        c->store_id = st->cache_id;
+    }
+    if (c->raw && c->seg == i)
+        return c->raw;
+
+    /* Drop the old segment first: a failure must not leave it labelled as @i */
+    free(c->raw);
+    c->raw = NULL;
+    c->raw_cap = 0;
+    if (!grow_buf(&c->z, &c->z_cap, seg->zlen) || !grow_buf(&c->raw, &c->raw_cap, seg->raw_len)) {
+        *err = -ENOMEM;
+        return NULL;
+    }
+    n = store_read_compressed(st, seg, c->z, seg->zlen, 0);
+    *err = n < 0 ? (int)n : n != (ssize_t)seg->zlen ? -EIO :
+           seg_inflate(c->z, seg->zlen, c->raw, seg->raw_len);
+    if (*err < 0) {
+        free(c->raw);
+        c->raw = NULL;
+        c->raw_cap = 0;
+        return NULL;
+    }
+    c->seg = i;
+    return c->raw;
+}
+
+/* Like pread() across the sealed segments and the tail; no st->lock needed */
+static ssize_t compressed_read(struct store *st, char *buf, size_t len, off_t off)
+{
+    size_t got = 0;
+
+    while (got < len) {
+        struct store_segment seg;
+        const char *raw;
+        size_t i, n;
+        int err;
+
+        pthread_rwlock_rdlock(&st->seg_lock);
+        if (off >= st->sealed) {
+            /* Shared lock: the tail is not emptied under this read */
+            ssize_t t = pread_all(st->fd, buf + got, len - got, off - st->sealed);
+
+            pthread_rwlock_unlock(&st->seg_lock);
+            if (t < 0)
+                return got ? (ssize_t)got : t;
+            return (ssize_t)(got + (size_t)t);
+        }
+        i = seg_find(st, off);
+        seg = st->segs[i];
+        pthread_rwlock_unlock(&st->seg_lock);
+
+        raw = seg_inflated(st, i, &seg, &err);
+        if (!raw)
+            return got ? (ssize_t)got : err;
+        n = (size_t)(seg.raw_off + seg.raw_len - off);
+        if (n > len - got)
+            n = len - got;
+        memcpy(buf + got, raw + (off - seg.raw_off), n);
+        got += n;
+        off += (off_t)n;
+    }
+    return (ssize_t)got;
+}
+
+int store_open(struct store *st, const char *path, enum store_engine engine, bool index_lines)
+{
+    int rc = 0;
+
+    memset(st, 0, sizeof(*st));
+    st->path = path;
+    st->engine = engine;
+    st->seg_fd = -1;
+    if (engine == STORE_COMPRESSED && !USE_ZLIB)
+        return -ENOTSUP;
+    st->indexed = index_lines && store_is_file(engine);
+    index_lines = st->indexed;
+
+    if (engine == STORE_RING) {
+        st->path = "ring";
+        st->fd = -1;
+        st->ring = malloc(sizeof(*st->ring));
+        if (!st->ring)
+            return -ENOMEM;
+        aesd_core_init(st->ring);
+        store_init_sync(st);
+        return 0;
+    }
+
+    /* The device must already exist; a regular file in its place would hide that */
+    if (engine == STORE_CHARDEV)
+        st->fd = open(path, O_RDWR | O_CLOEXEC);
+    else
+        st->fd = open(path, O_CREAT | O_RDWR | O_APPEND | O_CLOEXEC, 0644);
+    if (st->fd < 0)
+        return -errno;
+    if (engine == STORE_MMAP)
+        rc = mmap_open(st);
+    else if (engine == STORE_COMPRESSED)
+        rc = compressed_open(st, path);
+    if (rc == 0 && index_lines)
+        rc = index_existing(st);
+    if (rc < 0) {
+        compressed_close(st);
+        if (st->map)
+            munmap(st->map, st->map_size);
+        close(st->fd);
+        st->fd = -1;
+        free(st->lines.ends);
+        return rc;
+    }
+    store_init_sync(st);
+    return 0;
+}
+
+int store_start(struct store *st, enum commit_mode mode, unsigned int interval_ms)
+{
+    int rc;
+
+    st->header_on_sync = mode != COMMIT_NONE;
+    rc = commit_init(&st->commit, mode,
+                     st->engine == STORE_MMAP ? &mmap_ops :
+                     st->engine == STORE_RING ? &ring_ops :
+                     st->engine == STORE_COMPRESSED ? &compressed_ops : &file_ops,
+                     st, &st->lock, interval_ms);
+    if (rc == 0) {
+        st->started = true;
+        st->commit.written = store_written;
+        st->commit.written_ctx = st;
+    }
+    return rc;
+}
+
+void store_close(struct store *st)
+{
+    if (st->fd < 0 && !st->ring)
+        return;
+    if (st->started)
+        commit_destroy(&st->commit);
+    st->started = false;
+    if (st->ring) {
+        aesd_core_free(st->ring);
+        free(st->ring);
+        st->ring = NULL;
+        pthread_cond_destroy(&st->grown);
+        pthread_mutex_destroy(&st->lock);
+        return;
+    }
+    if (st->map) {
+        /* Clean shutdown: everything appended is complete */
+        mmap_header(st)->length = (uint64_t)atomic_load(&st->published);
+        munmap(st->map, st->map_size);
+        st->map = NULL;
+    }
+    compressed_close(st);
+    close(st->fd);
+    st->fd = -1;
+    free(st->lines.ends);
+    memset(&st->lines, 0, sizeof(st->lines));
+    pthread_cond_destroy(&st->grown);
+    pthread_mutex_destroy(&st->lock);
+}
+
+int store_unlink(const char *path, enum store_engine engine)
+{
+    int rc = unlink(path) == 0 ? 0 : -errno;
+
+    if (engine == STORE_COMPRESSED) {
+        char seg_path[PATH_MAX];
+
+        snprintf(seg_path, sizeof(seg_path), "%s" STORE_SEGMENT_SUFFIX, path);
+        unlink(seg_path);
+    }
+    return rc;
+}
+
+int store_append(struct store *st, const void *buf, size_t len, off_t *end)
+{
+    return commit_append(&st->commit, buf, len, end);
+}
+
+int store_append_locked(struct store *st, const void *buf, size_t len, off_t *end)
+{
+    return commit_append_locked(&st->commit, buf, len, end);
+}
+
+void store_note_write(struct store *st, const void *buf, size_t len, off_t end)
+{
+    index_append(st, buf, len, end);
+    commit_note_write(&st->commit);
+    pthread_cond_broadcast(&st->grown);
+}
+
+off_t store_length(struct store *st)
+{
+    off_t end;
+
+    if (st->engine == STORE_MMAP)
+        return atomic_load(&st->published);
+    if (st->engine == STORE_RING)
+        return aesd_core_llseek(st->ring, 0, 0, SEEK_END);
+    if (st->engine == STORE_COMPRESSED)
+        return st->sealed + st->tail_len;
+    end = lseek(st->fd, 0, SEEK_END);
+    return end < 0 ? -errno : end;
+}
+
+off_t store_wait_length(struct store *st, off_t off, unsigned int timeout_ms)
+{
+    off_t len = store_length(st);
+    struct timespec deadline;
+
+    if (len < 0 || len > off)
+        return len;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    /* One wait only: callers loop anyway and must notice shutdown */
+    pthread_cond_timedwait(&st->grown, &st->lock, &deadline);
+    return store_length(st);
+}
+
+void store_wake(struct store *st)
+{
+    pthread_mutex_lock(&st->lock);
+    pthread_cond_broadcast(&st->grown);
+    pthread_mutex_unlock(&st->lock);
+}
+
+ssize_t store_read(struct store *st, void *buf, size_t len, off_t off)
+{
+    struct aesd_cursor cursor = { .valid = false };
+    loff_t pos = off;
+    size_t got = 0;
+    ssize_t n;
+
+    switch (st->engine) {
+    case STORE_MMAP:
+        n = atomic_load_explicit(&st->published, memory_order_acquire) - off;
+        if (n <= 0)
+            return 0;
+        if ((size_t)n > len)
+            n = (ssize_t)len;
+        memcpy(buf, store_data(st) + off, (size_t)n);
+        return n;
+    case STORE_RING:
+        /* The core returns one write at a time; the cursor chains them in O(1) */
+        while (got < len) {
+            n = aesd_core_read(st->ring, &cursor, (char *)buf + got, len - got, &pos);
+            if (n < 0)
+                return got ? (ssize_t)got : n;
+            if (n == 0)
+                break;
+            got += (size_t)n;
+        }
+        return (ssize_t)got;
+    case STORE_COMPRESSED:
+        return compressed_read(st, buf, len, off);
+    default:
+        n = pread(st->fd, buf, len, off);
+        return n < 0 ? -errno : n;
+    }
+}
+
+size_t store_segments(struct store *st, off_t *sealed)
+{
+    size_t n;
+
+    *sealed = 0;
+    if (st->engine != STORE_COMPRESSED)
+        return 0;
+    pthread_rwlock_rdlock(&st->seg_lock);
+    n = st->nsegs;
+    *sealed = st->sealed;
+    pthread_rwlock_unlock(&st->seg_lock);
+    return n;
+}
+
+int store_segment(struct store *st, size_t i, struct store_segment *seg)
+{
+    int rc = -EINVAL;
+
+    if (st->engine != STORE_COMPRESSED)
+        return rc;
+    pthread_rwlock_rdlock(&st->seg_lock);
+    if (i < st->nsegs) {
+        *seg = st->segs[i];
+        rc = 0;
+    }
+    pthread_rwlock_unlock(&st->seg_lock);
+    return rc;
+}
+
+ssize_t store_read_compressed(struct store *st, const struct store_segment *seg, void *buf,
+                              size_t len, off_t off)
+{
+    if (off >= (off_t)seg->zlen)
+        return 0;
+    if ((off_t)len > (off_t)seg->zlen - off)
+        len = (size_t)((off_t)seg->zlen - off);
+    return pread_all(st->seg_fd, buf, len, seg->zoff + off);
+}
+
+int store_line_offset(struct store *st, uint32_t line, uint32_t offset, off_t *pos)
+{
+    const struct line_index *li = &st->lines;
+    off_t start, end;
+
+    if (!st->indexed)
+        return -ENOMEM;
+    if (line >= li->count)
+        return -EINVAL;
+    start = line ? li->ends[line - 1] : 0;
+    end = li->ends[line];
+    if ((off_t)offset >= end - start)
+        return -EINVAL;
+    *pos = start + offset;
+    return 0;
+}
+
+int store_tail_offset(struct store *st, uint32_t n, off_t end, off_t *pos)
+{
+    const struct line_index *li = &st->lines;
+    char *buf;
+    off_t off = end;
+    bool last = true;    /* next byte seen is the final one of the store */
+
+    /* Every line in the index ends at or before @end */
+    if (st->indexed) {
+        size_t count = li->count;
+
+        while (count > 0 && li->ends[count - 1] > end)
+            count--;
+        *pos = n >= count ? 0 : li->ends[count - n - 1];
+        return 0;
+    }
+
+    if (n == 0) {
+        *pos = end;
+        return 0;
+    }
+    buf = st->engine == STORE_MMAP ? NULL : malloc(STORE_SCAN_CHUNK);
+    if (st->engine != STORE_MMAP && !buf)
+        return -ENOMEM;
+    while (off > 0) {
+        size_t want = off < STORE_SCAN_CHUNK ? (size_t)off : STORE_SCAN_CHUNK;
+        const char *p;
+        ssize_t got;
+
+        if (st->engine == STORE_MMAP) {
+            p = store_data(st) + off - (off_t)want;
+        } else {
+            got = store_read(st, buf, want, off - (off_t)want);
+            if (got < 0) {
+                free(buf);
+                return (int)got;
+            }
+            if ((size_t)got != want)
+                break;      /* Shrunk under us (device or ring); treat as the start */
+            p = buf;
+        }
+        for (size_t i = want; i-- > 0; ) {
+            /* The newline ending the final line does not start a line */
+            if (p[i] == '\n' && !last && --n == 0) {
+                free(buf);
+                *pos = off - (off_t)want + (off_t)i + 1;
+                return 0;
+            }
+            last = false;
+        }
+        off -= (off_t)want;
+    }
+    free(buf);
+    *pos = 0;
+    return 0;
+}
+
+int store_seekto(struct store *st, uint32_t line, uint32_t offset, off_t *pos)
+{
+    struct aesd_seekto sk = { .write_cmd = line, .write_cmd_offset = offset };
+    loff_t fpos = 0;
+    int rc;
+
+    switch (st->engine) {
+    case STORE_CHARDEV:
+        /* The descriptor is shared, but st->lock keeps the ioctl and lseek together */
+        if (ioctl(st->fd, AESDCHAR_IOCSEEKTO, &sk) == -1)
+            return -errno;
+        *pos = lseek(st->fd, 0, SEEK_CUR);
+        return *pos < 0 ? -errno : 0;
+    case STORE_RING:
+        rc = aesd_core_seekto(st->ring, line, offset, &fpos);
+        if (rc == 0)
+            *pos = fpos;
+        return rc;
+    default:
+        /* A regular file has no ioctl; every line ever written is in the index */
+        return store_line_offset(st, line, offset, pos);
+    }
+}
+
+const char *store_engine_name(enum store_engine engine)
+{
+    switch (engine) {
+    case STORE_MMAP:       return "mmap";
+    case STORE_CHARDEV:    return "chardev";
+    case STORE_RING:       return "ring";
+    case STORE_COMPRESSED: return "compressed";
+    default:               return "file";
+    }
+}
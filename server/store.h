@@ -0,0 +1,216 @@
+/*
+ * store.h
+ *
+ * aesdsocket's data store: one long-lived handle on DATA_FILE shared by
+ * every connection, the lock that orders appends against reply snapshots,
+ * the durability policy applied to appends and, in the file-backed build,
+ * an index of line boundaries used to resolve SEEKTO.
+ *
+ * Five engines are available. STORE_FILE appends with write() on an O_APPEND
+ * descriptor and replies pread() from it. STORE_MMAP maps the file once,
+ * appends with memcpy() into extents preallocated with fallocate() and
+ * replies straight from the mapping; a header page holds the published
+ * length so a crash never exposes a half-written append. STORE_CHARDEV
+ * reads and writes the aesdchar device, and STORE_RING runs the driver's
+ * own core (aesdchar-core.c over aesd-circular-buffer.c) in-process, so
+ * appends and reads make no syscalls at all. STORE_COMPRESSED appends to a
+ * raw tail file and seals it into a zlib-compressed segment whenever it
+ * reaches STORE_SEGMENT_SIZE, so a long history takes a fraction of the
+ * disk and page cache and a read inflates only the segments it touches.
+ */
+
+#ifndef AESDSOCKET_STORE_H
+#define AESDSOCKET_STORE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "commit.h"
+
+/* The compressed store needs zlib; the Makefile sets this */
+#ifndef USE_ZLIB
+#define USE_ZLIB 0
+#endif
+
+enum store_engine {
+    STORE_FILE,
+    STORE_MMAP,
+    STORE_CHARDEV,
+    STORE_RING,
+    STORE_COMPRESSED,
+};
+
+struct aesd_core;
+
+#define STORE_MMAP_HEADER  4096               // Header page in front of the data
+#define STORE_MMAP_EXTENT  (1024 * 1024)      // Data grows by this much at a time
+
+/* First page of a STORE_MMAP file */
+struct store_mmap_header {
+    char magic[8];                // "AESDMMAP"
+    uint32_t version;
+    uint32_t header_size;         // STORE_MMAP_HEADER
+    uint64_t length;              // Data bytes known to be complete on disk
+};
+
+#define STORE_SEGMENT_SIZE   (64 * 1024)  // Tail bytes that trigger sealing a segment
+#define STORE_SEGMENT_SUFFIX "@seg"       // Sealed segments live in path + this; no stream name has '@'
+
+/* A sealed STORE_COMPRESSED segment: raw bytes [raw_off, raw_off + raw_len) */
+struct store_segment {
+    off_t raw_off;
+    uint32_t raw_len;             // At least STORE_SEGMENT_SIZE: a whole tail is sealed at once
+    uint32_t zlen;                // Size of the zlib stream
+    off_t zoff;                   // Where the zlib stream starts in the segment file
+    uint32_t crc;                 // crc32 of the raw bytes
+};
+
+/* End offset of every complete line, so line N starts at ends[N - 1] */
+struct line_index {
+    off_t *ends;
+    size_t count;
+    size_t cap;
+};
+
+struct store {
+    const char *path;
+    enum store_engine engine;
+    int fd;                       // O_RDWR | O_APPEND; replies use pread() only. -1 for STORE_RING
+    pthread_mutex_t lock;         // Held across an append and the snapshot of its end offset
+    pthread_cond_t grown;         // Broadcast after every append; waited on with lock
+    struct commit_log commit;
+    bool started;                 // commit log initialised
+    bool indexed;                 // lines tracks every complete line in the file
+    struct line_index lines;      // Protected by lock
+
+    /* STORE_MMAP only */
+    char *map;                    // Fixed mapping of the whole reservation, never moved
+    size_t map_size;
+    off_t alloc;                  // Data bytes backed by the file
+    _Atomic off_t published;      // Data bytes readers may send
+    off_t synced;                 // Data bytes covered by the last sync
+    bool header_on_sync;          // Header length advances only once data is synced
+
+    /* STORE_RING only */
+    struct aesd_core *ring;       // The last AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED writes
+
+    /* STORE_COMPRESSED only; fd is the raw tail holding bytes [sealed, sealed + tail_len) */
+    int seg_fd;                   // O_APPEND segment file
+    char *seg_path;
+    pthread_rwlock_t seg_lock;    // segs and sealed; held shared across a tail read
+    struct store_segment *segs;
+    size_t nsegs, segs_cap;
+    off_t sealed;                 // Data bytes in sealed segments
+    off_t tail_len;               // Protected by lock
+    uint64_t cache_id;            // Tags this store's entries in the readers' segment caches
+};
+
+/* Engines backed by regular files of ours: indexed, durable and removable */
+static inline bool store_is_file(enum store_engine engine)
+{
+    return engine == STORE_FILE || engine == STORE_MMAP || engine == STORE_COMPRESSED;
+}
+
+/* Engines whose descriptor holds the data at store offsets, for direct write() and io_uring */
+static inline bool store_is_raw(enum store_engine engine)
+{
+    return engine == STORE_FILE || engine == STORE_CHARDEV;
+}
+
+/*
+ * Open (creating if needed) @path with @engine; with @index_lines, index the
+ * lines it already holds and keep the index current on every append. Only
+ * file engines index; STORE_RING ignores @path. Returns 0 or -errno.
+ */
+int store_open(struct store *st, const char *path, enum store_engine engine, bool index_lines);
+
+/*
+ * Start the durability policy. Separate from store_open() because the
+ * periodic policy runs a thread, which must be created after daemonizing.
+ */
+int store_start(struct store *st, enum commit_mode mode, unsigned int interval_ms);
+
+/* Flush per the policy and close the handle */
+void store_close(struct store *st);
+
+/* Remove the files a store_is_file() engine keeps at @path; 0 or -errno for @path */
+int store_unlink(const char *path, enum store_engine engine);
+
+/*
+ * Append @len bytes through the durability policy and return the end offset
+ * of the store just past them in @end. Takes st->lock itself.
+ */
+int store_append(struct store *st, const void *buf, size_t len, off_t *end);
+
+/* store_append() with st->lock already held; not for COMMIT_GROUP. 0 or -errno */
+int store_append_locked(struct store *st, const void *buf, size_t len, off_t *end);
+
+/* STORE_FILE: record an append of @buf made directly on st->fd, ending at @end; st->lock held */
+void store_note_write(struct store *st, const void *buf, size_t len, off_t end);
+
+/* Current length of the data; st->lock held. Returns -errno on failure */
+off_t store_length(struct store *st);
+
+/*
+ * Wait up to @timeout_ms for the store to grow past @off; st->lock held.
+ * Returns the current length, which may still be @off or less after the
+ * timeout, a store_wake() or a spurious wakeup, or -errno.
+ */
+off_t store_wait_length(struct store *st, off_t off, unsigned int timeout_ms);
+
+/* Wake every store_wait_length() caller, e.g. for shutdown */
+void store_wake(struct store *st);
+
+/*
+ * Read up to @len bytes at @off, like pread() but for every engine; only
+ * returns short at the end of the data. Returns the count or -errno.
+ */
+ssize_t store_read(struct store *st, void *buf, size_t len, off_t off);
+
+/* STORE_MMAP: data bytes [0, published) are readable here without the lock */
+static inline const char *store_data(const struct store *st)
+{
+    return st->map + STORE_MMAP_HEADER;
+}
+
+/*
+ * STORE_COMPRESSED: the number of sealed segments and, in @sealed, the data
+ * bytes they hold; st->lock held, so no segment is sealed meanwhile. Other
+ * engines have none.
+ */
+size_t store_segments(struct store *st, off_t *sealed);
+
+/* Copy out segment @i, one of those store_segments() reported. 0 or -EINVAL */
+int store_segment(struct store *st, size_t i, struct store_segment *seg);
+
+/* Read up to @len bytes of @seg's zlib stream from byte @off of it. Count or -errno */
+ssize_t store_read_compressed(struct store *st, const struct store_segment *seg, void *buf,
+                              size_t len, off_t off);
+
+/*
+ * Resolve byte @offset of line @line (both counted from 0) to a file offset,
+ * in O(1); st->lock held. Returns 0, or -EINVAL if the line is not complete
+ * yet or is shorter than @offset + 1 bytes.
+ */
+int store_line_offset(struct store *st, uint32_t line, uint32_t offset, off_t *pos);
+
+/*
+ * SEEKTO for any engine: AESDCHAR_IOCSEEKTO on the device, the driver core
+ * for the ring, store_line_offset() otherwise; st->lock held. 0 or -errno.
+ */
+int store_seekto(struct store *st, uint32_t line, uint32_t offset, off_t *pos);
+
+/*
+ * Start of the last @n lines of the store's first @end bytes; st->lock held.
+ * Uses the line index when there is one and scans backwards from @end
+ * otherwise, so the cost is O(1) or the size of the tail. 0 or -errno.
+ */
+int store_tail_offset(struct store *st, uint32_t n, off_t end, off_t *pos);
+
+const char *store_engine_name(enum store_engine engine);
+
+#endif /* AESDSOCKET_STORE_H */
@@ -0,0 +1,141 @@
+/*
+ * streams.c
+ *
+ * A stream's store is opened under its shard's lock, so two clients naming
+ * a new stream at once open it only once; streams in other shards are not
+ * held up meanwhile. The count is reserved before opening and given back
+ * if that fails, so the limit holds without a global lock.
+ */
+
+#include "streams.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static bool name_valid(const char *name, size_t len)
+{
+    if (len == 0 || len > STREAM_NAME_MAX)
+        return false;
+    for (size_t i = 0; i < len; i++) {
+        char c = name[i];
+
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+              c == '_' || c == '-'))
+            return false;
+    }
+    return true;
+}
+
+/* FNV-1a */
+static uint32_t name_hash(const char *name, size_t len)
+{
+    uint32_t h = 2166136261u;
+
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static struct stream *stream_open(struct streams *tbl, const char *name, size_t len, int *err)
+{
+    size_t plen = strlen(tbl->path_prefix);
+    struct stream *s = calloc(1, sizeof(*s));
+    int rc;
+
+    if (!s || !(s->path = malloc(plen + len + 1))) {
+        free(s);
+        *err = -ENOMEM;
+        return NULL;
+    }
+    memcpy(s->name, name, len);
+    memcpy(s->path, tbl->path_prefix, plen);
+    memcpy(s->path + plen, name, len);
+    s->path[plen + len] = '\0';
+
+    /* SEEKTO works per stream, so every stream keeps a line index */
+    rc = store_open(&s->store, s->path, tbl->engine, true);
+    if (rc == 0) {
+        rc = store_start(&s->store, tbl->durability, tbl->interval_ms);
+        if (rc < 0)
+            store_close(&s->store);
+    }
+    if (rc < 0) {
+        free(s->path);
+        free(s);
+        *err = rc;
+        return NULL;
+    }
+    return s;
+}
+
+void streams_init(struct streams *tbl, const char *path_prefix, enum store_engine engine,
+                  enum commit_mode durability, unsigned int interval_ms, unsigned int max)
+{
+    memset(tbl, 0, sizeof(*tbl));
+    tbl->path_prefix = path_prefix;
+    tbl->engine = engine;
+    tbl->durability = durability;
+    tbl->interval_ms = interval_ms;
+    tbl->max = max;
+    atomic_init(&tbl->count, 0);
+    for (int i = 0; i < STREAM_SHARDS; i++)
+        pthread_mutex_init(&tbl->shards[i].lock, NULL);
+}
+
+int streams_get(struct streams *tbl, const char *name, size_t len, struct store **st)
+{
+    struct stream_shard *shard;
+    struct stream *s;
+    int rc = 0;
+
+    if (!name_valid(name, len))
+        return -EINVAL;
+    shard = &tbl->shards[name_hash(name, len) % STREAM_SHARDS];
+
+    pthread_mutex_lock(&shard->lock);
+    for (s = shard->head; s; s = s->next)
+        if (strncmp(s->name, name, len) == 0 && s->name[len] == '\0')
+            break;
+    if (!s) {
+        if (atomic_fetch_add(&tbl->count, 1) >= tbl->max) {
+            atomic_fetch_sub(&tbl->count, 1);
+            rc = -ENOSPC;
+        } else if ((s = stream_open(tbl, name, len, &rc)) != NULL) {
+            s->next = shard->head;
+            shard->head = s;
+        } else {
+            atomic_fetch_sub(&tbl->count, 1);
+        }
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    if (s)
+        *st = &s->store;
+    return rc;
+}
+
+void streams_close(struct streams *tbl, bool remove)
+{
+    for (int i = 0; i < STREAM_SHARDS; i++) {
+        struct stream *s = tbl->shards[i].head;
+
+        while (s) {
+            struct stream *next = s->next;
+
+            store_close(&s->store);
+            if (remove)
+                store_unlink(s->path, tbl->engine);
+            free(s->path);
+            free(s);
+            s = next;
+        }
+        tbl->shards[i].head = NULL;
+        pthread_mutex_destroy(&tbl->shards[i].lock);
+    }
+    atomic_store(&tbl->count, 0);
+}
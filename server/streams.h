@@ -0,0 +1,64 @@
+/*
+ * streams.h
+ *
+ * Named streams for aesdsocket: a packet starting with "@name:" is appended
+ * to the stream called name instead of DATA_FILE, and its reply is that
+ * stream's history only. Every stream is a complete store of its own, with
+ * its own file, lock, line index and durability policy, so clients writing
+ * to different streams never contend on one lock.
+ *
+ * Streams are created on first use and live until streams_close(). The
+ * table is split into shards with a lock each; a lookup holds one shard's
+ * lock only while walking its chain.
+ */
+
+#ifndef AESDSOCKET_STREAMS_H
+#define AESDSOCKET_STREAMS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "store.h"
+
+#define STREAM_NAME_MAX 64            // [A-Za-z0-9_-], at least one character
+#define STREAM_SHARDS   64
+
+struct stream {
+    struct stream *next;              // Chain within the shard
+    char name[STREAM_NAME_MAX + 1];
+    char *path;
+    struct store store;
+};
+
+struct stream_shard {
+    pthread_mutex_t lock;             // Protects the chain; streams are never removed
+    struct stream *head;
+};
+
+struct streams {
+    const char *path_prefix;          // Stream files are path_prefix + name
+    enum store_engine engine;
+    enum commit_mode durability;
+    unsigned int interval_ms;
+    unsigned int max;                 // Streams allowed; creation fails beyond this
+    _Atomic unsigned int count;
+    struct stream_shard shards[STREAM_SHARDS];
+};
+
+/* Set up an empty table; stores are opened with @engine and started with @durability */
+void streams_init(struct streams *tbl, const char *path_prefix, enum store_engine engine,
+                  enum commit_mode durability, unsigned int interval_ms, unsigned int max);
+
+/*
+ * Find the stream @name (@len bytes, not terminated), opening its store on
+ * first use. Returns 0 and the store in @st, -EINVAL for a bad name,
+ * -ENOSPC past the stream limit, or the -errno from opening the store.
+ */
+int streams_get(struct streams *tbl, const char *name, size_t len, struct store **st);
+
+/* Close every stream's store; with @remove, delete their files too */
+void streams_close(struct streams *tbl, bool remove);
+
+#endif /* AESDSOCKET_STREAMS_H */
@@ -0,0 +1,362 @@
+/*
+ * uring.c
+ *
+ * Raw-syscall io_uring plumbing for aesdsocket. Each connection gets a small
+ * private ring, so no locking is needed: the worker thread is the only
+ * submitter and the only reaper.
+ */
+#define _GNU_SOURCE
+#include "uring.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if USE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define URING_ENTRIES 16
+
+static int sys_io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned int opcode, const void *arg, unsigned int nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int uring_conn_init(struct uring *r, int data_fd, int client_fd, unsigned int nbufs, size_t buf_size)
+{
+    struct io_uring_params p;
+    int fds[2] = { data_fd, client_fd };
+    struct iovec iov[URING_ENTRIES];
+    int err;
+
+    memset(r, 0, sizeof(*r));
+    r->ring_fd = -1;
+    if (nbufs == 0 || nbufs >= URING_ENTRIES)
+        return -EINVAL;
+
+    memset(&p, 0, sizeof(p));
+    r->ring_fd = sys_io_uring_setup(URING_ENTRIES, &p);
+    if (r->ring_fd < 0)
+        return -errno;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_RW_CUR_POS)) {
+        err = -EOPNOTSUPP;
+        goto fail;
+    }
+
+    /* With SINGLE_MMAP the SQ and CQ rings share one mapping */
+    r->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    r->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (r->cq_ring_sz > r->sq_ring_sz)
+        r->sq_ring_sz = r->cq_ring_sz;
+    r->cq_ring_sz = r->sq_ring_sz;
+
+    r->sq_ring = mmap(NULL, r->sq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      r->ring_fd, IORING_OFF_SQ_RING);
+    if (r->sq_ring == MAP_FAILED) {
+        r->sq_ring = NULL;
+        err = -errno;
+        goto fail;
+    }
+    r->cq_ring = r->sq_ring;
+
+    r->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->ring_fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        r->sqes = NULL;
+        err = -errno;
+        goto fail;
+    }
+
+    r->sq_entries = p.sq_entries;
+    r->sq_head  = (unsigned int *)((char *)r->sq_ring + p.sq_off.head);
+    r->sq_tail  = (unsigned int *)((char *)r->sq_ring + p.sq_off.tail);
+    r->sq_mask  = (unsigned int *)((char *)r->sq_ring + p.sq_off.ring_mask);
+    r->sq_array = (unsigned int *)((char *)r->sq_ring + p.sq_off.array);
+    r->cq_head  = (unsigned int *)((char *)r->cq_ring + p.cq_off.head);
+    r->cq_tail  = (unsigned int *)((char *)r->cq_ring + p.cq_off.tail);
+    r->cq_mask  = (unsigned int *)((char *)r->cq_ring + p.cq_off.ring_mask);
+    r->cqes     = (struct io_uring_cqe *)((char *)r->cq_ring + p.cq_off.cqes);
+    r->sq_local_tail = *r->sq_tail;
+
+    if (sys_io_uring_register(r->ring_fd, IORING_REGISTER_FILES, fds, 2) < 0) {
+        err = -errno;
+        goto fail;
+    }
+
+    r->buf_size = buf_size;
+    r->nbufs = nbufs;
+    r->bufs = aligned_alloc(4096, nbufs * buf_size);
+    if (!r->bufs) {
+        err = -ENOMEM;
+        goto fail;
+    }
+    for (unsigned int i = 0; i < nbufs; i++) {
+        iov[i].iov_base = r->bufs + i * buf_size;
+        iov[i].iov_len = buf_size;
+    }
+    if (sys_io_uring_register(r->ring_fd, IORING_REGISTER_BUFFERS, iov, nbufs) < 0) {
+        err = -errno;
+        goto fail;
+    }
+    return 0;
+
+fail:
+    uring_conn_exit(r);
+    return err;
+}
+
+void uring_conn_exit(struct uring *r)
+{
+    if (r->sqes)
+        munmap(r->sqes, r->sqes_sz);
+    if (r->sq_ring)
+        munmap(r->sq_ring, r->sq_ring_sz);
+    if (r->ring_fd >= 0)
+        close(r->ring_fd);   /* also drops the registered files and buffers */
+    free(r->bufs);
+    memset(r, 0, sizeof(*r));
+    r->ring_fd = -1;
+}
+
+static struct io_uring_sqe *get_sqe(struct uring *r)
+{
+    unsigned int head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    unsigned int idx;
+    struct io_uring_sqe *sqe;
+
+    if (r->sq_local_tail - head >= r->sq_entries)
+        return NULL;
+    idx = r->sq_local_tail & *r->sq_mask;
+    sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[idx] = idx;
+    r->sq_local_tail++;
+    return sqe;
+}
+
+/* Publish all queued SQEs and wait until nr of them have completed */
+static int submit_and_wait(struct uring *r, unsigned int nr)
+{
+    unsigned int to_submit = r->sq_local_tail - *r->sq_tail;
+
+    __atomic_store_n(r->sq_tail, r->sq_local_tail, __ATOMIC_RELEASE);
+    for (;;) {
+        int rc = sys_io_uring_enter(r->ring_fd, to_submit, nr, IORING_ENTER_GETEVENTS);
+
+        r->enters++;
+        if (rc >= 0)
+            return 0;
+        if (errno != EINTR)
+            return -errno;
+        to_submit = 0;   /* already consumed by the kernel; just wait */
+    }
+}
+
+/* Pop one completion; the caller knows how many to expect */
+static struct io_uring_cqe *peek_cqe(struct uring *r)
+{
+    unsigned int head = *r->cq_head;
+
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &r->cqes[head & *r->cq_mask];
+}
+
+static void cqe_seen(struct uring *r)
+{
+    __atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/* Submit one prepared SQE and return its result */
+static ssize_t run_one(struct uring *r)
+{
+    struct io_uring_cqe *cqe;
+    ssize_t res;
+    int rc = submit_and_wait(r, 1);
+
+    if (rc < 0)
+        return rc;
+    cqe = peek_cqe(r);
+    if (!cqe)
+        return -EIO;
+    res = cqe->res;
+    cqe_seen(r);
+    return res;
+}
+
+ssize_t uring_recv(struct uring *r, void *buf, size_t len)
+{
+    struct io_uring_sqe *sqe = get_sqe(r);
+
+    if (!sqe)
+        return -EBUSY;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = URING_FILE_CLIENT;
+    sqe->addr = (unsigned long)buf;
+    sqe->len = (unsigned int)len;
+    return run_one(r);
+}
+
+ssize_t uring_append(struct uring *r, const void *buf, size_t len)
+{
+    const char *p = buf;
+    size_t remaining = len;
+
+    while (remaining > 0) {
+        struct io_uring_sqe *sqe = get_sqe(r);
+        ssize_t n;
+
+        if (!sqe)
+            return -EBUSY;
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->flags = IOSQE_FIXED_FILE;
+        sqe->fd = URING_FILE_DATA;
+        sqe->off = (__u64)-1;          /* current position, like write(2) */
+        sqe->addr = (unsigned long)p;
+        sqe->len = (unsigned int)remaining;
+        n = run_one(r);
+        if (n == -EINTR || n == -EAGAIN)
+            continue;
+        if (n < 0)
+            return n;
+        p += n;
+        remaining -= (size_t)n;
+    }
+    return (ssize_t)len;
+}
+
+ssize_t uring_stream(struct uring *r, off_t off, size_t len)
+{
+    struct iovec iov[URING_ENTRIES];
+    struct msghdr msg;
+    unsigned int nreads = 0;
+    unsigned int expect;
+    ssize_t sent = -ECANCELED;
+    ssize_t read_err = 0;         /* First failed read; the reads after it and the send are cancelled */
+    bool short_read = false;
+    int rc;
+
+    /* READ_FIXED -> READ_FIXED -> ... -> SENDMSG, linked so the send only runs
+     * once every buffer is filled, and is cancelled if any read comes up short */
+    while (len > 0 && nreads < r->nbufs) {
+        size_t chunk = len < r->buf_size ? len : r->buf_size;
+        struct io_uring_sqe *sqe = get_sqe(r);
+
+        if (!sqe)
+            break;
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+        sqe->fd = URING_FILE_DATA;
+        sqe->off = (__u64)off;
+        sqe->addr = (unsigned long)(r->bufs + nreads * r->buf_size);
+        sqe->len = (unsigned int)chunk;
+        sqe->buf_index = (__u16)nreads;
+        sqe->user_data = nreads;
+
+        iov[nreads].iov_base = r->bufs + nreads * r->buf_size;
+        iov[nreads].iov_len = chunk;
+        nreads++;
+        off += (off_t)chunk;
+        len -= chunk;
+    }
+    if (nreads == 0)
+        return 0;
+
+    struct io_uring_sqe *send_sqe = get_sqe(r);
+    if (!send_sqe)
+        return -EBUSY;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = nreads;
+    send_sqe->opcode = IORING_OP_SENDMSG;
+    send_sqe->flags = IOSQE_FIXED_FILE;
+    send_sqe->fd = URING_FILE_CLIENT;
+    send_sqe->addr = (unsigned long)&msg;
+    send_sqe->msg_flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+    send_sqe->user_data = URING_ENTRIES;   /* marks the send */
+
+    expect = nreads + 1;
+    rc = submit_and_wait(r, expect);
+    if (rc < 0)
+        return rc;
+
+    while (expect > 0) {
+        struct io_uring_cqe *cqe = peek_cqe(r);
+
+        if (!cqe) {
+            /* Completions can trail the enter() return on some kernels */
+            rc = submit_and_wait(r, 1);
+            if (rc < 0)
+                return rc;
+            continue;
+        }
+        if (cqe->user_data == URING_ENTRIES)
+            sent = cqe->res;
+        else if (cqe->res >= 0 && (size_t)cqe->res < iov[cqe->user_data].iov_len)
+            short_read = true;
+        else if (cqe->res < 0 && cqe->res != -ECANCELED && read_err == 0)
+            read_err = cqe->res;
+        cqe_seen(r);
+        expect--;
+    }
+
+    if (read_err < 0)
+        return read_err;
+    if (sent == -EAGAIN || sent == -EWOULDBLOCK)
+        return 0;
+    if (sent == -ECANCELED && short_read)
+        return -ENODATA;
+    return sent;
+}
+
+#else /* !USE_IO_URING */
+
+int uring_conn_init(struct uring *r, int data_fd, int client_fd, unsigned int nbufs, size_t buf_size)
+{
+    (void)data_fd; (void)client_fd; (void)nbufs; (void)buf_size;
+    memset(r, 0, sizeof(*r));
+    r->ring_fd = -1;
+    return -ENOSYS;
+}
+
+void uring_conn_exit(struct uring *r)
+{
+    (void)r;
+}
+
+ssize_t uring_recv(struct uring *r, void *buf, size_t len)
+{
+    (void)r; (void)buf; (void)len;
+    return -ENOSYS;
+}
+
+ssize_t uring_append(struct uring *r, const void *buf, size_t len)
+{
+    (void)r; (void)buf; (void)len;
+    return -ENOSYS;
+}
+
+ssize_t uring_stream(struct uring *r, off_t off, size_t len)
+{
+    (void)r; (void)off; (void)len;
+    return -ENOSYS;
+}
+
+#endif /* USE_IO_URING */
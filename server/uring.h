@@ -0,0 +1,69 @@
+/*
+ * uring.h
+ *
+ * Minimal io_uring engine for aesdsocket connections, built directly on the
+ * io_uring syscalls so no liburing is needed on the target.
+ */
+
+#ifndef AESDSOCKET_URING_H
+#define AESDSOCKET_URING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifndef USE_IO_URING
+#  if defined(__has_include)
+#    if __has_include(<linux/io_uring.h>)
+#      define USE_IO_URING 1
+#    endif
+#  endif
+#endif
+#ifndef USE_IO_URING
+#define USE_IO_URING 0
+#endif
+
+/* Fixed file slots registered for each connection */
+#define URING_FILE_DATA   0
+#define URING_FILE_CLIENT 1
+
+struct uring {
+    int ring_fd;
+    unsigned int sq_entries;
+    unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned int *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    void *cq_ring;
+    size_t sq_ring_sz, cq_ring_sz, sqes_sz;
+    unsigned int sq_local_tail;   // SQEs filled in but not yet published
+    char *bufs;                   // nbufs registered buffers of buf_size bytes
+    unsigned int nbufs;
+    size_t buf_size;
+    unsigned long enters;         // io_uring_enter() calls made on this ring
+};
+
+/*
+ * Set up a ring for one connection with data_fd/client_fd as fixed files and
+ * nbufs registered buffers. Returns 0 or a negative errno (e.g. -ENOSYS when
+ * the kernel has no io_uring), in which case the caller uses blocking I/O.
+ */
+int uring_conn_init(struct uring *r, int data_fd, int client_fd, unsigned int nbufs, size_t buf_size);
+void uring_conn_exit(struct uring *r);
+
+/* Single recv() on the client socket; returns bytes or a negative errno */
+ssize_t uring_recv(struct uring *r, void *buf, size_t len);
+
+/* Write all of buf at the data file's current position (O_APPEND appends) */
+ssize_t uring_append(struct uring *r, const void *buf, size_t len);
+
+/*
+ * Send up to len bytes of the data file starting at off: one linked chain of
+ * READ_FIXED into every registered buffer followed by a single non-blocking
+ * SENDMSG, all submitted with one io_uring_enter(). Returns bytes sent (0 if
+ * the socket is full), -ENODATA if the file ended early, or a negative errno.
+ */
+ssize_t uring_stream(struct uring *r, off_t off, size_t len);
+
+#endif /* AESDSOCKET_URING_H */
@@ -0,0 +1,282 @@
+/*
+ * wheel.c
+ *
+ * Slots are indexed by absolute tick bits, so a timer's slot never depends
+ * on when it was armed and the thread may skip any stretch of ticks in which
+ * nothing is due: the occupancy maps give the next tick that fires or
+ * cascades a non-empty slot, and the thread sleeps until then rather than
+ * waking every tick.
+ */
+
+#include "wheel.h"
+
+#include <signal.h>
+#include <string.h>
+
+#define LEVEL_SHIFT(l) ((l) * WHEEL_BITS)
+#define SLOT_MASK      ((uint64_t)WHEEL_SLOTS - 1)
+#define WHEEL_SPAN     ((uint64_t)1 << LEVEL_SHIFT(WHEEL_LEVELS))
+
+static uint64_t current_tick(const struct timer_wheel *w)
+{
+    struct timespec ts;
+    int64_t ms;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ms = (int64_t)(ts.tv_sec - w->epoch.tv_sec) * 1000 +
+         (ts.tv_nsec - w->epoch.tv_nsec) / 1000000;
+    return ms > 0 ? (uint64_t)ms / WHEEL_TICK_MS : 0;
+}
+
+static uint64_t ms_to_ticks(unsigned int ms)
+{
+    return ms ? (ms + WHEEL_TICK_MS - 1) / WHEEL_TICK_MS : 0;
+}
+
+/*
+ * Put @t in the slot of its expiry at the finest level that reaches it. An
+ * expiry beyond the wheel's span waits in the farthest top-level slot
+ * instead; when that slot cascades @t is linked again from its real expiry,
+ * now closer, so a long timer never fires early.
+ */
+static void link_timer(struct timer_wheel *w, struct timer *t)
+{
+    uint64_t delta = t->expires > w->now ? t->expires - w->now : 0;
+    uint64_t at = t->expires;
+    unsigned int level = 0;
+    struct timer **head;
+
+    if (delta >= WHEEL_SPAN) {
+        at = w->now + WHEEL_SPAN - 1;
+        delta = WHEEL_SPAN - 1;
+    }
+    while (delta >> LEVEL_SHIFT(level + 1))
+        level++;
+    t->level = (uint8_t)level;
+    t->slot = (uint8_t)((at >> LEVEL_SHIFT(level)) & SLOT_MASK);
+
+    head = &w->slots[level][t->slot];
+    t->next = *head;
+    if (t->next)
+        t->next->pprev = &t->next;
+    *head = t;
+    t->pprev = head;
+    w->occupied[level] |= 1ULL << t->slot;
+}
+
+static void unlink_timer(struct timer_wheel *w, struct timer *t)
+{
+    *t->pprev = t->next;
+    if (t->next)
+        t->next->pprev = t->pprev;
+    if (!w->slots[t->level][t->slot])
+        w->occupied[t->level] &= ~(1ULL << t->slot);
+    t->next = NULL;
+    t->pprev = NULL;
+}
+
+/*
+ * The first tick after w->now at which a non-empty slot fires (level 0) or
+ * cascades (above), or UINT64_MAX with no timers at all. A slot at level l
+ * cascades on the tick whose lower l * WHEEL_BITS bits are zero and whose
+ * level l index is that slot.
+ */
+static uint64_t next_event(const struct timer_wheel *w)
+{
+    uint64_t best = UINT64_MAX;
+
+    for (int l = 0; l < WHEEL_LEVELS; l++) {
+        uint64_t map = w->occupied[l];
+        uint64_t base, rot;
+        unsigned int r;
+
+        if (!map)
+            continue;
+        base = w->now >> LEVEL_SHIFT(l);
+        /* Bit k of rot is the slot k + 1 places past the current one */
+        r = (unsigned int)((base + 1) & SLOT_MASK);
+        rot = r ? (map >> r) | (map << (WHEEL_SLOTS - r)) : map;
+        base = (base + 1 + (uint64_t)__builtin_ctzll(rot)) << LEVEL_SHIFT(l);
+        if (base < best)
+            best = base;
+    }
+    return best;
+}
+
+/* Run tick @tick, which next_event() returned; drops the lock around callbacks */
+static void run_tick(struct timer_wheel *w, uint64_t tick)
+{
+    struct timer **slot;
+    struct timer *t;
+
+    w->now = tick;
+
+    /* Every coarser wheel whose finer ones all turned over moves one slot down */
+    for (int l = 1; l < WHEEL_LEVELS && !((tick >> LEVEL_SHIFT(l - 1)) & SLOT_MASK); l++) {
+        unsigned int s = (unsigned int)((tick >> LEVEL_SHIFT(l)) & SLOT_MASK);
+        struct timer *list = w->slots[l][s];
+
+        w->slots[l][s] = NULL;
+        w->occupied[l] &= ~(1ULL << s);
+        while (list) {
+            t = list;
+            list = t->next;
+            link_timer(w, t);
+        }
+    }
+
+    /* Arming always lands past w->now, so this slot only drains */
+    slot = &w->slots[0][tick & SLOT_MASK];
+    while ((t = *slot) != NULL) {
+        unlink_timer(w, t);
+        if (t->period) {
+            t->expires = tick + t->period;
+            link_timer(w, t);
+        } else {
+            w->armed--;
+        }
+        w->running = t;
+        pthread_mutex_unlock(&w->lock);
+        t->fn(t->arg);
+        pthread_mutex_lock(&w->lock);
+        w->running = NULL;
+        w->fired++;
+        pthread_cond_broadcast(&w->done);
+    }
+}
+
+static void *wheel_main(void *arg)
+{
+    struct timer_wheel *w = arg;
+
+    pthread_mutex_lock(&w->lock);
+    while (!w->stop) {
+        uint64_t target = current_tick(w);
+        uint64_t next;
+
+        while (w->now < target && !w->stop) {
+            next = next_event(w);
+            if (next > target) {
+                w->now = target;
+                break;
+            }
+            run_tick(w, next);
+        }
+        if (w->stop)
+            break;
+
+        next = next_event(w);
+        w->sleep_until = next;
+        if (next == UINT64_MAX) {
+            pthread_cond_wait(&w->kick, &w->lock);
+        } else if (next > current_tick(w)) {
+            uint64_t ms = next * WHEEL_TICK_MS;
+            struct timespec deadline = {
+                .tv_sec = w->epoch.tv_sec + (time_t)(ms / 1000),
+                .tv_nsec = w->epoch.tv_nsec + (long)(ms % 1000) * 1000000L,
+            };
+
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&w->kick, &w->lock, &deadline);
+        }
+        w->sleep_until = UINT64_MAX;
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+void timer_init(struct timer *t, void (*fn)(void *arg), void *arg)
+{
+    memset(t, 0, sizeof(*t));
+    t->fn = fn;
+    t->arg = arg;
+}
+
+int wheel_start(struct timer_wheel *w)
+{
+    pthread_condattr_t attr;
+    sigset_t all, old;
+    int rc;
+
+    memset(w, 0, sizeof(*w));
+    w->sleep_until = UINT64_MAX;
+    clock_gettime(CLOCK_MONOTONIC, &w->epoch);
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&w->kick, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_cond_init(&w->done, NULL);
+
+    /* Leave signal delivery to the application's own threads */
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    rc = pthread_create(&w->tid, NULL, wheel_main, w);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (rc != 0) {
+        pthread_cond_destroy(&w->done);
+        pthread_cond_destroy(&w->kick);
+        pthread_mutex_destroy(&w->lock);
+        return -rc;
+    }
+    w->started = true;
+    return 0;
+}
+
+void wheel_stop(struct timer_wheel *w)
+{
+    if (!w->started)
+        return;
+    pthread_mutex_lock(&w->lock);
+    w->stop = true;
+    pthread_cond_signal(&w->kick);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->tid, NULL);
+    w->started = false;
+    pthread_cond_destroy(&w->done);
+    pthread_cond_destroy(&w->kick);
+    pthread_mutex_destroy(&w->lock);
+}
+
+void timer_arm(struct timer_wheel *w, struct timer *t, unsigned int delay_ms,
+               unsigned int period_ms)
+{
+    uint64_t delay = ms_to_ticks(delay_ms);
+
+    pthread_mutex_lock(&w->lock);
+    if (t->pprev)
+        unlink_timer(w, t);
+    else
+        w->armed++;
+    /* The current tick is partly over: one more so @t never fires early */
+    t->expires = current_tick(w) + delay + 1;
+    t->period = (unsigned int)ms_to_ticks(period_ms);
+    link_timer(w, t);
+    if (t->expires < w->sleep_until)
+        pthread_cond_signal(&w->kick);
+    pthread_mutex_unlock(&w->lock);
+}
+
+void timer_cancel(struct timer_wheel *w, struct timer *t)
+{
+    pthread_mutex_lock(&w->lock);
+    /* The callback may re-arm @t, so only unlink once it has returned */
+    while (w->running == t)
+        pthread_cond_wait(&w->done, &w->lock);
+    if (t->pprev) {
+        unlink_timer(w, t);
+        w->armed--;
+    }
+    pthread_mutex_unlock(&w->lock);
+}
+
+uint64_t wheel_clock_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
@@ -0,0 +1,79 @@
+/*
+ * wheel.h
+ *
+ * Hierarchical timer wheel for aesdsocket: one thread serves every
+ * connection deadline and periodic task. WHEEL_LEVELS wheels of WHEEL_SLOTS
+ * slots each hold timers due within 64, 64^2, ... ticks; a timer sits in the
+ * slot of its expiry tick at the finest level that reaches it and moves down
+ * a level whenever the coarser wheel turns over that slot. Arming and
+ * cancelling unlink or link one node, whatever the number of timers.
+ */
+
+#ifndef AESDSOCKET_WHEEL_H
+#define AESDSOCKET_WHEEL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#define WHEEL_TICK_MS 10
+#define WHEEL_BITS    6
+#define WHEEL_SLOTS   (1 << WHEEL_BITS)   // One bit each in a uint64_t occupancy map
+#define WHEEL_LEVELS  4                   // 64^4 ticks, about 46 hours; later expiries cascade again
+
+struct timer {
+    struct timer *next;
+    struct timer **pprev;             // NULL while not armed
+    uint64_t expires;                 // Tick to fire at
+    unsigned int period;              // Ticks between firings, 0 = once
+    uint8_t level, slot;
+    void (*fn)(void *arg);
+    void *arg;
+};
+
+struct timer_wheel {
+    pthread_mutex_t lock;
+    pthread_cond_t kick;              // CLOCK_MONOTONIC; an earlier expiry or stop
+    pthread_cond_t done;              // A callback returned
+    struct timespec epoch;            // Tick 0
+    uint64_t now;                     // Ticks already run
+    uint64_t sleep_until;             // Tick the thread waits for, UINT64_MAX with none
+    uint64_t occupied[WHEEL_LEVELS];  // Bit s set while slots[level][s] is not empty
+    struct timer *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    struct timer *running;            // Timer whose callback is running
+    pthread_t tid;
+    bool started;
+    bool stop;
+
+    _Atomic unsigned long armed;
+    _Atomic unsigned long fired;
+};
+
+void timer_init(struct timer *t, void (*fn)(void *arg), void *arg);
+
+/* Start the wheel's thread, which runs with all signals blocked. 0 or -errno */
+int wheel_start(struct timer_wheel *w);
+
+/* Join the thread; timers still armed never fire */
+void wheel_stop(struct timer_wheel *w);
+
+/*
+ * Fire @t once in @delay_ms, or every @period_ms from then on when that is
+ * not 0. Re-arming an armed timer moves it. Callbacks run on the wheel's
+ * thread and may arm any timer, their own included.
+ */
+void timer_arm(struct timer_wheel *w, struct timer *t, unsigned int delay_ms,
+               unsigned int period_ms);
+
+/*
+ * Disarm @t and wait for its callback if it is running, so @t and its
+ * argument may be freed on return. Not from @t's own callback.
+ */
+void timer_cancel(struct timer_wheel *w, struct timer *t);
+
+/* Milliseconds on the wheel's clock (CLOCK_MONOTONIC_COARSE), cheap enough per packet */
+uint64_t wheel_clock_ms(void);
+
+#endif /* AESDSOCKET_WHEEL_H */
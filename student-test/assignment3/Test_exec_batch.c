@@ -0,0 +1,116 @@
+#include "unity.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <sys/wait.h>
+#include "../../examples/systemcalls/systemcalls.h"
+
+/**
+* Checks do_exec_batch() in examples/systemcalls: each job's exit status,
+* spawn error, captured stdout and stderr and elapsed time, with commands
+* that fail, cannot start, write more than a pipe holds or leave a
+* grandchild running.
+*/
+
+#define SLEEP_JOBS 8
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void test_exec_batch_mixed_exit_codes()
+{
+    char *const ok[] = { "/bin/echo", "hello", NULL };
+    char *const three[] = { "/bin/sh", "-c", "echo out; echo err >&2; exit 3", NULL };
+    char *const killed[] = { "/bin/sh", "-c", "kill -TERM $$", NULL };
+    struct exec_job jobs[] = { { .argv = ok }, { .argv = three }, { .argv = killed } };
+
+    TEST_ASSERT_FALSE_MESSAGE(do_exec_batch(jobs, 3, 2), "A failing command must fail the batch");
+
+    TEST_ASSERT_TRUE(WIFEXITED(jobs[0].status) && WEXITSTATUS(jobs[0].status) == 0);
+    TEST_ASSERT_EQUAL_STRING("hello\n", jobs[0].out.data);
+    TEST_ASSERT_NULL_MESSAGE(jobs[0].err.data, "Nothing was written to stderr");
+
+    TEST_ASSERT_TRUE(WIFEXITED(jobs[1].status));
+    TEST_ASSERT_EQUAL_INT(3, WEXITSTATUS(jobs[1].status));
+    TEST_ASSERT_EQUAL_STRING("out\n", jobs[1].out.data);
+    TEST_ASSERT_EQUAL_STRING("err\n", jobs[1].err.data);
+
+    TEST_ASSERT_TRUE(WIFSIGNALED(jobs[2].status));
+    TEST_ASSERT_EQUAL_INT(SIGTERM, WTERMSIG(jobs[2].status));
+
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_EQUAL_INT(0, jobs[i].spawn_errno);
+        exec_job_release(&jobs[i]);
+    }
+}
+
+void test_exec_batch_spawn_error()
+{
+    char *const missing[] = { "/nonexistent/command", NULL };
+    char *const ok[] = { "/bin/true", NULL };
+    struct exec_job jobs[] = { { .argv = missing }, { .argv = ok } };
+
+    TEST_ASSERT_FALSE(do_exec_batch(jobs, 2, 1));
+    TEST_ASSERT_EQUAL_INT(-1, jobs[0].status);
+    TEST_ASSERT_EQUAL_INT(ENOENT, jobs[0].spawn_errno);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, jobs[1].status, "The job after a spawn error must still run");
+    exec_job_release(&jobs[0]);
+    exec_job_release(&jobs[1]);
+}
+
+void test_exec_batch_large_output()
+{
+    /* Several times a pipe's capacity on both streams at once */
+    char *const big[] = { "/bin/sh", "-c",
+                          "head -c 3000000 /dev/zero | tr '\\0' x; head -c 1000000 /dev/zero | tr '\\0' y >&2",
+                          NULL };
+    struct exec_job job = { .argv = big };
+
+    TEST_ASSERT_TRUE(do_exec_batch(&job, 1, 1));
+    TEST_ASSERT_EQUAL_UINT64(3000000, job.out.len);
+    TEST_ASSERT_EQUAL_UINT64(1000000, job.err.len);
+    TEST_ASSERT_FALSE(job.out.truncated || job.err.truncated);
+    TEST_ASSERT_EQUAL_CHAR('x', job.out.data[0]);
+    TEST_ASSERT_EQUAL_CHAR('x', job.out.data[2999999]);
+    TEST_ASSERT_EQUAL_CHAR('\0', job.out.data[3000000]);
+    TEST_ASSERT_EQUAL_CHAR('y', job.err.data[999999]);
+    exec_job_release(&job);
+}
+
+void test_exec_batch_grandchild()
+{
+    /* The background sleep keeps the output pipe open after the shell exits */
+    char *const bg[] = { "/bin/sh", "-c", "sleep 3 & echo bg", NULL };
+    struct exec_job job = { .argv = bg };
+    double start = now_s();
+
+    TEST_ASSERT_TRUE(do_exec_batch(&job, 1, 1));
+    TEST_ASSERT_TRUE_MESSAGE(now_s() - start < 2, "The batch waited for a grandchild");
+    TEST_ASSERT_EQUAL_STRING("bg\n", job.out.data);
+    exec_job_release(&job);
+}
+
+void test_exec_batch_elapsed()
+{
+    char *const nap[] = { "/bin/sleep", "0.3", NULL };
+    struct exec_job jobs[SLEEP_JOBS];
+
+    memset(jobs, 0, sizeof(jobs));
+    for (int i = 0; i < SLEEP_JOBS; i++)
+        jobs[i].argv = nap;
+
+    /* One at a time, so most runs cross a second boundary somewhere */
+    TEST_ASSERT_TRUE(do_exec_batch(jobs, SLEEP_JOBS, 1));
+    for (int i = 0; i < SLEEP_JOBS; i++) {
+        TEST_ASSERT_TRUE_MESSAGE(jobs[i].elapsed_us >= 300000, "elapsed_us below the sleep");
+        TEST_ASSERT_TRUE_MESSAGE(jobs[i].elapsed_us < 10000000, "elapsed_us out of range");
+        exec_job_release(&jobs[i]);
+    }
+}